@@ -11,11 +11,20 @@
  */
 
 #include "a_patch_distance.h"
+#include <math.h>
 
 APatchDistance::APatchDistance()
 {
 	_gaussian_sigma = 1.0;
 	_patch_size = Shape(7, 7);
+	_is_uniform_weighting = false;
+	_row_kernel = 0;
+	_search_precision = QuantizedPatches::Float;
+	_use_moment_bounds = false;
+	_use_moment_deviations = false;
+	_moment_norm = QuantizedPatches::SquaredDifference;
+	_moment_factor = 0.0f;
+	_sparse_stride = 1;
 }
 
 
@@ -23,7 +32,14 @@ APatchDistance::APatchDistance(Shape &patch_size, float gaussian_sigma)
 	: _patch_size(patch_size),
 	  _gaussian_sigma(gaussian_sigma)
 {
-
+	_is_uniform_weighting = false;
+	_row_kernel = 0;
+	_search_precision = QuantizedPatches::Float;
+	_use_moment_bounds = false;
+	_use_moment_deviations = false;
+	_moment_norm = QuantizedPatches::SquaredDifference;
+	_moment_factor = 0.0f;
+	_sparse_stride = 1;
 }
 
 
@@ -37,6 +53,65 @@ void APatchDistance::initialize(FixedImage<float> source, FixedImage<float> targ
 {
 	_source = source;
 	_target = target;
+
+	// NOTE: weights are calculated here, because calculate() may be called concurrently
+	if (_patch_weighting.is_empty()) {
+		_patch_weighting = GaussianWeights::calculate(_patch_size.size_x,
+													  _patch_size.size_y,
+													  _gaussian_sigma,
+													  _gaussian_sigma);
+		_is_uniform_weighting = is_uniform(_patch_weighting);
+	}
+
+	repeat_weights(_patch_weighting, source.get_number_of_channels(), _channel_weights);
+}
+
+
+/**
+ * Reinitializes the distance calculation. The default implementation initializes it for the whole images.
+ */
+void APatchDistance::reinitialize(FixedImage<float> source, FixedImage<float> target, FixedMask modified_region)
+{
+	initialize(source, target);
+}
+
+
+/**
+ * Calculates the distance with an early termination bound. The default implementation
+ * ignores the bound and calculates the exact distance.
+ */
+float APatchDistance::calculate(const Point &source_point,
+								const Point &target_point,
+								float bound)
+{
+	return calculate(source_point, target_point);
+}
+
+
+/**
+ * Calculates the distances one by one. The default implementation passes the current bound to
+ * the single distance calculation.
+ */
+void APatchDistance::calculate(const Point *source_points,
+							   int count,
+							   const Point &target_point,
+							   float bound,
+							   float *distances)
+{
+	for (int i = 0; i < count; i++) {
+		distances[i] = calculate(source_points[i], target_point, bound);
+		bound = std::min(bound, distances[i]);
+	}
+}
+
+
+/**
+ * Calculates the exact distance. The default implementation does not use the quantized images.
+ */
+float APatchDistance::calculate_exact(const Point &source_point,
+									  const Point &target_point)
+{
+	return calculate(source_point, target_point);
 }
 
 
@@ -76,5 +151,239 @@ void APatchDistance::set_patch_size(Shape patch_size)
 }
 
 
+FixedImage<float> APatchDistance::get_patch_weighting()
+{
+	return _patch_weighting;
+}
+
+
+QuantizedPatches::Precision APatchDistance::get_search_precision()
+{
+	return _search_precision;
+}
+
+
+/**
+ * Sets the precision of the images of the search: with Int16 or UInt8 the distances are calculated on
+ * the quantized copies of the images (approximately), calculate_exact() gives the exact distances.
+ */
+void APatchDistance::set_search_precision(QuantizedPatches::Precision precision)
+{
+	_search_precision = precision;
+}
+
+
+bool APatchDistance::is_moment_bounds_used()
+{
+	return _use_moment_bounds;
+}
+
+
+/**
+ * Enables the lower bounds of the distances by the weighted means (and the standard deviations, if requested,
+ * only for the L2 distances) of the patches, calculated once by initialize(). For the L2 distance of a channel
+ * sum w (a - b)^2 >= W ((mean_a - mean_b)^2 + (deviation_a - deviation_b)^2), for the L1 distance
+ * sum w |a - b| >= W |mean_a - mean_b|, where W is the sum of the weights. Thus a candidate, whose bound
+ * is not smaller than the current distance, can be rejected without the calculation of its distance.
+ */
+void APatchDistance::use_moment_bounds(bool value, bool use_deviations)
+{
+	_use_moment_bounds = value;
+	_use_moment_deviations = use_deviations;
+}
+
+
+/**
+ * Checks if the lower bounds can be used: the moments are calculated for the float images and the distances
+ * are not calculated on the quantized images (their approximate distances may be smaller than the bounds).
+ */
+bool APatchDistance::has_moment_bounds() const
+{
+	return !_source_moments.is_empty() && _quantized_patches.is_empty();
+}
+
+
+int APatchDistance::get_sparse_stride()
+{
+	return _sparse_stride;
+}
+
+
+/**
+ * Sets the stride of the sparse stage of the distance (1 to disable it): the distance is first estimated by
+ * every stride-th pixel of the patches in both directions (the lattice includes the center), and the full
+ * distance is calculated only for the candidates, whose estimate is smaller than the current distance.
+ *
+ * @note The estimate is not a bound, thus a better candidate may be rejected (the search is approximate).
+ */
+void APatchDistance::set_sparse_stride(int stride)
+{
+	_sparse_stride = std::max(stride, 1);
+}
+
+
+bool APatchDistance::has_sparse_stage() const
+{
+	return !_sparse_patches.is_empty();
+}
+
+
+/* Protected */
+
+APatchDistance::KernelRows::KernelRows(PatchDistanceKernels::RowKernel kernel,
+										const float *source_values,
+										int source_stride,
+										const float *target_patch,
+										int target_stride,
+										const float *weights,
+										int number_of_channels,
+										Shape patch_size)
+	: kernel(kernel),
+	  source_values(source_values),
+	  source_patch(source_values),
+	  target_patch(target_patch),
+	  weights(weights),
+	  source_stride(source_stride),
+	  target_stride(target_stride),
+	  number_of_channels(number_of_channels),
+	  row_length(number_of_channels * patch_size.size_x),
+	  radius_x(patch_size.size_x / 2),
+	  radius_y(patch_size.size_y / 2)
+{
+}
+
+
+APatchDistance::DecomposedRows::DecomposedRows(const KernelRows &dot_rows,
+												const PatchRowNorms &source_norms,
+												const PatchRowNorms &target_norms,
+												const Point &target_point)
+	: dot_rows(dot_rows),
+	  source_norms(&source_norms),
+	  target_norms(&target_norms),
+	  target_point(target_point)
+{
+}
+
+
+APatchDistance::QuantizedRows::QuantizedRows(const QuantizedPatches &patches, const Point &target_point)
+	: patches(&patches),
+	  source_offset(0),
+	  target_offset(patches.get_target_offset(target_point))
+{
+}
+
+
+/**
+ * Rows of the patches of the float images by the given kernel (and the weights repeated for every channel)
+ * for the target patch centered at the point.
+ */
+APatchDistance::KernelRows APatchDistance::get_kernel_rows(PatchDistanceKernels::RowKernel kernel, const Point &target_point) const
+{
+	int radius_x = _patch_size.size_x / 2;
+	int radius_y = _patch_size.size_y / 2;
+	int number_of_channels = _source.get_number_of_channels();
+	int source_stride = number_of_channels * _source.get_size_x();
+	int target_stride = number_of_channels * _target.get_size_x();
+
+	// NOTE: direct access - we sacrifice readability in favor of performance
+	const float *target_patch = _target.raw() + target_stride * (target_point.y - radius_y) + number_of_channels * (target_point.x - radius_x);
+
+	return KernelRows(kernel, _source.raw(), source_stride, target_patch, target_stride, &_channel_weights[0], number_of_channels, _patch_size);
+}
+
+
+/**
+ * Calculates the distances on the quantized images row by row (as the float distances of the derived classes)
+ * and stops as soon as the partial weighted sum exceeds the bound.
+ */
+void APatchDistance::calculate_quantized(const Point *source_points,
+										 int count,
+										 const Point &target_point,
+										 float bound,
+										 float *distances)
+{
+	QuantizedRows rows(_quantized_patches, target_point);
+	calculate_rows<float>(source_points, count, bound, rows, distances);
+}
+
+
+/**
+ * Checks if all weights are equal up to a relative difference of 1e-5 (e.g. Gaussian weights with the
+ * default sigma of 10000), so the weights can be replaced by a single factor.
+ */
+bool APatchDistance::is_uniform(FixedImage<float> patch_weighting)
+{
+	int size = patch_weighting.get_size_x() * patch_weighting.get_size_y();
+	const float *p_weight = patch_weighting.raw();
+
+	for (int i = 1; i < size; i++) {
+		if (fabs(p_weight[i] - p_weight[0]) > 1e-5f * fabs(p_weight[0])) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+/**
+ * Calculates the moments of the patches of the images (shared, if the target is the source), if the bounds are used.
+ */
+void APatchDistance::initialize_moments(FixedImage<float> source, FixedImage<float> target, QuantizedPatches::Norm norm)
+{
+	if (!_use_moment_bounds) {
+		set_moments(PatchMoments(), PatchMoments(), norm);
+		return;
+	}
+
+	// NOTE: the deviations give a tighter bound only for the L2 distances
+	bool use_deviations = _use_moment_deviations && norm == QuantizedPatches::SquaredDifference;
+	PatchMoments source_moments(source, _patch_weighting, use_deviations);
+	PatchMoments target_moments = (target == source) ? source_moments : PatchMoments(target, _patch_weighting, use_deviations);
+	set_moments(source_moments, target_moments, norm);
+}
+
+
+void APatchDistance::set_moments(PatchMoments source_moments, PatchMoments target_moments, QuantizedPatches::Norm norm)
+{
+	_source_moments = source_moments;
+	_target_moments = target_moments;
+	_moment_norm = norm;
+	_moment_factor = source_moments.get_weights_sum() / (_patch_size.size_x * _patch_size.size_y);
+}
+
+
+/**
+ * Recalculates the moments around the modified region of the image shared by the source and the target.
+ */
+void APatchDistance::refresh_moments(FixedMask modified_region, int margin)
+{
+	if (!_source_moments.is_empty()) {
+		// NOTE: the target moments share the tables of the source moments
+		_source_moments.refresh(modified_region, margin);
+	}
+}
+
+
+/**
+ * Repeats every weight of the patch for every channel, so the weights of a patch row
+ * match the values of the row in an image with interleaved channels.
+ */
+void APatchDistance::repeat_weights(FixedImage<float> patch_weighting,
+									int number_of_channels,
+									std::vector<float> &weights)
+{
+	int size = patch_weighting.get_size_x() * patch_weighting.get_size_y();
+	const float *p_weight = patch_weighting.raw();
+
+	weights.resize(size * number_of_channels);
+	for (int i = 0; i < size; i++) {
+		for (int ch = 0; ch < number_of_channels; ch++) {
+			weights[number_of_channels * i + ch] = p_weight[i];
+		}
+	}
+}
+
+
 
 
@@ -13,8 +13,17 @@
 #ifndef A_PATCH_DISTANCE_H_
 #define A_PATCH_DISTANCE_H_
 
+#include <math.h>
+#include <limits>
+#include <vector>
 #include "gaussian_weights.h"
 #include "image.h"
+#include "mask.h"
+#include "patch_distance_kernels.h"
+#include "patch_moments.h"
+#include "patch_row_norms.h"
+#include "quantized_patches.h"
+#include "sparse_patches.h"
 
 /**
  * Abstract base class for different patch distance calculation
@@ -31,14 +40,90 @@ public:
 
 	virtual void initialize(FixedImage<float> source, FixedImage<float> target);
 
+	// Same as initialize() for the images of the previous call, which were modified only inside the given region
+	// (e.g. by an iteration of the inpainting), so the data calculated from the images may be updated only there.
+	virtual void reinitialize(FixedImage<float> source, FixedImage<float> target, FixedMask modified_region);
+
 	virtual float calculate(const Point &source_point,
 							const Point &target_point) = 0;
 
+	// Same as above, but the calculation may stop as soon as the distance exceeds the given bound.
+	// In this case the returned value is not smaller than the bound, but it is not the exact distance.
+	virtual float calculate(const Point &source_point,
+							const Point &target_point,
+							float bound);
+
+	// Calculates distances from the target patch to 'count' source patches (e.g. all candidates of the random search).
+	// Every calculated distance tightens the bound for the following ones, thus only the distances smaller than
+	// the bound and all the previous distances are exact.
+	virtual void calculate(const Point *source_points,
+						   int count,
+						   const Point &target_point,
+						   float bound,
+						   float *distances);
+
+	// Exact distance (in floats), if the distances above are calculated on the quantized images (see set_search_precision()).
+	virtual float calculate_exact(const Point &source_point,
+								  const Point &target_point);
+
 	/// getters and setters for parameters
 	float get_gaussian_sigma();
 	void set_gaussian_sigma(float gaussian_sigma);
 	Shape get_patch_size();
 	void set_patch_size(Shape patch_size);
+	FixedImage<float> get_patch_weighting();	// NOTE: calculated by initialize()
+	QuantizedPatches::Precision get_search_precision();
+	void set_search_precision(QuantizedPatches::Precision precision);	// NOTE: used by the next initialize()
+	bool is_moment_bounds_used();
+	void use_moment_bounds(bool value = true, bool use_deviations = false);	// NOTE: used by the next initialize()
+
+	// The lower bounds are available (calculated by initialize() and not replaced by the quantized search).
+	bool has_moment_bounds() const;
+
+	/// Lower bound of the distance by the moments of the patches (see use_moment_bounds()).
+	inline float calculate_lower_bound(const Point &source_point, const Point &target_point) const
+	{
+		int number_of_channels = _source_moments.get_number_of_channels();
+		const float *source_means = _source_moments.get_means(source_point);
+		const float *target_means = _target_moments.get_means(target_point);
+
+		float bound = 0.0f;
+		if (_moment_norm == QuantizedPatches::AbsoluteDifference) {
+			for (int ch = 0; ch < number_of_channels; ch++) {
+				bound += fabsf(source_means[ch] - target_means[ch]);
+			}
+		} else {
+			for (int ch = 0; ch < number_of_channels; ch++) {
+				float difference = source_means[ch] - target_means[ch];
+				bound += difference * difference;
+			}
+			if (_source_moments.has_deviations()) {
+				const float *source_deviations = _source_moments.get_deviations(source_point);
+				const float *target_deviations = _target_moments.get_deviations(target_point);
+				for (int ch = 0; ch < number_of_channels; ch++) {
+					float difference = source_deviations[ch] - target_deviations[ch];
+					bound += difference * difference;
+				}
+			}
+		}
+
+		return _moment_factor * bound;
+	}
+
+	int get_sparse_stride();
+	void set_sparse_stride(int stride);	// NOTE: used by the next initialize()
+
+	// The sparse stage is available (the stride is larger than 1 and the lattice is calculated by initialize()).
+	bool has_sparse_stage() const;
+
+	/// Estimate of the distance by the sparse lattice of the patches (see set_sparse_stride()), the summation
+	/// stops as soon as the partial sum exceeds the bound.
+	inline float calculate_sparse(const Point &source_point, const Point &target_point, float bound) const
+	{
+		return _sparse_patches.calculate(source_point, target_point, bound);
+	}
+
+	static bool is_uniform(FixedImage<float> patch_weighting);
 
 protected:
 	FixedImage<float> _source;
@@ -46,7 +131,194 @@ protected:
 	Image<float> _patch_weighting;
 	Shape _patch_size;
 	float _gaussian_sigma;
+	// patch weights repeated for every channel (for the row kernels)
+	std::vector<float> _channel_weights;
+	// all weights are (nearly) equal, e.g. for a large sigma (NOTE: calculated by initialize())
+	bool _is_uniform_weighting;
+	// row kernel selected for the patch size and the number of channels (by initialize() of the derived class)
+	PatchDistanceKernels::RowKernel _row_kernel;
+	// quantized images of the search (empty for the float precision, built by initialize() of the derived class)
+	QuantizedPatches::Precision _search_precision;
+	QuantizedPatches _quantized_patches;
+	// moments of the patches for the lower bounds of the distances (empty, if the bounds are not used)
+	bool _use_moment_bounds;
+	bool _use_moment_deviations;
+	PatchMoments _source_moments;
+	PatchMoments _target_moments;
+	QuantizedPatches::Norm _moment_norm;
+	float _moment_factor;		// sum of the patch weights per patch area
+	// sparse stage of the distance (empty, if the stride is 1, built by initialize() of the derived class)
+	int _sparse_stride;
+	SparsePatches _sparse_patches;
+
+	/// Weighted sums over the rows of the patches of the float images (or features) with interleaved channels by a row kernel.
+	struct KernelRows
+	{
+		KernelRows(PatchDistanceKernels::RowKernel kernel,
+				   const float *source_values,
+				   int source_stride,
+				   const float *target_patch,
+				   int target_stride,
+				   const float *weights,
+				   int number_of_channels,
+				   Shape patch_size);
+
+		inline void start(const Point &source_point)
+		{
+			source_patch = source_values + source_stride * (source_point.y - radius_y) + number_of_channels * (source_point.x - radius_x);
+		}
+
+		inline float operator()(int row) const
+		{
+			return kernel(source_patch + source_stride * row, target_patch + target_stride * row, weights + row_length * row, row_length);
+		}
+
+		PatchDistanceKernels::RowKernel kernel;
+		const float *source_values;
+		const float *source_patch;
+		const float *target_patch;
+		const float *weights;
+		int source_stride;
+		int target_stride;
+		int number_of_channels;
+		int row_length;
+		int radius_x;
+		int radius_y;
+	};
+
+	/// Same as above, but every row is the sum of the norms of the rows minus the doubled dot product (see PatchRowNorms).
+	struct DecomposedRows
+	{
+		DecomposedRows(const KernelRows &dot_rows,
+					   const PatchRowNorms &source_norms,
+					   const PatchRowNorms &target_norms,
+					   const Point &target_point);
+
+		inline void start(const Point &source_point)
+		{
+			dot_rows.start(source_point);
+			this->source_point = source_point;
+		}
+
+		inline float operator()(int row) const
+		{
+			return source_norms->get(source_point, row) + target_norms->get(target_point, row) - 2.0f * dot_rows(row);
+		}
+
+		KernelRows dot_rows;
+		const PatchRowNorms *source_norms;
+		const PatchRowNorms *target_norms;
+		Point source_point;
+		Point target_point;
+	};
+
+	/// Weighted sums over the rows of the patches of the quantized images.
+	struct QuantizedRows
+	{
+		QuantizedRows(const QuantizedPatches &patches, const Point &target_point);
+
+		inline void start(const Point &source_point)
+		{
+			source_offset = patches->get_source_offset(source_point);
+		}
+
+		inline float operator()(int row) const
+		{
+			return patches->calculate_row(source_offset, target_offset, row);
+		}
+
+		const QuantizedPatches *patches;
+		int source_offset;
+		int target_offset;
+	};
+
+	/// Rows of two terms weighted by lambda and 1 - lambda (e.g. of the intensities and of the gradients).
+	template <class First, class Second>
+	struct CombinedRows
+	{
+		CombinedRows(const First &first, const Second &second, double lambda)
+			: first(first), second(second), lambda(lambda) { }
+
+		inline void start(const Point &source_point)
+		{
+			first.start(source_point);
+			second.start(source_point);
+		}
+
+		inline double operator()(int row) const
+		{
+			return lambda * first(row) + (1 - lambda) * second(row);
+		}
+
+		First first;
+		Second second;
+		double lambda;
+	};
+
+	KernelRows get_kernel_rows(PatchDistanceKernels::RowKernel kernel, const Point &target_point) const;
+
+	template <class Sum, class Rows>
+	inline void calculate_rows(const Point *source_points,
+							   int count,
+							   float bound,
+							   Rows &rows,
+							   float *distances) const;
+
+	void calculate_quantized(const Point *source_points,
+							 int count,
+							 const Point &target_point,
+							 float bound,
+							 float *distances);
+
+	void initialize_moments(FixedImage<float> source, FixedImage<float> target, QuantizedPatches::Norm norm);
+	void set_moments(PatchMoments source_moments, PatchMoments target_moments, QuantizedPatches::Norm norm);
+	void refresh_moments(FixedMask modified_region, int margin = 0);
+
+	static void repeat_weights(FixedImage<float> patch_weighting,
+							   int number_of_channels,
+							   std::vector<float> &weights);
 };
 
 
+/**
+ * Calculates the distances of the candidates row by row (the sums over the rows are given by 'rows', see KernelRows)
+ * and stops as soon as the partial sum exceeds the bound. A stopped distance is not smaller than the bound, every
+ * calculated distance tightens the bound for the following candidates.
+ *
+ * @tparam Sum Type of the partial sums (double for the sums of two terms).
+ */
+template <class Sum, class Rows>
+inline void APatchDistance::calculate_rows(const Point *source_points,
+										   int count,
+										   float bound,
+										   Rows &rows,
+										   float *distances) const
+{
+	// NOTE: the partial sum is compared with the bound scaled back to the sum of the weighted norms
+	Sum patch_area = _patch_size.size_x * _patch_size.size_y;
+
+	for (int i = 0; i < count; i++) {
+		rows.start(source_points[i]);
+		Sum scaled_bound = (Sum)bound * patch_area;
+
+		Sum distance = 0;
+		bool is_aborted = false;
+		for (int row = 0; row < (int)_patch_size.size_y && !is_aborted; row++) {
+			distance += rows(row);
+			is_aborted = distance >= scaled_bound;
+		}
+
+		// NOTE: the rounding errors of the norm decomposition may give a (small) negative distance
+		distance = std::max(distance, (Sum)0);
+
+		if (is_aborted) {
+			distances[i] = std::max(bound, (float)(distance / patch_area));
+		} else {
+			distances[i] = distance / patch_area;
+			bound = std::min(bound, distances[i]);
+		}
+	}
+}
+
+
 #endif /* A_PATCH_DISTANCE_H_ */
@@ -0,0 +1,155 @@
+/**
+ * Copyright (C) 2015, Vadim Fedorov <vadim.fedorov@upf.edu>
+ * Copyright (C) 2015, Gabriele Facciolo <facciolo@ens-cachan.fr>
+ * Copyright (C) 2015, Pablo Arias <pablo.arias@cmla.ens-cachan.fr>
+ *
+ * This program is free software: you can use, modify and/or
+ * redistribute it under the terms of the simplified BSD
+ * License. You should have received a copy of this license along
+ * this program. If not, see
+ * <http://www.opensource.org/licenses/bsd-license.html>.
+ */
+
+#ifndef CANDIDATE_MEMO_H_
+#define CANDIDATE_MEMO_H_
+
+#include <stdint.h>
+#include <vector>
+#include "point.h"
+
+/**
+ * Small open-addressing table of the distances of recently evaluated (source, target) pairs, one per
+ * thread of PatchMatch, so the candidates proposed again (e.g. by the propagation from a neighbor, whose
+ * match has not changed) are not evaluated again. A pair is hashed to a group of 4 slots, the oldest
+ * entry of a full group is replaced.
+ *
+ * @note Definitions are in header in order to allow inlining in hot loops.
+ */
+class CandidateMemo
+{
+public:
+	inline CandidateMemo();
+	inline explicit CandidateMemo(int size);
+
+	/// Finds the distance stored for the pair, returns false if there is none.
+	inline bool find(const Point &source_point, const Point &target_point, float &distance) const;
+
+	inline void store(const Point &source_point, const Point &target_point, float distance);
+
+	inline void clear();
+
+private:
+	struct Entry
+	{
+		uint64_t key;
+		float distance;
+	};
+
+	static const uint64_t EMPTY_KEY = ~0ULL;
+	static const int GROUP_SIZE = 4;
+
+	std::vector<Entry> _entries;
+	uint64_t _group_mask;
+	int _group_shift;
+
+	static inline uint64_t make_key(const Point &source_point, const Point &target_point);
+	inline int get_group(uint64_t key) const;
+};
+
+
+inline CandidateMemo::CandidateMemo()
+{
+	_group_mask = 0;
+	_group_shift = 64;
+}
+
+
+/**
+ * @param size Number of entries, rounded up to a power of two (at least one group).
+ */
+inline CandidateMemo::CandidateMemo(int size)
+{
+	int groups_count = 1;
+	int bits = 0;
+	while (GROUP_SIZE * groups_count < size) {
+		groups_count *= 2;
+		bits++;
+	}
+
+	_group_mask = groups_count - 1;
+	_group_shift = 64 - bits;
+	_entries.resize(GROUP_SIZE * groups_count);
+	clear();
+}
+
+
+inline bool CandidateMemo::find(const Point &source_point, const Point &target_point, float &distance) const
+{
+	uint64_t key = make_key(source_point, target_point);
+	const Entry *group = &_entries[GROUP_SIZE * get_group(key)];
+	for (int i = 0; i < GROUP_SIZE; i++) {
+		if (group[i].key == key) {
+			distance = group[i].distance;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
+/**
+ * Stores the distance of the pair: the entries of the group are shifted by one (the last one is dropped),
+ * so the group is ordered from the newest to the oldest entry.
+ */
+inline void CandidateMemo::store(const Point &source_point, const Point &target_point, float distance)
+{
+	uint64_t key = make_key(source_point, target_point);
+	Entry *group = &_entries[GROUP_SIZE * get_group(key)];
+
+	int last = GROUP_SIZE - 1;
+	for (int i = 0; i < GROUP_SIZE - 1; i++) {
+		if (group[i].key == key) {
+			last = i;
+			break;
+		}
+	}
+	for (int i = last; i > 0; i--) {
+		group[i] = group[i - 1];
+	}
+
+	group[0].key = key;
+	group[0].distance = distance;
+}
+
+
+inline void CandidateMemo::clear()
+{
+	for (unsigned int i = 0; i < _entries.size(); i++) {
+		_entries[i].key = EMPTY_KEY;
+	}
+}
+
+
+/**
+ * Packs the coordinates (16 bits each, the images are smaller than 65535 pixels in each direction).
+ */
+inline uint64_t CandidateMemo::make_key(const Point &source_point, const Point &target_point)
+{
+	return (uint64_t)(uint16_t)source_point.x |
+		   ((uint64_t)(uint16_t)source_point.y << 16) |
+		   ((uint64_t)(uint16_t)target_point.x << 32) |
+		   ((uint64_t)(uint16_t)target_point.y << 48);
+}
+
+
+/**
+ * Fibonacci hashing of the key (the upper bits of the product).
+ */
+inline int CandidateMemo::get_group(uint64_t key) const
+{
+	return (_group_shift < 64) ? (int)(((key * 0x9E3779B97F4A7C15ULL) >> _group_shift) & _group_mask) : 0;
+}
+
+
+#endif /* CANDIDATE_MEMO_H_ */
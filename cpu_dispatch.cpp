@@ -0,0 +1,126 @@
+/**
+ * Copyright (C) 2015, Vadim Fedorov <vadim.fedorov@upf.edu>
+ * Copyright (C) 2015, Gabriele Facciolo <facciolo@ens-cachan.fr>
+ * Copyright (C) 2015, Pablo Arias <pablo.arias@cmla.ens-cachan.fr>
+ *
+ * This program is free software: you can use, modify and/or
+ * redistribute it under the terms of the simplified BSD
+ * License. You should have received a copy of this license along
+ * this program. If not, see
+ * <http://www.opensource.org/licenses/bsd-license.html>.
+ */
+
+#include "cpu_dispatch.h"
+
+// NOTE: resolved before main(), thus the kernels never change while they are used
+CpuDispatch::Isa CpuDispatch::_isa = CpuDispatch::get_supported_isa();
+
+
+/**
+ * Returns the best instruction set supported by the CPU (and compiled).
+ */
+CpuDispatch::Isa CpuDispatch::get_supported_isa()
+{
+	if (is_supported(AVX2)) {
+		return AVX2;
+	}
+	if (is_supported(SSE2)) {
+		return SSE2;
+	}
+	return Scalar;
+}
+
+
+bool CpuDispatch::is_supported(Isa isa)
+{
+	if (!get_kernels(isa).is_compiled) {
+		return false;
+	}
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+	// NOTE: required, since this function is called before the constructors of the runtime
+	__builtin_cpu_init();
+
+	switch (isa) {
+	case AVX2:
+		return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+	case SSE2:
+		return __builtin_cpu_supports("sse2");
+	default:
+		return true;
+	}
+#else
+	return isa == Scalar;
+#endif
+}
+
+
+CpuDispatch::Isa CpuDispatch::get_isa()
+{
+	return _isa;
+}
+
+
+/**
+ * Overrides the instruction set of the kernels. Should be called before the kernels are used
+ * (e.g. at startup), since the kernels of the patch distances are selected once per image.
+ *
+ * @return False, if the instruction set is not supported (the current one is kept).
+ */
+bool CpuDispatch::set_isa(Isa isa)
+{
+	if (!is_supported(isa)) {
+		return false;
+	}
+
+	_isa = isa;
+	return true;
+}
+
+
+const SimdKernels& CpuDispatch::get_kernels()
+{
+	return get_kernels(_isa);
+}
+
+
+/**
+ * Parses the name of the instruction set ("scalar", "sse2" or "avx2").
+ *
+ * @return False, if the name is unknown.
+ */
+bool CpuDispatch::parse_isa(const string &name, Isa &isa)
+{
+	if (name.compare("scalar") == 0) {
+		isa = Scalar;
+	} else if (name.compare("sse2") == 0) {
+		isa = SSE2;
+	} else if (name.compare("avx2") == 0) {
+		isa = AVX2;
+	} else {
+		return false;
+	}
+
+	return true;
+}
+
+
+const char* CpuDispatch::get_isa_name(Isa isa)
+{
+	return get_kernels(isa).name;
+}
+
+
+/* Private */
+
+const SimdKernels& CpuDispatch::get_kernels(Isa isa)
+{
+	switch (isa) {
+	case AVX2:
+		return AVX2_SIMD_KERNELS;
+	case SSE2:
+		return SSE2_SIMD_KERNELS;
+	default:
+		return SCALAR_SIMD_KERNELS;
+	}
+}
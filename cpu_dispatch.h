@@ -0,0 +1,52 @@
+/**
+ * Copyright (C) 2015, Vadim Fedorov <vadim.fedorov@upf.edu>
+ * Copyright (C) 2015, Gabriele Facciolo <facciolo@ens-cachan.fr>
+ * Copyright (C) 2015, Pablo Arias <pablo.arias@cmla.ens-cachan.fr>
+ *
+ * This program is free software: you can use, modify and/or
+ * redistribute it under the terms of the simplified BSD
+ * License. You should have received a copy of this license along
+ * this program. If not, see
+ * <http://www.opensource.org/licenses/bsd-license.html>.
+ */
+
+#ifndef CPU_DISPATCH_H_
+#define CPU_DISPATCH_H_
+
+#include <string>
+#include "simd_kernels.h"
+
+using namespace std;
+
+/**
+ * Selects the instruction set of the hot kernels (patch distances, accumulation of the
+ * patches, Poisson stencil and separable convolution) at runtime: the best one supported
+ * by the CPU is resolved once at startup and can be overridden (e.g. for benchmarking).
+ */
+class CpuDispatch
+{
+public:
+	enum Isa {
+		Scalar,		// reference kernels (no vector instructions)
+		SSE2,
+		AVX2		// AVX2 and FMA
+	};
+
+	static Isa get_supported_isa();
+	static bool is_supported(Isa isa);
+
+	static Isa get_isa();
+	static bool set_isa(Isa isa);
+	static const SimdKernels& get_kernels();
+
+	static bool parse_isa(const string &name, Isa &isa);
+	static const char* get_isa_name(Isa isa);
+
+private:
+	static Isa _isa;
+
+	static const SimdKernels& get_kernels(Isa isa);
+};
+
+
+#endif /* CPU_DISPATCH_H_ */
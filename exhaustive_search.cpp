@@ -0,0 +1,280 @@
+/**
+ * Copyright (C) 2015, Vadim Fedorov <vadim.fedorov@upf.edu>
+ * Copyright (C) 2015, Gabriele Facciolo <facciolo@ens-cachan.fr>
+ * Copyright (C) 2015, Pablo Arias <pablo.arias@cmla.ens-cachan.fr>
+ *
+ * This program is free software: you can use, modify and/or
+ * redistribute it under the terms of the simplified BSD
+ * License. You should have received a copy of this license along
+ * this program. If not, see
+ * <http://www.opensource.org/licenses/bsd-license.html>.
+ */
+
+#include "exhaustive_search.h"
+
+const int ExhaustiveSearch::BATCH_SIZE;
+
+ExhaustiveSearch::ExhaustiveSearch()
+{
+	_distance_calculation = 0;
+	_distance_evaluations = 0;
+	_searched_points = 0;
+	_refreshed_points = 0;
+}
+
+
+ExhaustiveSearch::ExhaustiveSearch(APatchDistance *distance_calculation)
+{
+	_distance_calculation = distance_calculation;
+	_distance_evaluations = 0;
+	_searched_points = 0;
+	_refreshed_points = 0;
+}
+
+
+/**
+ * Calculates the exact nearest neighbors field. If the given field is the one returned by the previous call
+ * and the changed region is given, only target points affected by the changes are searched again: the target
+ * points whose patches or whose nearest neighbors' patches overlap the changed region are compared with all
+ * source patches, the other ones only with the source patches overlapping the changed region (the distances
+ * to the rest are the same as in the previous call).
+ *
+ * @note With a quantized search precision (see APatchDistance::set_search_precision()) the nearest neighbors
+ *       minimize the distances on the quantized images, only their distances are exact. The quantization
+ *       changes with the images, thus every call searches all target points then.
+ *
+ * @param initial_field Initial nearest neighbors field (optional), its distances are the initial bounds.
+ * @param changed_region Pixels changed since the previous call (optional).
+ * @param scale_context Source data prepared for the distance calculation and the images (optional, see PatchMatch::calculate()).
+ */
+Image<Point> ExhaustiveSearch::calculate(FixedImage<float> source,
+										 FixedMask source_mask,
+										 FixedImage<float> target,
+										 FixedMask target_mask,
+										 Image<Point> initial_field,
+										 FixedMask changed_region,
+										 const ScaleContext *scale_context)
+{
+	if ((source.get_size() != source_mask.get_size()) ||
+			(target.get_size() != target_mask.get_size()) ||
+			!_distance_calculation) {
+		return Image<Point>();
+	}
+
+	_distance_evaluations = 0;
+	_searched_points = 0;
+	_refreshed_points = 0;
+
+	// Initialize distance calculation and collect the valid source points, unless they were prepared by the caller
+	ScaleContext own_context;
+	if (!scale_context || !scale_context->is_prepared_for(_distance_calculation, source, source_mask, target)) {
+		own_context = ScaleContext(_distance_calculation, source, source_mask, target);
+		scale_context = &own_context;
+	}
+
+	// Allocate memory for nearest neighbors and distances
+	Shape target_shape = target.get_size();
+	Image<float> distances(target_shape.size_x, target_shape.size_y, numeric_limits<float>::max());
+	Image<Point> neighbors(target_shape.size_x, target_shape.size_y, Point(-1, -1));
+
+	const vector<Point> &source_points = scale_context->get_source_points();
+	vector<Point> target_points = target_mask.get_masked_points();
+	bool is_quantized = (_distance_calculation->get_search_precision() != QuantizedPatches::Float);
+
+	// Points to be searched: the first ones are compared with all source points, the refreshed ones only with
+	// the affected source points. The rest keeps the result of the previous call.
+	vector<Point> searched_points, affected_source_points;
+	int refreshed_count = 0;
+	if (!is_quantized && can_refresh_field(source_mask, target_mask, initial_field, changed_region)) {
+		for (uint i = 0; i < target_points.size(); i++) {
+			Point p = target_points[i];
+			neighbors(p) = _previous_neighbors(p);
+			distances(p) = _previous_distances(p);
+		}
+
+		vector<Point> refreshed_points;
+		get_affected_points(changed_region, source_mask, source_points, target_points, affected_source_points, searched_points, refreshed_points);
+		refreshed_count = refreshed_points.size();
+		searched_points.insert(searched_points.end(), refreshed_points.begin(), refreshed_points.end());
+	} else {
+		searched_points = target_points;
+	}
+	int fully_searched_count = searched_points.size() - refreshed_count;
+
+	long distance_evaluations = 0;
+
+	#pragma omp parallel for schedule(dynamic, 16) reduction(+:distance_evaluations)
+	for (int i = 0; i < (int)searched_points.size(); i++) {
+		Point p = searched_points[i];
+		Point neighbor(-1, -1);
+		float distance = numeric_limits<float>::max();
+
+		// start with the bound given by the initial field
+		if (initial_field.is_not_empty() && source_mask.test(initial_field(p).x, initial_field(p).y)) {
+			neighbor = initial_field(p);
+			distance = _distance_calculation->calculate(neighbor, p);
+			distance_evaluations++;
+		}
+
+		const vector<Point> &candidates = (i < fully_searched_count) ? source_points : affected_source_points;
+		distance_evaluations += search_point(p, candidates, neighbor, distance);
+
+		// the search on the quantized images gives the approximate distance of the nearest neighbor
+		if (is_quantized && source_mask.test(neighbor.x, neighbor.y)) {
+			distance = _distance_calculation->calculate_exact(neighbor, p);
+		}
+
+		neighbors(p) = neighbor;
+		distances(p) = distance;
+	}
+
+	_distance_evaluations = distance_evaluations;
+	_searched_points = fully_searched_count;
+	_refreshed_points = refreshed_count;
+
+	// Keep the state for the incremental refresh in the next call
+	_previous_neighbors = neighbors;
+	_previous_distances = distances;
+	_previous_source_mask = source_mask;
+	_previous_target_mask = target_mask;
+
+	return neighbors;
+}
+
+
+/**
+ * Checks if the state of the previous call can be reused: the masks are the same objects and the initial
+ * field is the one returned by the previous call.
+ */
+bool ExhaustiveSearch::can_refresh_field(FixedMask source_mask,
+										 FixedMask target_mask,
+										 FixedImage<Point> initial_field,
+										 FixedMask changed_region)
+{
+	return changed_region.is_not_empty() &&
+			initial_field.is_not_empty() &&
+			_previous_neighbors.is_not_empty() &&
+			initial_field == _previous_neighbors &&
+			source_mask == _previous_source_mask &&
+			target_mask == _previous_target_mask;
+}
+
+
+/**
+ * Splits the target points by the changes since the previous call: the searched points (their patches or the patches
+ * of their nearest neighbors overlap the changed region) and the refreshed points (only the distances to the affected
+ * source points have changed). The target points are left out, if no source point is affected.
+ *
+ * @param affected_source_points Source points whose patches overlap the changed region.
+ */
+void ExhaustiveSearch::get_affected_points(FixedMask changed_region,
+										   FixedMask source_mask,
+										   const vector<Point> &source_points,
+										   const vector<Point> &target_points,
+										   vector<Point> &affected_source_points,
+										   vector<Point> &searched_points,
+										   vector<Point> &refreshed_points)
+{
+	Shape shape = changed_region.get_size();
+	Shape patch_size = _distance_calculation->get_patch_size();
+
+	// Mark centers of the patches overlapping the changed region.
+	// NOTE: one more pixel is added to the patch radius for the features computed by forward differences.
+	int radius_x = patch_size.size_x / 2 + 1;
+	int radius_y = patch_size.size_y / 2 + 1;
+	Mask affected(shape, false);
+	FixedMask::iterator it;
+	for (it = changed_region.begin(); it != changed_region.end(); ++it) {
+		int x_begin = max(0, (*it).x - radius_x);
+		int x_end = min((int)shape.size_x - 1, (*it).x + radius_x);
+		int y_begin = max(0, (*it).y - radius_y);
+		int y_end = min((int)shape.size_y - 1, (*it).y + radius_y);
+		for (int y = y_begin; y <= y_end; y++) {
+			for (int x = x_begin; x <= x_end; x++) {
+				affected.mask(x, y);
+			}
+		}
+	}
+
+	for (uint i = 0; i < source_points.size(); i++) {
+		if (affected.test(source_points[i].x, source_points[i].y)) {
+			affected_source_points.push_back(source_points[i]);
+		}
+	}
+
+	for (uint i = 0; i < target_points.size(); i++) {
+		Point p = target_points[i];
+		Point neighbor = _previous_neighbors(p);
+		if (affected.test(p.x, p.y) || !source_mask.test(neighbor.x, neighbor.y) || affected.test(neighbor.x, neighbor.y)) {
+			searched_points.push_back(p);
+		} else if (!affected_source_points.empty()) {
+			refreshed_points.push_back(p);
+		}
+	}
+}
+
+
+/**
+ * Compares the target patch with the given source patches. The given neighbor is replaced only by a strictly
+ * closer one, thus ties are resolved in favor of the initial neighbor and then in the scanline order.
+ *
+ * @param neighbor Current nearest neighbor (updated).
+ * @param distance Distance to the current nearest neighbor (updated), the bound of the early termination.
+ * @return Number of distance evaluations.
+ */
+long ExhaustiveSearch::search_point(const Point &target_point,
+									const vector<Point> &source_points,
+									Point &neighbor,
+									float &distance)
+{
+	float candidate_distances[BATCH_SIZE];
+	int source_count = source_points.size();
+
+	for (int begin = 0; begin < source_count; begin += BATCH_SIZE) {
+		int count = min(BATCH_SIZE, source_count - begin);
+
+		// NOTE: the bound is tightened inside the batch in the same order, thus the strict comparison
+		//       below selects exactly the candidates whose distances are exact
+		_distance_calculation->calculate(&source_points[begin], count, target_point, distance, candidate_distances);
+		for (int k = 0; k < count; k++) {
+			if (candidate_distances[k] < distance) {
+				distance = candidate_distances[k];
+				neighbor = source_points[begin + k];
+			}
+		}
+	}
+
+	return source_count;
+}
+
+
+/* Getters and setters */
+
+APatchDistance* ExhaustiveSearch::get_distance_calculation()
+{
+	return _distance_calculation;
+}
+
+
+void ExhaustiveSearch::set_distance_calculation(APatchDistance *distance_calculation)
+{
+	_distance_calculation = distance_calculation;
+}
+
+
+long ExhaustiveSearch::get_distance_evaluations_metric()
+{
+	return _distance_evaluations;
+}
+
+
+int ExhaustiveSearch::get_searched_points_metric()
+{
+	return _searched_points;
+}
+
+
+int ExhaustiveSearch::get_refreshed_points_metric()
+{
+	return _refreshed_points;
+}
@@ -0,0 +1,96 @@
+/**
+ * Copyright (C) 2015, Vadim Fedorov <vadim.fedorov@upf.edu>
+ * Copyright (C) 2015, Gabriele Facciolo <facciolo@ens-cachan.fr>
+ * Copyright (C) 2015, Pablo Arias <pablo.arias@cmla.ens-cachan.fr>
+ *
+ * This program is free software: you can use, modify and/or
+ * redistribute it under the terms of the simplified BSD
+ * License. You should have received a copy of this license along
+ * this program. If not, see
+ * <http://www.opensource.org/licenses/bsd-license.html>.
+ */
+
+#ifndef EXHAUSTIVE_SEARCH_H_
+#define EXHAUSTIVE_SEARCH_H_
+
+#include <vector>
+#include <limits>
+#include "image.h"
+#include "mask.h"
+#include "point.h"
+#include "a_patch_distance.h"
+#include "scale_context.h"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+using namespace std;
+
+/**
+ * Exact nearest neighbors field: every target patch is compared with all valid source
+ * patches (in batches, by the row kernels of the patch distance). Meant for small images
+ * (e.g. the coarsest scales), where it is cheaper than PatchMatch and gives the exact answer.
+ *
+ * @note Has the same interface as PatchMatch::calculate(). The initial field only tightens
+ *       the bounds of the early termination, the result does not depend on it. With a quantized
+ *       search precision the answer is exact for the quantized images (see calculate()).
+ */
+class ExhaustiveSearch
+{
+public:
+	ExhaustiveSearch();
+	ExhaustiveSearch(APatchDistance *distance_calculation);
+
+	// Calculates the exact NNF (using the given field, if any, to start with tight bounds).
+	Image<Point> calculate(FixedImage<float> source,
+						   FixedMask source_mask,
+						   FixedImage<float> target,
+						   FixedMask target_mask,
+						   Image<Point> initial_field = Image<Point>(),
+						   FixedMask changed_region = FixedMask(),
+						   const ScaleContext *scale_context = 0);
+
+	/// getters and setters for parameters
+	APatchDistance* get_distance_calculation();
+	void set_distance_calculation(APatchDistance *distance_calculation);
+
+	/// metrics (of the last call)
+	long get_distance_evaluations_metric();
+	int get_searched_points_metric();	// target points compared with all source points
+	int get_refreshed_points_metric();	// target points compared only with the source points affected by the changes
+
+private:
+	static const int BATCH_SIZE = 64;
+
+	APatchDistance *_distance_calculation;
+	// state of the previous call (for the incremental refresh)
+	Image<Point> _previous_neighbors;
+	Image<float> _previous_distances;
+	FixedMask _previous_source_mask;
+	FixedMask _previous_target_mask;
+	// metrics
+	long _distance_evaluations;
+	int _searched_points;
+	int _refreshed_points;
+
+	bool can_refresh_field(FixedMask source_mask,
+						   FixedMask target_mask,
+						   FixedImage<Point> initial_field,
+						   FixedMask changed_region);
+
+	void get_affected_points(FixedMask changed_region,
+							 FixedMask source_mask,
+							 const vector<Point> &source_points,
+							 const vector<Point> &target_points,
+							 vector<Point> &affected_source_points,
+							 vector<Point> &searched_points,
+							 vector<Point> &refreshed_points);
+
+	long search_point(const Point &target_point,
+					  const vector<Point> &source_points,
+					  Point &neighbor,
+					  float &distance);
+};
+
+
+#endif /* EXHAUSTIVE_SEARCH_H_ */
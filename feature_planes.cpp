@@ -0,0 +1,129 @@
+/**
+ * Copyright (C) 2015, Vadim Fedorov <vadim.fedorov@upf.edu>
+ * Copyright (C) 2015, Gabriele Facciolo <facciolo@ens-cachan.fr>
+ * Copyright (C) 2015, Pablo Arias <pablo.arias@cmla.ens-cachan.fr>
+ *
+ * This program is free software: you can use, modify and/or
+ * redistribute it under the terms of the simplified BSD
+ * License. You should have received a copy of this license along
+ * this program. If not, see
+ * <http://www.opensource.org/licenses/bsd-license.html>.
+ */
+
+#include "feature_planes.h"
+#include <math.h>
+#include <stdint.h>
+#include <algorithm>
+
+// NOTE: alignment of the rows in values (32 bytes)
+static const int ALIGNMENT = 8;
+
+FeaturePlanes::FeaturePlanes()
+{
+	_lambda = 0.0;
+	_number_of_channels = 0;
+	_stride = 0;
+	_values = 0;
+}
+
+
+/**
+ * Calculates the features of the whole image.
+ *
+ * @param lambda Weight of the values, the weight of the gradients is 1 - lambda (see L2CombinedPatchDistance).
+ */
+void FeaturePlanes::build(FixedImage<float> image, float lambda)
+{
+	_image = image;
+	_lambda = lambda;
+	_number_of_channels = 3 * image.get_number_of_channels();
+	_stride = (_number_of_channels * image.get_size_x() + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+
+	// NOTE: zeros in the padding, one more aligned block for the alignment of the first row
+	_buffer.assign(_stride * image.get_size_y() + ALIGNMENT, 0.0f);
+	uintptr_t address = (uintptr_t)&_buffer[0];
+	uintptr_t alignment_bytes = ALIGNMENT * sizeof(float);
+	_values = &_buffer[0] + ((alignment_bytes - address % alignment_bytes) % alignment_bytes) / sizeof(float);
+
+	calculate(0, 0, image.get_size_x(), image.get_size_y());
+}
+
+
+/**
+ * Recalculates the features of the modified pixels of the image given to build(): the bounding box of
+ * the region and the pixels above and left of it (their forward gradients depend on the modified pixels).
+ */
+void FeaturePlanes::refresh(FixedMask modified_region)
+{
+	Point top_left = modified_region.bounding_box_top_left();
+	Point bottom_right = modified_region.bounding_box_bottom_right();
+	if (top_left.x < 0) {
+		return;
+	}
+
+	calculate(max(0, top_left.x - 1),
+	          max(0, top_left.y - 1),
+	          min((int)_image.get_size_x(), bottom_right.x + 1),
+	          min((int)_image.get_size_y(), bottom_right.y + 1));
+}
+
+
+bool FeaturePlanes::is_empty() const
+{
+	return _values == 0;
+}
+
+
+FixedImage<float> FeaturePlanes::get_image() const
+{
+	return _image;
+}
+
+
+float FeaturePlanes::get_lambda() const
+{
+	return _lambda;
+}
+
+
+int FeaturePlanes::get_number_of_channels() const
+{
+	return _number_of_channels;
+}
+
+
+int FeaturePlanes::get_stride() const
+{
+	return _stride;
+}
+
+
+/* Private */
+
+/**
+ * Calculates the features of the pixels in [x_begin, x_end) x [y_begin, y_end).
+ */
+void FeaturePlanes::calculate(int x_begin, int y_begin, int x_end, int y_end)
+{
+	int size_x = _image.get_size_x();
+	int size_y = _image.get_size_y();
+	int image_channels = _image.get_number_of_channels();
+	float value_factor = sqrt(_lambda);
+	float gradient_factor = sqrt(1.0f - _lambda);
+	const float *image_values = _image.raw();
+
+	#pragma omp parallel for schedule(static)
+	for (int y = y_begin; y < y_end; y++) {
+		for (int x = x_begin; x < x_end; x++) {
+			const float *pixel = image_values + image_channels * (size_x * y + x);
+			float *features = _values + _stride * y + _number_of_channels * x;
+			for (int ch = 0; ch < image_channels; ch++) {
+				float gradient_x = (x < size_x - 1) ? pixel[image_channels + ch] - pixel[ch] : 0.0f;
+				float gradient_y = (y < size_y - 1) ? pixel[image_channels * size_x + ch] - pixel[ch] : 0.0f;
+				features[ch] = value_factor * pixel[ch];
+				features[image_channels + 2 * ch] = gradient_factor * gradient_x;
+				features[image_channels + 2 * ch + 1] = gradient_factor * gradient_y;
+			}
+		}
+	}
+}
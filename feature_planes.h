@@ -0,0 +1,68 @@
+/**
+ * Copyright (C) 2015, Vadim Fedorov <vadim.fedorov@upf.edu>
+ * Copyright (C) 2015, Gabriele Facciolo <facciolo@ens-cachan.fr>
+ * Copyright (C) 2015, Pablo Arias <pablo.arias@cmla.ens-cachan.fr>
+ *
+ * This program is free software: you can use, modify and/or
+ * redistribute it under the terms of the simplified BSD
+ * License. You should have received a copy of this license along
+ * this program. If not, see
+ * <http://www.opensource.org/licenses/bsd-license.html>.
+ */
+
+#ifndef FEATURE_PLANES_H_
+#define FEATURE_PLANES_H_
+
+#include <vector>
+#include "image.h"
+#include "mask.h"
+#include "point.h"
+
+using namespace std;
+
+/**
+ * Features of the combined patch distance stacked per pixel: the values of the image scaled by sqrt(lambda)
+ * and the forward gradients (x and y per channel, as in Gradient) scaled by sqrt(1 - lambda), so the combined
+ * distance is the plain weighted L2 distance of the features (9 channels for a 3 channel image). The rows are
+ * padded to a multiple of 8 values and aligned to 32 bytes for the SIMD kernels.
+ *
+ * @note The features are kept for the image object and can be recalculated only in the modified region
+ *       (e.g. the inpainting domain updated by an iteration of the inpainting).
+ */
+class FeaturePlanes
+{
+public:
+	FeaturePlanes();
+
+	void build(FixedImage<float> image, float lambda);
+	void refresh(FixedMask modified_region);
+
+	bool is_empty() const;
+	FixedImage<float> get_image() const;
+	float get_lambda() const;
+	int get_number_of_channels() const;
+	int get_stride() const;
+
+	/// Features of the first pixel of the patch centered at the point.
+	inline const float *get_patch(const Point &center, int radius_x, int radius_y) const
+	{
+		return _values + _stride * (center.y - radius_y) + _number_of_channels * (center.x - radius_x);
+	}
+
+private:
+	FixedImage<float> _image;
+	float _lambda;
+	int _number_of_channels;	// of the features
+	int _stride;				// values per row (padded)
+	vector<float> _buffer;
+	float *_values;				// aligned in the buffer
+
+	void calculate(int x_begin, int y_begin, int x_end, int y_end);
+
+	// NOTE: the features are not copied (the aligned pointer refers to the buffer)
+	FeaturePlanes(const FeaturePlanes &other);
+	FeaturePlanes& operator= (const FeaturePlanes &other);
+};
+
+
+#endif /* FEATURE_PLANES_H_ */
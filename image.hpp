@@ -429,7 +429,8 @@ FixedImage<T> FixedImage<T>::clone() const
 
 	if (this->_ref) {
 		clone.init(this->_size_x, this->_size_y, this->_number_of_channels);
-		memcpy(clone._data, this->_data,  this->_number_of_channels * this->_size_y * this->_size_x * sizeof(T));
+		// NOTE: element copy, T may be not trivially copyable (e.g. Point)
+		std::copy(this->_data, this->_data + this->_number_of_channels * this->_size_y * this->_size_x, clone._data);
 	}
 
 	return clone;
@@ -781,7 +782,8 @@ Image<T> Image<T>::clone() const
 
 	if (this->_ref) {
 		clone.init(this->_size_x, this->_size_y, this->_number_of_channels);
-		memcpy(clone._data, this->_data,  this->_number_of_channels * this->_size_y * this->_size_x * sizeof(T));
+		// NOTE: element copy, T may be not trivially copyable (e.g. Point)
+		std::copy(this->_data, this->_data + this->_number_of_channels * this->_size_y * this->_size_x, clone._data);
 	}
 
 	return clone;
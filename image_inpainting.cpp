@@ -24,6 +24,8 @@ const float ImageInpainting::MASK_SAMPLING_THRESHOLD = 0.4f;
 ImageInpainting::ImageInpainting()
 {
 	_patch_match = 0;
+	_exhaustive_search = 0;
+	_exhaustive_search_threshold = 0;
 	_image_updating = 0;
 	_iterations_amount = 5;
 	_tolerance = 0;
@@ -31,6 +33,10 @@ ImageInpainting::ImageInpainting()
 	_subsampling_rate = 0.5;
 	_confidence_decay_time = 5.0;
 	_confidence_asymptotic_value = 0.1;
+	_refresh_threshold = -1.0;
+	_use_adaptive_search_windows = false;
+	_sparse_target_stride = 1;
+	_sparse_target_scales = 1;
 	_initialization_type = InitPoisson;
 
 	_keep_intermediate = false;
@@ -46,6 +52,8 @@ ImageInpainting::ImageInpainting(int iterations_amount,
 								 InitType initialization_type)
 {
 	_patch_match = 0;
+	_exhaustive_search = 0;
+	_exhaustive_search_threshold = 0;
 	_image_updating = 0;
 	_iterations_amount = iterations_amount;
 	_tolerance = tolerance;
@@ -53,6 +61,10 @@ ImageInpainting::ImageInpainting(int iterations_amount,
 	_subsampling_rate = subsampling_rate;
 	_confidence_decay_time = confidence_decay_time;
 	_confidence_asymptotic_value = confidence_asymptotic_value;
+	_refresh_threshold = -1.0;
+	_use_adaptive_search_windows = false;
+	_sparse_target_stride = 1;
+	_sparse_target_scales = 1;
 	_initialization_type = initialization_type;
 
 	_keep_intermediate = false;
@@ -163,6 +175,7 @@ Image<float> ImageInpainting::process(FixedImage<float> in, FixedMask mask)
 	Image<Point> nnf;
 
 	printf("\tinpainting scale %d\n", _scales_amount);
+	select_target_stride(_scales_amount - 1);
 	inpaint_internal(_image_pyramid.back(), _mask_pyramid.back(), confidence_mask, nnf, _tolerance);
 
 #ifdef DBG_OUTPUT
@@ -173,7 +186,7 @@ Image<float> ImageInpainting::process(FixedImage<float> in, FixedMask mask)
 	for (int i = _scales_amount - 2; i >= 0; i--) {
 		Image<float> confidence_mask = calculate_confidence_mask(_mask_pyramid[i], _confidence_decay_time, _confidence_asymptotic_value);
 
-		nnf = propagate_weights(_image_pyramid[i], _mask_pyramid[i], confidence_mask, _image_pyramid[i + 1], _mask_pyramid[i + 1]);
+		nnf = propagate_weights(_image_pyramid[i], _mask_pyramid[i], confidence_mask, _image_pyramid[i + 1], _mask_pyramid[i + 1], i);
 
 #ifdef DBG_OUTPUT
 		IOUtility::write_rgb_image(IOUtility::compose_file_name("dbg_propagated", _scales_amount - i - 1, "png"), IOUtility::lab_to_rgb(_image_pyramid[i]));
@@ -186,7 +199,15 @@ Image<float> ImageInpainting::process(FixedImage<float> in, FixedMask mask)
 		IOUtility::write_rgb_image(IOUtility::compose_file_name("dbg_inpainted", _scales_amount - i - 1, "png"), IOUtility::lab_to_rgb(_image_pyramid[i]));
 #endif
 	}
-	
+
+	// the windows are given for the finest scale only
+	if (_use_adaptive_search_windows) {
+		_patch_match->set_search_windows(Image<int>());
+	}
+	if (_sparse_target_stride > 1) {
+		_patch_match->set_target_stride(1);
+	}
+
 	return _image_pyramid.front();
 }
 
@@ -277,6 +298,74 @@ void ImageInpainting::set_confidence_asymptotic_value(float value)
 }
 
 
+float ImageInpainting::get_refresh_threshold()
+{
+	return _refresh_threshold;
+}
+
+
+bool ImageInpainting::is_adaptive_search_windows_used()
+{
+	return _use_adaptive_search_windows;
+}
+
+
+/**
+ * Enables the adaptive search windows: at every scale except the coarsest one, the random search of PatchMatch
+ * starts in the window of each target point derived from the spread of the upsampled NNF of the coarser scale
+ * (see calculate_search_windows()), instead of the whole image.
+ */
+void ImageInpainting::use_adaptive_search_windows(bool value)
+{
+	_use_adaptive_search_windows = value;
+}
+
+
+int ImageInpainting::get_sparse_target_stride()
+{
+	return _sparse_target_stride;
+}
+
+
+/**
+ * Enables the sparse target at the finest scales: PatchMatch searches only the lattice of the target points with
+ * the given stride and fills the other points from it (see PatchMatch::set_target_stride()).
+ *
+ * @param stride Stride of the lattice. 1 disables the sparse target.
+ */
+void ImageInpainting::set_sparse_target_stride(int stride)
+{
+	_sparse_target_stride = max(stride, 1);
+}
+
+
+int ImageInpainting::get_sparse_target_scales()
+{
+	return _sparse_target_scales;
+}
+
+
+/**
+ * @param count Number of the finest scales with the sparse target.
+ */
+void ImageInpainting::set_sparse_target_scales(int count)
+{
+	_sparse_target_scales = max(count, 0);
+}
+
+
+/**
+ * Enables the incremental NNF refresh: after the first iteration at each scale, PatchMatch recalculates only
+ * the patches overlapping pixels changed by the image update by more than the threshold (in any channel).
+ *
+ * @param value Threshold of the change. Negative value disables the incremental refresh.
+ */
+void ImageInpainting::set_refresh_threshold(float value)
+{
+	_refresh_threshold = value;
+}
+
+
 PatchMatch* ImageInpainting::get_weights_updating()
 {
 	return _patch_match;
@@ -289,6 +378,36 @@ void ImageInpainting::set_weights_updating(PatchMatch *patch_match)
 }
 
 
+ExhaustiveSearch* ImageInpainting::get_exhaustive_search()
+{
+	return _exhaustive_search;
+}
+
+
+void ImageInpainting::set_exhaustive_search(ExhaustiveSearch *exhaustive_search)
+{
+	_exhaustive_search = exhaustive_search;
+}
+
+
+int ImageInpainting::get_exhaustive_search_threshold()
+{
+	return _exhaustive_search_threshold;
+}
+
+
+/**
+ * Sets the size of images (in pixels) up to which the exact search is used instead of PatchMatch
+ * (if the exact search is given).
+ *
+ * @param pixels_count Maximal number of pixels. Zero disables the exact search.
+ */
+void ImageInpainting::set_exhaustive_search_threshold(int pixels_count)
+{
+	_exhaustive_search_threshold = pixels_count;
+}
+
+
 AImageUpdating* ImageInpainting::get_image_updating()
 {
 	return _image_updating;
@@ -384,15 +503,44 @@ void ImageInpainting::inpaint_internal(Image<float> image,
 		throw std::runtime_error("ERROR: Empty source mask (no complete patches to copy from. This may happen due to a too big inpainting domain, too big patch, or too much downscaling)");
 	}
 
+	// prepare the source data once for all NNF calculations of the scale (the source mask does not change)
+	ScaleContext scale_context = create_scale_context(image, source_mask, initial_nnf.is_empty());
+
 	Image<Point> nnf = initial_nnf;
+	Mask changed_region;	// NOTE: empty region means that the whole NNF is recalculated
+	bool use_refresh = _refresh_threshold >= 0.0;
+	vector<float> previous_values;	// values of the inpainting domain before the update (in the order of its iterator)
 	double total_difference = numeric_limits<double>::max();
 	int i = 0;
 	for (i = 0; i < _iterations_amount && total_difference > tolerance; i++) {
 		// update weights (find nearest neighbours field)
-		nnf = _patch_match->calculate(image, source_mask, image, target_mask, nnf);
+		nnf = calculate_nnf(image, source_mask, target_mask, nnf, changed_region, &scale_context);
+
+#ifdef DBG_OUTPUT
+		if (is_exhaustive_search_used(image)) {
+			printf("\t\t\texhaustive search: %d points searched, %d points refreshed\n",
+				   _exhaustive_search->get_searched_points_metric(), _exhaustive_search->get_refreshed_points_metric());
+		}
+#endif
+
+		// keep current values of the inpainting domain to find the pixels changed by the update
+		if (use_refresh) {
+			previous_values.clear();
+			FixedMask::iterator it;
+			for (it = inpainting_domain.begin(); it != inpainting_domain.end(); ++it) {
+				for (uint channel = 0; channel < image.get_number_of_channels(); channel++) {
+					previous_values.push_back(image(*it, channel));
+				}
+			}
+		}
 
 		// update image
 		total_difference = _image_updating->update(image, original_image, inpainting_domain, extended_inpainting_domain, nnf, confidence_mask);
+		scale_context.update(inpainting_domain);	// NOTE: the update writes only to the inpainting domain
+
+		if (use_refresh) {
+			changed_region = get_changed_region(previous_values, image, inpainting_domain, _refresh_threshold);
+		}
 
 #ifdef DBG_OUTPUT
 		if (i % 10 == 0)
@@ -412,6 +560,36 @@ void ImageInpainting::inpaint_internal(Image<float> image,
 }
 
 
+/**
+ * Finds pixels of the inpainting domain, which were changed by more than the threshold in any channel
+ *
+ * @param previous_values Values of the inpainting domain before the update (all channels of a pixel, in the order of its iterator)
+ * @param image Updated image
+ * @param inpainting_domain Binary mask of the updated pixels
+ */
+Mask ImageInpainting::get_changed_region(const vector<float> &previous_values,
+										 FixedImage<float> image,
+										 FixedMask inpainting_domain,
+										 float threshold)
+{
+	Mask changed_region(image.get_size(), false);
+	uint number_of_channels = image.get_number_of_channels();
+
+	FixedMask::iterator it;
+	uint index = 0;
+	for (it = inpainting_domain.begin(); it != inpainting_domain.end(); ++it, index += number_of_channels) {
+		for (uint channel = 0; channel < number_of_channels; channel++) {
+			if (fabs(image(*it, channel) - previous_values[index + channel]) > threshold) {
+				changed_region.mask(*it);
+				break;
+			}
+		}
+	}
+
+	return changed_region;
+}
+
+
 /**
  * Updates the image by filling all the pixels given by the mask with the given color value
  *
@@ -483,12 +661,14 @@ float* ImageInpainting::get_initial_color(Image<float> image,
  * @param upper_confidence_mask Corresponding confidence values
  * @param lower_level Image to take information from (lower level of image pyramid)
  * @param lower_inpainting_domain Corresponding inpainting domain (lower level of mask pyramid)
+ * @param upper_scale Index of the current level (0 is the finest one)
  */
 Image<Point> ImageInpainting::propagate_weights(Image<float> upper_level,
 										FixedMask upper_inpainting_domain,
 										FixedImage<float> upper_confidence_mask,
 										FixedImage<float> lower_level,
-										FixedMask lower_inpainting_domain)
+										FixedMask lower_inpainting_domain,
+										int upper_scale)
 {
 	Shape patch_size = _image_updating->get_patch_size();
 
@@ -501,7 +681,12 @@ Image<Point> ImageInpainting::propagate_weights(Image<float> upper_level,
 	add_margin(lower_source_mask, lower_target_mask, half_patch_side);
 
 	// calculate NNF using image and inpainting domain mask from the lower level
-	Image<Point> nnf = _patch_match->calculate(lower_level, lower_source_mask, lower_level, lower_target_mask);
+	Image<Point> nnf = calculate_nnf(lower_level, lower_source_mask, lower_target_mask);
+
+	// limit the search at the upper level (and its further iterations) by the spread of the lower level NNF
+	if (_use_adaptive_search_windows) {
+		_patch_match->set_search_windows(calculate_search_windows(nnf, lower_target_mask, upper_level.get_size()));
+	}
 
 	// scale NNF
 	float scale_x = (float)upper_level.get_size_x() / lower_level.get_size_x();
@@ -537,13 +722,14 @@ Image<Point> ImageInpainting::propagate_weights(Image<float> upper_level,
 	Mask extended_upper_inpainting_domain = get_extended_domain(upper_inpainting_domain, patch_size);
 
 	// refine NNF using the scaled_nnf and the upsampled image
+	select_target_stride(upper_scale);
 	Mask upper_target_mask = extended_upper_inpainting_domain.clone();
 	Mask upper_source_mask = extended_upper_inpainting_domain.clone_invert();
 
 	// add margin at the border of lower_target_mask and lower_source_mask
 	add_margin(upper_source_mask, upper_target_mask, half_patch_side);
 
-	Image<Point> refined_nnf = _patch_match->calculate(upsampled_image, upper_source_mask, upsampled_image, upper_target_mask, scaled_nnf);
+	Image<Point> refined_nnf = calculate_nnf(upsampled_image, upper_source_mask, upper_target_mask, scaled_nnf);
 
 	// use scaled NNF and rough initialization to propagate information to the upper level
 	_image_updating->update(upper_level, upper_level, upper_inpainting_domain, extended_upper_inpainting_domain, refined_nnf, upper_confidence_mask);
@@ -552,6 +738,127 @@ Image<Point> ImageInpainting::propagate_weights(Image<float> upper_level,
 }
 
 
+/**
+ * Calculates the sizes of the search windows of the upper level. The spread of a lower level point is the largest
+ * difference (in pixels, along any axis) between its offset and the offsets of its neighbors in the 5x5 window.
+ * Coherent regions of the NNF get windows slightly larger than the patch, the seams between them get the windows
+ * covering the disagreement of the offsets. Upper level points inherit the window of the lower level point
+ * they are upsampled from (-1, i.e. the whole source, if it has no nearest neighbor).
+ *
+ * @param lower_nnf NNF of the lower level.
+ * @param lower_target_mask Target points of the lower level NNF.
+ * @param upper_size Size of the upper level.
+ */
+Image<int> ImageInpainting::calculate_search_windows(FixedImage<Point> lower_nnf,
+													 FixedMask lower_target_mask,
+													 Shape upper_size)
+{
+	const int SPREAD_RADIUS = 2;
+
+	Shape lower_size = lower_nnf.get_size();
+	float scale_x = (float)upper_size.size_x / lower_size.size_x;
+	float scale_y = (float)upper_size.size_y / lower_size.size_y;
+	int min_window_size = max(_image_updating->get_patch_size().size_x, _image_updating->get_patch_size().size_y);
+
+	Image<int> lower_windows(lower_size);
+	lower_windows.fill(-1);
+
+	#pragma omp parallel for schedule(static)
+	for (int y = 0; y < (int)lower_size.size_y; y++) {
+		for (int x = 0; x < (int)lower_size.size_x; x++) {
+			if (!lower_target_mask.test(x, y) || lower_nnf(x, y).x < 0) {
+				continue;
+			}
+
+			Point offset = lower_nnf(x, y) - Point(x, y);
+			int spread = 0;
+			for (int dy = -SPREAD_RADIUS; dy <= SPREAD_RADIUS; dy++) {
+				for (int dx = -SPREAD_RADIUS; dx <= SPREAD_RADIUS; dx++) {
+					if (!lower_target_mask.test(x + dx, y + dy) || lower_nnf(x + dx, y + dy).x < 0) {
+						continue;
+					}
+
+					Point difference = lower_nnf(x + dx, y + dy) - Point(x + dx, y + dy) - offset;
+					spread = max(spread, max(abs(difference.x), abs(difference.y)));
+				}
+			}
+
+			lower_windows(x, y) = max((int)ceil((spread + 1) * max(scale_x, scale_y)), min_window_size);
+		}
+	}
+
+	Image<int> upper_windows(upper_size);
+	for (uint y = 0; y < upper_size.size_y; y++) {
+		int lower_y = min((int)round(y / scale_y), (int)lower_size.size_y - 1);
+		for (uint x = 0; x < upper_size.size_x; x++) {
+			int lower_x = min((int)round(x / scale_x), (int)lower_size.size_x - 1);
+			upper_windows(x, y) = lower_windows(lower_x, lower_y);
+		}
+	}
+
+	return upper_windows;
+}
+
+
+/**
+ * Sets the target stride of PatchMatch for the NNF calculations of the scale, if the sparse target is used.
+ */
+void ImageInpainting::select_target_stride(int scale)
+{
+	if (_sparse_target_stride > 1) {
+		_patch_match->set_target_stride(scale < _sparse_target_scales ? _sparse_target_stride : 1);
+	}
+}
+
+
+/**
+ * Checks if the nearest neighbors field of the image is calculated exactly (the image is small enough).
+ */
+bool ImageInpainting::is_exhaustive_search_used(FixedImage<float> image)
+{
+	int pixels_count = image.get_size_x() * image.get_size_y();
+	return _exhaustive_search && pixels_count <= _exhaustive_search_threshold;
+}
+
+
+/**
+ * Initializes the patch distance of the search used for the image and prepares the source data
+ * for calculate_nnf() (see ScaleContext).
+ *
+ * @param use_tree Builds the tree of the source patches, if PatchMatch uses it for the initialization.
+ */
+ScaleContext ImageInpainting::create_scale_context(FixedImage<float> image, FixedMask source_mask, bool use_tree)
+{
+	if (is_exhaustive_search_used(image)) {
+		return ScaleContext(_exhaustive_search->get_distance_calculation(), image, source_mask, image);
+	}
+
+	return ScaleContext(_patch_match->get_distance_calculation(), image, source_mask, image,
+						use_tree && _patch_match->is_tree_initialization_used());
+}
+
+
+/**
+ * Calculates the nearest neighbors field of the image (source and target are the same image): exactly,
+ * if the image is small enough, or by PatchMatch otherwise.
+ *
+ * @param scale_context Source data prepared by create_scale_context() for the image and the source mask (optional).
+ */
+Image<Point> ImageInpainting::calculate_nnf(FixedImage<float> image,
+											FixedMask source_mask,
+											FixedMask target_mask,
+											Image<Point> initial_nnf,
+											FixedMask changed_region,
+											const ScaleContext *scale_context)
+{
+	if (is_exhaustive_search_used(image)) {
+		return _exhaustive_search->calculate(image, source_mask, image, target_mask, initial_nnf, changed_region, scale_context);
+	}
+
+	return _patch_match->calculate(image, source_mask, image, target_mask, initial_nnf, changed_region, scale_context);
+}
+
+
 /**
  * Computes the mask containing centers of all patches, intersecting the given inpainting domain
  *
@@ -20,6 +20,8 @@
 #include "image.h"
 #include "mask.h"
 #include "patch_match.h"
+#include "exhaustive_search.h"
+#include "scale_context.h"
 #include "shape.h"
 #include "sampling.h"
 #include "distance_transform.h"
@@ -66,8 +68,20 @@ public:
 	void set_confidence_decay_time(float value);
 	float get_confidence_asymptotic_value();
 	void set_confidence_asymptotic_value(float value);
+	float get_refresh_threshold();
+	void set_refresh_threshold(float value);
+	bool is_adaptive_search_windows_used();
+	void use_adaptive_search_windows(bool value = true);
+	int get_sparse_target_stride();
+	void set_sparse_target_stride(int stride);
+	int get_sparse_target_scales();
+	void set_sparse_target_scales(int count);
 	PatchMatch* get_weights_updating();
 	void set_weights_updating(PatchMatch *patch_match);
+	ExhaustiveSearch* get_exhaustive_search();
+	void set_exhaustive_search(ExhaustiveSearch *exhaustive_search);
+	int get_exhaustive_search_threshold();
+	void set_exhaustive_search_threshold(int pixels_count);
 	AImageUpdating* get_image_updating();
 	void set_image_updating(AImageUpdating *image_updating);
 
@@ -89,6 +103,10 @@ private:
 	// PatchMatch algorithm
 	PatchMatch *_patch_match;
 
+	// exact search, used instead of PatchMatch for images with at most the given number of pixels
+	ExhaustiveSearch *_exhaustive_search;
+	int _exhaustive_search_threshold;
+
 	// image updater
 	AImageUpdating *_image_updating;
 
@@ -104,6 +122,16 @@ private:
 	float _confidence_decay_time;
 	float _confidence_asymptotic_value;
 
+	// incremental NNF refresh: pixels changed by more than the threshold (negative to disable)
+	float _refresh_threshold;
+
+	// search windows of PatchMatch at the finer scales given by the spread of the coarser NNF
+	bool _use_adaptive_search_windows;
+
+	// sparse target of PatchMatch at the finest scales: stride of the searched lattice (1 to disable), number of scales
+	int _sparse_target_stride;
+	int _sparse_target_scales;
+
 	// coarsest scale initialization (average, black or none)
 	InitType _initialization_type;
 
@@ -120,6 +148,22 @@ private:
 						  FixedImage<Point> initial_nnf,
 						  float tolerance);
 
+	// nearest neighbors field (by the exact search for small images, by PatchMatch otherwise)
+	bool is_exhaustive_search_used(FixedImage<float> image);
+	ScaleContext create_scale_context(FixedImage<float> image, FixedMask source_mask, bool use_tree);
+	Image<Point> calculate_nnf(FixedImage<float> image,
+							   FixedMask source_mask,
+							   FixedMask target_mask,
+							   Image<Point> initial_nnf = Image<Point>(),
+							   FixedMask changed_region = FixedMask(),
+							   const ScaleContext *scale_context = 0);
+
+	// pixels of the inpainting domain changed by the image update
+	Mask get_changed_region(const vector<float> &previous_values,
+							FixedImage<float> image,
+							FixedMask inpainting_domain,
+							float threshold);
+
 	// sets all pixels in mask to color
 	void initialize_with_color(Image<float> image,
 							   FixedMask mask,
@@ -139,7 +183,16 @@ private:
 						   FixedMask upper_inpainting_domain,
 						   FixedImage<float> upper_confidence_mask,
 						   FixedImage<float> lower_level,
-						   FixedMask lower_inpainting_domain);
+						   FixedMask lower_inpainting_domain,
+						   int upper_scale);
+
+	// selects the target stride of PatchMatch for the scale (0 is the finest one)
+	void select_target_stride(int scale);
+
+	// sizes of the search windows of the upper level given by the spread of the NNF of the lower level
+	Image<int> calculate_search_windows(FixedImage<Point> lower_nnf,
+										FixedMask lower_target_mask,
+										Shape upper_size);
 
 	// computes confidence mask
 	Image<float> calculate_confidence_mask(FixedMask domain,
@@ -11,6 +11,7 @@
  */
 
 #include "l1_norm_patch_distance.h"
+#include "patch_distance_kernels.h"
 
 L1NormPatchDistance::L1NormPatchDistance()
 	: APatchDistance() { }
@@ -19,87 +20,105 @@ L1NormPatchDistance::L1NormPatchDistance(Shape &patch_size, float gaussian_sigma
 	: APatchDistance(patch_size, gaussian_sigma) { }
 
 
+/**
+ * Selects the row kernel for the patch size and the number of channels of the images. Calculates the moments
+ * of the patches, if the lower bounds are used, copies the images for the sparse stage, if any, and quantizes
+ * the images, if the search precision is not Float.
+ */
+void L1NormPatchDistance::initialize(FixedImage<float> source, FixedImage<float> target)
+{
+	APatchDistance::initialize(source, target);
+
+	_row_kernel = PatchDistanceKernels::select_absolute_difference(_patch_size.size_x, source.get_number_of_channels(), _is_uniform_weighting);
+
+	initialize_moments(source, target, QuantizedPatches::AbsoluteDifference);
+	_sparse_patches = SparsePatches(source, target, _patch_weighting, _sparse_stride, QuantizedPatches::AbsoluteDifference);
+
+	_quantized_patches = QuantizedPatches(source, target, _patch_weighting, _search_precision, QuantizedPatches::AbsoluteDifference);
+}
+
+
+/**
+ * Refreshes the moments of the patches and the copies of the sparse stage only around the modified region, if the image is shared by the source
+ * and the target, and quantizes the images again, if needed. Initializes for the whole images otherwise.
+ */
+void L1NormPatchDistance::reinitialize(FixedImage<float> source, FixedImage<float> target, FixedMask modified_region)
+{
+	if (!(source == _source) ||
+			!(target == source) ||
+			modified_region.get_size() != source.get_size() ||
+			_use_moment_bounds != !_source_moments.is_empty() ||
+			_sparse_stride != _sparse_patches.get_stride()) {
+		initialize(source, target);
+		return;
+	}
+
+	// NOTE: the moments and the copies are calculated for _source (checked above)
+	refresh_moments(modified_region);
+	_sparse_patches.refresh(modified_region);
+
+	_quantized_patches = QuantizedPatches(source, target, _patch_weighting, _search_precision, QuantizedPatches::AbsoluteDifference);
+}
+
+
 float L1NormPatchDistance::calculate(const Point &source_point,
 							   	     const Point &target_point)
 {
-	if (_patch_weighting.is_empty()) {
-		_patch_weighting = GaussianWeights::calculate(_patch_size.size_x,
-													  _patch_size.size_y,
-													  _gaussian_sigma,
-													  _gaussian_sigma);
-	}
+	return calculate(source_point, target_point, numeric_limits<float>::max());
+}
+
 
-	// calculate distance between source and target patches
-	int radius_x = _patch_size.size_x / 2;
-	int radius_y = _patch_size.size_y / 2;
-
-	// NOTE: direct access - we sacrifice readability in favor of performance
-	const float *source_points = _source.raw();
-	const float *target_points = _target.raw();
-	const float *p_weight = _patch_weighting.raw();
-	int number_of_channels = _source.get_number_of_channels();
-	int source_stride = _source.get_size_x();
-	int target_stride = _target.get_size_x();
-
-
-	float distance = 0.0;
-	if (number_of_channels == 3) {
-		// NOTE: unrolled channel loop for 3 channels
-		for (int dy = -radius_y; dy < ((int)_patch_size.size_y - radius_y); dy++) {
-			for (int dx = -radius_x; dx < ((int)_patch_size.size_x - radius_x); dx++, ++p_weight) {
-				// NOTE: this is the same as: _patch_weighting(dx + radius_x, dy + radius_y);
-				float weight = *p_weight;
-
-				// calculate partial result as a weighted norm
-				int source_id = 3 * (source_stride * (source_point.y + dy) + (source_point.x + dx));
-				int target_id = 3 * (target_stride * (target_point.y + dy) + (target_point.x + dx));
-
-				float norm = abs(source_points[source_id] - target_points[target_id]) +
-							 abs(source_points[source_id + 1] - target_points[target_id + 1]) +
-							 abs(source_points[source_id + 2] - target_points[target_id + 2]);
-
-				distance += weight * norm;
-			}
-		}
-	} else if (number_of_channels == 1) {
-		// NOTE: no channel loop for 1 channel
-		for (int dy = -radius_y; dy < ((int)_patch_size.size_y - radius_y); dy++) {
-			for (int dx = -radius_x; dx < ((int)_patch_size.size_x - radius_x); dx++, ++p_weight) {
-				// NOTE: this is the same as: _patch_weighting(dx + radius_x, dy + radius_y);
-				float weight = *p_weight;
-
-				// calculate partial result as a weighted norm
-				int source_id = source_stride * (source_point.y + dy) + (source_point.x + dx);
-				int target_id = target_stride * (target_point.y + dy) + (target_point.x + dx);
-
-				float norm = abs(source_points[source_id] - target_points[target_id]);
-
-				distance += weight * norm;
-			}
-		}
+/**
+ * Calculates the distance row by row and stops as soon as the partial weighted sum exceeds the bound.
+ */
+float L1NormPatchDistance::calculate(const Point &source_point,
+							   	     const Point &target_point,
+							   	     float bound)
+{
+	float distance;
+	calculate(&source_point, 1, target_point, bound, &distance);
+	return distance;
+}
+
+
+/**
+ * Calculates the distances on the quantized images, if any, or on the float images.
+ */
+void L1NormPatchDistance::calculate(const Point *source_points,
+									int count,
+									const Point &target_point,
+									float bound,
+									float *distances)
+{
+	if (!_quantized_patches.is_empty()) {
+		calculate_quantized(source_points, count, target_point, bound, distances);
 	} else {
-		for (int dy = -radius_y; dy < ((int)_patch_size.size_y - radius_y); dy++) {
-			for (int dx = -radius_x; dx < ((int)_patch_size.size_x - radius_x); dx++, ++p_weight) {
-				// NOTE: this is the same as: _patch_weighting(dx + radius_x, dy + radius_y);
-				float weight = *p_weight;
-
-				// calculate partial result as a weighted norm
-				float norm = 0.0;
-				int source_id = number_of_channels * (source_stride * (source_point.y + dy) + (source_point.x + dx));
-				int target_id = number_of_channels * (target_stride * (target_point.y + dy) + (target_point.x + dx));
-				for (int ch = 0; ch < number_of_channels; ch++) {
-					// NOTE: this is the same as: source(source_point + dp);
-					float color_a = source_points[source_id + ch];
-					// NOTE: this is the same as: target(target_point + dp);
-					float color_b = target_points[target_id + ch];
-
-					norm += abs(color_a - color_b);
-				}
-
-				distance += weight * norm;
-			}
-		}
+		calculate_direct(source_points, count, target_point, bound, distances);
 	}
+}
+
+
+float L1NormPatchDistance::calculate_exact(const Point &source_point,
+										   const Point &target_point)
+{
+	float distance;
+	calculate_direct(&source_point, 1, target_point, numeric_limits<float>::max(), &distance);
+	return distance;
+}
 
-	return distance / (_patch_size.size_x * _patch_size.size_y);
+
+/* Private */
+
+/**
+ * Calculates the distances row by row (in the images with interleaved channels a row of a patch is contiguous)
+ * and stops as soon as the partial weighted sum exceeds the bound. The bound is tightened by every calculated distance.
+ */
+void L1NormPatchDistance::calculate_direct(const Point *source_points,
+										   int count,
+										   const Point &target_point,
+										   float bound,
+										   float *distances)
+{
+	KernelRows rows = get_kernel_rows(_row_kernel, target_point);
+	calculate_rows<float>(source_points, count, bound, rows, distances);
 }
@@ -29,8 +29,31 @@ public:
 
 	virtual ~L1NormPatchDistance() {};
 
+	virtual void initialize(FixedImage<float> source, FixedImage<float> target);
+	virtual void reinitialize(FixedImage<float> source, FixedImage<float> target, FixedMask modified_region);
+
 	virtual float calculate(const Point &source_point,
 							const Point &target_point);
+
+	virtual float calculate(const Point &source_point,
+							const Point &target_point,
+							float bound);
+
+	virtual void calculate(const Point *source_points,
+						   int count,
+						   const Point &target_point,
+						   float bound,
+						   float *distances);
+
+	virtual float calculate_exact(const Point &source_point,
+								  const Point &target_point);
+
+private:
+	void calculate_direct(const Point *source_points,
+						  int count,
+						  const Point &target_point,
+						  float bound,
+						  float *distances);
 };
 
 
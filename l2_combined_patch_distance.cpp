@@ -11,11 +11,16 @@
  */
 
 #include "l2_combined_patch_distance.h"
+#include "patch_distance_kernels.h"
 
 L2CombinedPatchDistance::L2CombinedPatchDistance()
 : APatchDistance()
 {
 	_lambda = 0.5;
+	_is_target_shared = false;
+	_use_norm_decomposition = false;
+	_dot_kernel = 0;
+	_gradient_dot_kernel = 0;
 }
 
 
@@ -23,126 +28,290 @@ L2CombinedPatchDistance::L2CombinedPatchDistance(float lambda, Shape &patch_size
 : APatchDistance(patch_size, gaussian_sigma)
 {
 	_lambda = lambda;
+	_is_target_shared = false;
+	_use_norm_decomposition = false;
+	_dot_kernel = 0;
+	_gradient_dot_kernel = 0;
 }
 
 
+/**
+ * Calculates the features (values and gradients) of the images, their moments, if the lower bounds are used,
+ * and their copies for the sparse stage, if any.
+ */
 void L2CombinedPatchDistance::initialize(FixedImage<float> source, FixedImage<float> target)
 {
-	// calculate gradients
-	_source_gradient = Gradient::calculate(source);
-	_target_gradient = Gradient::calculate(target);
+	_source_features.build(source, _lambda);
+	_is_target_shared = (target == source);
+	if (!_is_target_shared) {
+		_target_features.build(target, _lambda);
+	}
+
+	prepare(source, target);
+	initialize_feature_moments(source, target);
+
+	// NOTE: the sparse stage is calculated on the features
+	const FeaturePlanes &target_features = _is_target_shared ? _source_features : _target_features;
+	_sparse_patches = SparsePatches(_source_features.get_patch(Point(0, 0), 0, 0), _source_features.get_stride(),
+									target_features.get_patch(Point(0, 0), 0, 0), target_features.get_stride(),
+									source.get_size(), target.get_size(), _source_features.get_number_of_channels(),
+									_patch_weighting, _sparse_stride, QuantizedPatches::SquaredDifference);
+}
+
+
+/**
+ * Recalculates the features only in the modified region, if they were calculated for the same image
+ * (the source and the target), otherwise calculates them for the whole images. The same for the moments and
+ * the copies of the sparse stage.
+ */
+void L2CombinedPatchDistance::reinitialize(FixedImage<float> source, FixedImage<float> target, FixedMask modified_region)
+{
+	if (target == source &&
+			!_source_features.is_empty() &&
+			_source_features.get_image() == source &&
+			_source_features.get_lambda() == _lambda &&
+			modified_region.get_size() == source.get_size() &&
+			_use_moment_bounds == !_source_moments.is_empty() &&
+			_sparse_stride == _sparse_patches.get_stride()) {
+		_source_features.refresh(modified_region);
+		_is_target_shared = true;
+		prepare(source, target);
 
+		// NOTE: the features of the pixels preceding the modified ones are modified as well (forward gradients)
+		refresh_moments(modified_region, 1);
+		_sparse_patches.refresh(modified_region, 1);
+	} else {
+		initialize(source, target);
+	}
+}
+
+
+/**
+ * Selects the row kernel for the features and prepares the norms or the quantized images, if needed.
+ */
+void L2CombinedPatchDistance::prepare(FixedImage<float> source, FixedImage<float> target)
+{
 	APatchDistance::initialize(source, target);
+
+	repeat_weights(_patch_weighting, _source_features.get_number_of_channels(), _feature_weights);
+	_row_kernel = PatchDistanceKernels::select_squared_difference(_patch_size.size_x, _source_features.get_number_of_channels(), _is_uniform_weighting);
+
+	// calculate the separate gradients, if needed
+	// NOTE: the same gradient object for the same image (e.g. the norms and the quantized copies are shared then)
+	if (_use_norm_decomposition || _search_precision != QuantizedPatches::Float) {
+		_source_gradient = Gradient::calculate(source);
+		_target_gradient = (target == source) ? _source_gradient : Gradient::calculate(target);
+
+		// NOTE: two gradient values (x and y) per channel
+		repeat_weights(_patch_weighting, _source_gradient.get_number_of_channels(), _gradient_weights);
+	} else {
+		_source_gradient = FixedImage<float>();
+		_target_gradient = FixedImage<float>();
+	}
+
+	if (_use_norm_decomposition) {
+		// NOTE: the images are modified between the calls (e.g. the inpainting domain), thus the norms are always recalculated
+		_dot_kernel = PatchDistanceKernels::select_dot_product(_patch_size.size_x, source.get_number_of_channels(), _is_uniform_weighting);
+		_gradient_dot_kernel = PatchDistanceKernels::select_dot_product(_patch_size.size_x, _source_gradient.get_number_of_channels(), _is_uniform_weighting);
+		_source_norms = PatchRowNorms(source, _patch_weighting);
+		_source_gradient_norms = PatchRowNorms(_source_gradient, _patch_weighting);
+		if (target == source) {
+			_target_norms = _source_norms;
+			_target_gradient_norms = _source_gradient_norms;
+		} else {
+			_target_norms = PatchRowNorms(target, _patch_weighting);
+			_target_gradient_norms = PatchRowNorms(_target_gradient, _patch_weighting);
+		}
+	} else {
+		_source_norms = PatchRowNorms();
+		_target_norms = PatchRowNorms();
+		_source_gradient_norms = PatchRowNorms();
+		_target_gradient_norms = PatchRowNorms();
+	}
+
+	// NOTE: the gradients have their own quantization steps
+	if (_search_precision != QuantizedPatches::Float) {
+		_quantized_patches = QuantizedPatches(source, target, _patch_weighting, _search_precision, QuantizedPatches::SquaredDifference);
+		_quantized_gradient_patches = QuantizedPatches(_source_gradient, _target_gradient, _patch_weighting, _search_precision, QuantizedPatches::SquaredDifference);
+	} else {
+		_quantized_patches = QuantizedPatches();
+		_quantized_gradient_patches = QuantizedPatches();
+	}
+}
+
+
+/**
+ * Calculates the moments of the patches of the features (i.e. the bounds of the combined distance), if needed.
+ */
+void L2CombinedPatchDistance::initialize_feature_moments(FixedImage<float> source, FixedImage<float> target)
+{
+	if (!_use_moment_bounds) {
+		set_moments(PatchMoments(), PatchMoments(), QuantizedPatches::SquaredDifference);
+		return;
+	}
+
+	// NOTE: the moments refer to the values of the features, which are refreshed in place by reinitialize()
+	PatchMoments source_moments(_source_features.get_patch(Point(0, 0), 0, 0),
+								source.get_size_x(),
+								source.get_size_y(),
+								_source_features.get_stride(),
+								_source_features.get_number_of_channels(),
+								_patch_weighting,
+								_use_moment_deviations);
+	PatchMoments target_moments = source_moments;
+	if (!_is_target_shared) {
+		target_moments = PatchMoments(_target_features.get_patch(Point(0, 0), 0, 0),
+									  target.get_size_x(),
+									  target.get_size_y(),
+									  _target_features.get_stride(),
+									  _target_features.get_number_of_channels(),
+									  _patch_weighting,
+									  _use_moment_deviations);
+	}
+
+	set_moments(source_moments, target_moments, QuantizedPatches::SquaredDifference);
+}
+
+
+/**
+ * Enables the calculation of the intensity and the gradient terms as ||a||^2 + ||b||^2 - 2<a, b>, where the norms
+ * of the patch rows are calculated once per image (see PatchRowNorms).
+ *
+ * @note The result differs from the direct calculation by the rounding errors (larger for the large norms).
+ */
+void L2CombinedPatchDistance::use_norm_decomposition(bool value)
+{
+	_use_norm_decomposition = value;
 }
 
 
 float L2CombinedPatchDistance::calculate(const Point &source_point,
 										 const Point &target_point)
 {
-	// get raw gradient values
-	const float *source_gradient_values = _source_gradient.raw();
-	const float *target_gradient_values = _target_gradient.raw();
-
-	if (_patch_weighting.is_empty()) {
-		_patch_weighting = GaussianWeights::calculate(_patch_size.size_x,
-													  _patch_size.size_y,
-													  _gaussian_sigma,
-													  _gaussian_sigma);
+	return calculate(source_point, target_point, numeric_limits<float>::max());
+}
+
+
+/**
+ * Calculates the distance row by row and stops as soon as the partial weighted sum exceeds the bound.
+ */
+float L2CombinedPatchDistance::calculate(const Point &source_point,
+										 const Point &target_point,
+										 float bound)
+{
+	float distance;
+	calculate(&source_point, 1, target_point, bound, &distance);
+	return distance;
+}
+
+
+/**
+ * Calculates the distances on the quantized images and gradients, if any, or on the float ones (directly
+ * or by the norm decomposition).
+ */
+void L2CombinedPatchDistance::calculate(const Point *source_points,
+										int count,
+										const Point &target_point,
+										float bound,
+										float *distances)
+{
+	if (!_quantized_patches.is_empty()) {
+		calculate_quantized_combined(source_points, count, target_point, bound, distances);
+	} else if (_use_norm_decomposition) {
+		calculate_decomposed(source_points, count, target_point, bound, distances);
+	} else {
+		calculate_direct(source_points, count, target_point, bound, distances);
 	}
+}
+
+
+float L2CombinedPatchDistance::calculate_exact(const Point &source_point,
+											   const Point &target_point)
+{
+	float distance;
+	if (_use_norm_decomposition) {
+		calculate_decomposed(&source_point, 1, target_point, numeric_limits<float>::max(), &distance);
+	} else {
+		calculate_direct(&source_point, 1, target_point, numeric_limits<float>::max(), &distance);
+	}
+	return distance;
+}
 
-	// calculate distance between source and target patches
+
+/* Private */
+
+/**
+ * Calculates the distances row by row on the features (a row of a patch is contiguous and contains both terms,
+ * already weighted by lambda and 1 - lambda) and stops as soon as the partial weighted sum exceeds the bound.
+ * The bound is tightened by every calculated distance.
+ */
+void L2CombinedPatchDistance::calculate_direct(const Point *source_points,
+											   int count,
+											   const Point &target_point,
+											   float bound,
+											   float *distances)
+{
+	const FeaturePlanes &target_features = _is_target_shared ? _source_features : _target_features;
 	int radius_x = _patch_size.size_x / 2;
 	int radius_y = _patch_size.size_y / 2;
 
-	// NOTE: direct access - we sacrifice readability in favor of performance
-	const float *source_points = _source.raw();
-	const float *target_points = _target.raw();
-	const float *p_weight = _patch_weighting.raw();
-	int number_of_channels = _source.get_number_of_channels();
-	int source_stride = _source.get_size_x();
-	int target_stride = _target.get_size_x();
-
-	double distance = 0.0;
-	double gradient_distance = 0.0;
-	if (number_of_channels == 3) {
-		// NOTE: unrolled channel loop for 3 channels
-		for (int dy = -radius_y; dy < ((int)_patch_size.size_y - radius_y); dy++) {
-			for (int dx = -radius_x; dx < ((int)_patch_size.size_x - radius_x); dx++, ++p_weight) {
-				// NOTE: this is the same as: _patch_weighting(dx + radius_x, dy + radius_y);
-				float weight = *p_weight;
-
-				// calculate partial result as a weighted norm
-				int source_id = 3 * (source_stride * (source_point.y + dy) + (source_point.x + dx));
-				int target_id = 3 * (target_stride * (target_point.y + dy) + (target_point.x + dx));
-
-				float norm = (source_points[source_id] - target_points[target_id]) * (source_points[source_id] - target_points[target_id]) +
-							 (source_points[source_id + 1] - target_points[target_id + 1]) * (source_points[source_id + 1] - target_points[target_id + 1]) +
-							 (source_points[source_id + 2] - target_points[target_id + 2]) * (source_points[source_id + 2] - target_points[target_id + 2]);
-
-				float gradient_norm = (source_gradient_values[source_id * 2] - target_gradient_values[target_id * 2]) * (source_gradient_values[source_id * 2] - target_gradient_values[target_id * 2]) +
-									  (source_gradient_values[source_id * 2 + 1] - target_gradient_values[target_id * 2 + 1]) * (source_gradient_values[source_id * 2 + 1] - target_gradient_values[target_id * 2 + 1]) +
-									  (source_gradient_values[source_id * 2 + 2] - target_gradient_values[target_id * 2 + 2]) * (source_gradient_values[source_id * 2 + 2] - target_gradient_values[target_id * 2 + 2]) +
-									  (source_gradient_values[source_id * 2 + 3] - target_gradient_values[target_id * 2 + 3]) * (source_gradient_values[source_id * 2 + 3] - target_gradient_values[target_id * 2 + 3]) +
-									  (source_gradient_values[source_id * 2 + 4] - target_gradient_values[target_id * 2 + 4]) * (source_gradient_values[source_id * 2 + 4] - target_gradient_values[target_id * 2 + 4]) +
-									  (source_gradient_values[source_id * 2 + 5] - target_gradient_values[target_id * 2 + 5]) * (source_gradient_values[source_id * 2 + 5] - target_gradient_values[target_id * 2 + 5]);
-
-				distance += weight * norm;
-				gradient_distance += weight * gradient_norm;
-			}
-		}
-	} else if (number_of_channels == 1) {
-		// NOTE: no channel loop for 1 channel
-		for (int dy = -radius_y; dy < ((int)_patch_size.size_y - radius_y); dy++) {
-			for (int dx = -radius_x; dx < ((int)_patch_size.size_x - radius_x); dx++, ++p_weight) {
-				// NOTE: this is the same as: _patch_weighting(dx + radius_x, dy + radius_y);
-				float weight = *p_weight;
+	KernelRows rows(_row_kernel,
+					_source_features.get_patch(Point(0, 0), 0, 0),
+					_source_features.get_stride(),
+					target_features.get_patch(target_point, radius_x, radius_y),
+					target_features.get_stride(),
+					&_feature_weights[0],
+					_source_features.get_number_of_channels(),
+					_patch_size);
+	calculate_rows<float>(source_points, count, bound, rows, distances);
+}
 
-				// calculate partial result as a weighted norm
-				int source_id = source_stride * (source_point.y + dy) + (source_point.x + dx);
-				int target_id = target_stride * (target_point.y + dy) + (target_point.x + dx);
 
-				float norm = (source_points[source_id] - target_points[target_id]) * (source_points[source_id] - target_points[target_id]);
+/**
+ * Same as above, but every row of both terms is calculated as the sum of the norms minus the doubled dot product.
+ */
+void L2CombinedPatchDistance::calculate_decomposed(const Point *source_points,
+												   int count,
+												   const Point &target_point,
+												   float bound,
+												   float *distances)
+{
+	int radius_x = _patch_size.size_x / 2;
+	int radius_y = _patch_size.size_y / 2;
+	int number_of_channels = _source.get_number_of_channels();
+	int source_stride = number_of_channels * _source.get_size_x();
+	int target_stride = number_of_channels * _target.get_size_x();
 
-				float gradient_norm = (source_gradient_values[source_id * 2] - target_gradient_values[target_id * 2]) * (source_gradient_values[source_id * 2] - target_gradient_values[target_id * 2]) +
-													  (source_gradient_values[source_id * 2 + 1] - target_gradient_values[target_id * 2 + 1]) * (source_gradient_values[source_id * 2 + 1] - target_gradient_values[target_id * 2 + 1]);
+	// NOTE: the gradients have two values per value of the images
+	int target_offset = target_stride * (target_point.y - radius_y) + number_of_channels * (target_point.x - radius_x);
+	KernelRows gradient_dot_rows(_gradient_dot_kernel,
+								 _source_gradient.raw(),
+								 2 * source_stride,
+								 _target_gradient.raw() + 2 * target_offset,
+								 2 * target_stride,
+								 &_gradient_weights[0],
+								 2 * number_of_channels,
+								 _patch_size);
+
+	CombinedRows<DecomposedRows, DecomposedRows> rows(
+			DecomposedRows(get_kernel_rows(_dot_kernel, target_point), _source_norms, _target_norms, target_point),
+			DecomposedRows(gradient_dot_rows, _source_gradient_norms, _target_gradient_norms, target_point),
+			_lambda);
+	calculate_rows<double>(source_points, count, bound, rows, distances);
+}
 
-				distance += weight * norm;
-				gradient_distance += weight * gradient_norm;
-			}
-		}
-	} else {
-		for (int dy = -radius_y; dy < ((int)_patch_size.size_y - radius_y); dy++) {
-			for (int dx = -radius_x; dx < ((int)_patch_size.size_x - radius_x); dx++, ++p_weight) {
-				// NOTE: this is the same as: _patch_weighting(dx + radius_x, dy + radius_y);
-				float weight = *p_weight;
-
-				// calculate partial result as a weighted norm
-				double norm = 0.0;
-				double gradient_norm = 0.0;
-				int source_id = number_of_channels * (source_stride * (source_point.y + dy) + (source_point.x + dx));
-				int target_id = number_of_channels * (target_stride * (target_point.y + dy) + (target_point.x + dx));
-				for (int ch = 0; ch < number_of_channels; ch++) {
-					// NOTE: this is the same as: source(source_point + dp);
-					float color_a = source_points[source_id + ch];
-					// NOTE: this is the same as: target(target_point + dp);
-					float color_b = target_points[target_id + ch];
-
-					norm += (color_a - color_b) * (color_a - color_b);
-
-					float gradient_x_a = source_gradient_values[(source_id + ch) * 2];
-					float gradient_x_b = target_gradient_values[(target_id + ch) * 2];
-					float gradient_y_a = source_gradient_values[(source_id + ch) * 2 + 1];
-					float gradient_y_b = target_gradient_values[(target_id + ch) * 2 + 1];
-
-					gradient_norm += (gradient_x_a - gradient_x_b) * (gradient_x_a - gradient_x_b) +
-									 (gradient_y_a - gradient_y_b) * (gradient_y_a - gradient_y_b);
-				}
-
-				distance += weight * norm;
-				gradient_distance += weight * gradient_norm;
-			}
-		}
-	}
 
-	return (_lambda * distance + (1 - _lambda) * gradient_distance) / (_patch_size.size_x * _patch_size.size_y);
+/**
+ * Same as calculate_direct(), but on the quantized images and gradients.
+ */
+void L2CombinedPatchDistance::calculate_quantized_combined(const Point *source_points,
+														   int count,
+														   const Point &target_point,
+														   float bound,
+														   float *distances)
+{
+	CombinedRows<QuantizedRows, QuantizedRows> rows(QuantizedRows(_quantized_patches, target_point),
+													QuantizedRows(_quantized_gradient_patches, target_point),
+													_lambda);
+	calculate_rows<double>(source_points, count, bound, rows, distances);
 }
@@ -15,6 +15,8 @@
 
 #include "a_patch_distance.h"
 #include "gradient.h"
+#include "feature_planes.h"
+#include "patch_row_norms.h"
 
 /**
  * Implements L2-Norm patch distance calculation method
@@ -33,14 +35,70 @@ public:
 	virtual ~L2CombinedPatchDistance() {};
 
 	virtual void initialize(FixedImage<float> source, FixedImage<float> target);
+	virtual void reinitialize(FixedImage<float> source, FixedImage<float> target, FixedMask modified_region);
 
 	virtual float calculate(const Point &source_point,
 							const Point &target_point);
 
+	virtual float calculate(const Point &source_point,
+							const Point &target_point,
+							float bound);
+
+	virtual void calculate(const Point *source_points,
+						   int count,
+						   const Point &target_point,
+						   float bound,
+						   float *distances);
+
+	// Calculates the distances by the norms of the patch rows and the dot products.
+	void use_norm_decomposition(bool value = true);
+
+	virtual float calculate_exact(const Point &source_point,
+								  const Point &target_point);
+
 private:
+	float _lambda;
+	// values and gradients stacked per pixel (the row kernel of the base class is selected for them)
+	FeaturePlanes _source_features;
+	FeaturePlanes _target_features;
+	bool _is_target_shared;		// the target features are the source ones
+	std::vector<float> _feature_weights;
+
+	// separate gradients (only for the norm decomposition and the quantized images)
 	FixedImage<float> _source_gradient;
 	FixedImage<float> _target_gradient;
-	float _lambda;
+	std::vector<float> _gradient_weights;
+
+	bool _use_norm_decomposition;
+	PatchRowNorms _source_norms;
+	PatchRowNorms _target_norms;
+	PatchRowNorms _source_gradient_norms;
+	PatchRowNorms _target_gradient_norms;
+	PatchDistanceKernels::RowKernel _dot_kernel;
+	PatchDistanceKernels::RowKernel _gradient_dot_kernel;
+
+	QuantizedPatches _quantized_gradient_patches;
+
+	void prepare(FixedImage<float> source, FixedImage<float> target);
+	void initialize_feature_moments(FixedImage<float> source, FixedImage<float> target);
+
+	void calculate_direct(const Point *source_points,
+						  int count,
+						  const Point &target_point,
+						  float bound,
+						  float *distances);
+
+	void calculate_decomposed(const Point *source_points,
+							  int count,
+							  const Point &target_point,
+							  float bound,
+							  float *distances);
+
+	void calculate_quantized_combined(const Point *source_points,
+									  int count,
+									  const Point &target_point,
+									  float bound,
+									  float *distances);
 };
 
 
@@ -11,94 +11,170 @@
  */
 
 #include "l2_norm_patch_distance.h"
+#include "patch_distance_kernels.h"
 
 L2NormPatchDistance::L2NormPatchDistance()
-	: APatchDistance() { }
+	: APatchDistance()
+{
+	_use_norm_decomposition = false;
+	_dot_kernel = 0;
+}
 
 L2NormPatchDistance::L2NormPatchDistance(Shape &patch_size, float gaussian_sigma)
-	: APatchDistance(patch_size, gaussian_sigma) { }
+	: APatchDistance(patch_size, gaussian_sigma)
+{
+	_use_norm_decomposition = false;
+	_dot_kernel = 0;
+}
+
+
+/**
+ * Selects the row kernel for the patch size and the number of channels of the images. Calculates the norms
+ * of the patch rows, if the norm decomposition is used, the moments of the patches, if the lower bounds are used,
+ * copies the images for the sparse stage, if any, and quantizes the images, if the search precision is not Float.
+ */
+void L2NormPatchDistance::initialize(FixedImage<float> source, FixedImage<float> target)
+{
+	APatchDistance::initialize(source, target);
+
+	int number_of_channels = source.get_number_of_channels();
+	_row_kernel = PatchDistanceKernels::select_squared_difference(_patch_size.size_x, number_of_channels, _is_uniform_weighting);
+
+	if (_use_norm_decomposition) {
+		// NOTE: the images may be modified between the calls, reinitialize() refreshes only the modified part
+		_dot_kernel = PatchDistanceKernels::select_dot_product(_patch_size.size_x, number_of_channels, _is_uniform_weighting);
+		_source_norms = PatchRowNorms(source, _patch_weighting);
+		_target_norms = (target == source) ? _source_norms : PatchRowNorms(target, _patch_weighting);
+	} else {
+		_source_norms = PatchRowNorms();
+		_target_norms = PatchRowNorms();
+	}
+
+	initialize_moments(source, target, QuantizedPatches::SquaredDifference);
+	_sparse_patches = SparsePatches(source, target, _patch_weighting, _sparse_stride, QuantizedPatches::SquaredDifference);
+
+	_quantized_patches = QuantizedPatches(source, target, _patch_weighting, _search_precision, QuantizedPatches::SquaredDifference);
+}
+
+
+/**
+ * Refreshes the norms of the patch rows, the moments of the patches and the copies of the sparse stage only around
+ * the modified region, if the image is shared by the source and the target, and quantizes the images again, if needed.
+ * Initializes for the whole images otherwise.
+ */
+void L2NormPatchDistance::reinitialize(FixedImage<float> source, FixedImage<float> target, FixedMask modified_region)
+{
+	if (!(source == _source) ||
+			!(target == source) ||
+			modified_region.get_size() != source.get_size() ||
+			_use_norm_decomposition != !_source_norms.is_empty() ||
+			_use_moment_bounds != !_source_moments.is_empty() ||
+			_sparse_stride != _sparse_patches.get_stride()) {
+		initialize(source, target);
+		return;
+	}
+
+	// NOTE: the target norms, moments and copies share the tables of the source ones
+	if (_use_norm_decomposition) {
+		_source_norms.refresh(modified_region);
+	}
+	refresh_moments(modified_region);
+	_sparse_patches.refresh(modified_region);
+
+	_quantized_patches = QuantizedPatches(source, target, _patch_weighting, _search_precision, QuantizedPatches::SquaredDifference);
+}
+
+
+/**
+ * Enables the calculation of the distances as ||a||^2 + ||b||^2 - 2<a, b>, where the norms of the patch rows are
+ * calculated once per image (see PatchRowNorms). Only the dot products are calculated per pair of patches.
+ *
+ * @note The result differs from the direct calculation by the rounding errors (larger for the large norms).
+ */
+void L2NormPatchDistance::use_norm_decomposition(bool value)
+{
+	_use_norm_decomposition = value;
+}
 
 
 float L2NormPatchDistance::calculate(const Point &source_point,
 							   	     const Point &target_point)
 {
-	if (_patch_weighting.is_empty()) {
-		_patch_weighting = GaussianWeights::calculate(_patch_size.size_x,
-													  _patch_size.size_y,
-													  _gaussian_sigma,
-													  _gaussian_sigma);
+	return calculate(source_point, target_point, numeric_limits<float>::max());
+}
+
+
+/**
+ * Calculates the distance row by row and stops as soon as the partial weighted sum exceeds the bound.
+ */
+float L2NormPatchDistance::calculate(const Point &source_point,
+							   	     const Point &target_point,
+							   	     float bound)
+{
+	float distance;
+	calculate(&source_point, 1, target_point, bound, &distance);
+	return distance;
+}
+
+
+/**
+ * Calculates the distances on the quantized images, if any, or on the float images (directly or by the norm decomposition).
+ */
+void L2NormPatchDistance::calculate(const Point *source_points,
+									int count,
+									const Point &target_point,
+									float bound,
+									float *distances)
+{
+	if (!_quantized_patches.is_empty()) {
+		calculate_quantized(source_points, count, target_point, bound, distances);
+	} else if (_use_norm_decomposition) {
+		calculate_decomposed(source_points, count, target_point, bound, distances);
+	} else {
+		calculate_direct(source_points, count, target_point, bound, distances);
 	}
+}
+
 
-	// calculate distance between source and target patches
-	int radius_x = _patch_size.size_x / 2;
-	int radius_y = _patch_size.size_y / 2;
-
-	// NOTE: direct access - we sacrifice readability in favor of performance
-	const float *source_points = _source.raw();
-	const float *target_points = _target.raw();
-	const float *p_weight = _patch_weighting.raw();
-	int number_of_channels = _source.get_number_of_channels();
-	int source_stride = _source.get_size_x();
-	int target_stride = _target.get_size_x();
-
-	float distance = 0.0;
-	if (number_of_channels == 3) {
-		// NOTE: unrolled channel loop for 3 channels
-		for (int dy = -radius_y; dy < ((int)_patch_size.size_y - radius_y); dy++) {
-			for (int dx = -radius_x; dx < ((int)_patch_size.size_x - radius_x); dx++, ++p_weight) {
-				// NOTE: this is the same as: _patch_weighting(dx + radius_x, dy + radius_y);
-				float weight = *p_weight;
-
-				// calculate partial result as a weighted norm
-				int source_id = 3 * (source_stride * (source_point.y + dy) + (source_point.x + dx));
-				int target_id = 3 * (target_stride * (target_point.y + dy) + (target_point.x + dx));
-
-				float norm = (source_points[source_id] - target_points[target_id]) * (source_points[source_id] - target_points[target_id]) +
-							 (source_points[source_id + 1] - target_points[target_id + 1]) * (source_points[source_id + 1] - target_points[target_id + 1]) +
-							 (source_points[source_id + 2] - target_points[target_id + 2]) * (source_points[source_id + 2] - target_points[target_id + 2]);
-
-				distance += weight * norm;
-			}
-		}
-	} else if (number_of_channels == 1) {
-		// NOTE: no channel loop for 1 channel
-		for (int dy = -radius_y; dy < ((int)_patch_size.size_y - radius_y); dy++) {
-			for (int dx = -radius_x; dx < ((int)_patch_size.size_x - radius_x); dx++, ++p_weight) {
-				// NOTE: this is the same as: _patch_weighting(dx + radius_x, dy + radius_y);
-				float weight = *p_weight;
-
-				// calculate partial result as a weighted norm
-				int source_id = source_stride * (source_point.y + dy) + (source_point.x + dx);
-				int target_id = target_stride * (target_point.y + dy) + (target_point.x + dx);
-
-				float norm = (source_points[source_id] - target_points[target_id]) * (source_points[source_id] - target_points[target_id]);
-
-				distance += weight * norm;
-			}
-		}
+float L2NormPatchDistance::calculate_exact(const Point &source_point,
+										   const Point &target_point)
+{
+	float distance;
+	if (_use_norm_decomposition) {
+		calculate_decomposed(&source_point, 1, target_point, numeric_limits<float>::max(), &distance);
 	} else {
-		for (int dy = -radius_y; dy < ((int)_patch_size.size_y - radius_y); dy++) {
-			for (int dx = -radius_x; dx < ((int)_patch_size.size_x - radius_x); dx++, ++p_weight) {
-				// NOTE: this is the same as: _patch_weighting(dx + radius_x, dy + radius_y);
-				float weight = *p_weight;
-
-				// calculate partial result as a weighted norm
-				float norm = 0.0;
-				int source_id = number_of_channels * (source_stride * (source_point.y + dy) + (source_point.x + dx));
-				int target_id = number_of_channels * (target_stride * (target_point.y + dy) + (target_point.x + dx));
-				for (int ch = 0; ch < number_of_channels; ch++) {
-					// NOTE: this is the same as: source(source_point + dp);
-					float color_a = source_points[source_id + ch];
-					// NOTE: this is the same as: target(target_point + dp);
-					float color_b = target_points[target_id + ch];
-
-					norm += (color_a - color_b) * (color_a - color_b);
-				}
-
-				distance += weight * norm;
-			}
-		}
+		calculate_direct(&source_point, 1, target_point, numeric_limits<float>::max(), &distance);
 	}
+	return distance;
+}
 
-	return distance / (_patch_size.size_x * _patch_size.size_y);
+
+/* Private */
+
+/**
+ * Calculates the distances row by row (in the images with interleaved channels a row of a patch is contiguous)
+ * and stops as soon as the partial weighted sum exceeds the bound. The bound is tightened by every calculated distance.
+ */
+void L2NormPatchDistance::calculate_direct(const Point *source_points,
+										   int count,
+										   const Point &target_point,
+										   float bound,
+										   float *distances)
+{
+	KernelRows rows = get_kernel_rows(_row_kernel, target_point);
+	calculate_rows<float>(source_points, count, bound, rows, distances);
+}
+
+
+/**
+ * Same as above, but every row is calculated as the sum of the norms minus the doubled dot product.
+ */
+void L2NormPatchDistance::calculate_decomposed(const Point *source_points,
+											   int count,
+											   const Point &target_point,
+											   float bound,
+											   float *distances)
+{
+	DecomposedRows rows(get_kernel_rows(_dot_kernel, target_point), _source_norms, _target_norms, target_point);
+	calculate_rows<float>(source_points, count, bound, rows, distances);
 }
@@ -15,6 +15,7 @@
 
 #include <map>
 #include "a_patch_distance.h"
+#include "patch_row_norms.h"
 
 using namespace std;
 
@@ -29,8 +30,45 @@ public:
 
 	virtual ~L2NormPatchDistance() {};
 
+	virtual void initialize(FixedImage<float> source, FixedImage<float> target);
+	virtual void reinitialize(FixedImage<float> source, FixedImage<float> target, FixedMask modified_region);
+
 	virtual float calculate(const Point &source_point,
 							const Point &target_point);
+
+	virtual float calculate(const Point &source_point,
+							const Point &target_point,
+							float bound);
+
+	virtual void calculate(const Point *source_points,
+						   int count,
+						   const Point &target_point,
+						   float bound,
+						   float *distances);
+
+	// Calculates the distances by the norms of the patch rows and the dot products.
+	void use_norm_decomposition(bool value = true);
+
+	virtual float calculate_exact(const Point &source_point,
+								  const Point &target_point);
+
+private:
+	bool _use_norm_decomposition;
+	PatchRowNorms _source_norms;
+	PatchRowNorms _target_norms;
+	PatchDistanceKernels::RowKernel _dot_kernel;
+
+	void calculate_direct(const Point *source_points,
+						  int count,
+						  const Point &target_point,
+						  float bound,
+						  float *distances);
+
+	void calculate_decomposed(const Point *source_points,
+							  int count,
+							  const Point &target_point,
+							  float bound,
+							  float *distances);
 };
 
 
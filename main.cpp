@@ -15,6 +15,8 @@
 
 #include "image_inpainting.h"
 #include "patch_match.h"
+#include "exhaustive_search.h"
+#include "cpu_dispatch.h"
 #include "a_patch_distance.h"
 #include "patch_non_local_means.h"
 #include "patch_non_local_medians.h"
@@ -75,6 +77,24 @@ int main(int argc, char *argv[])
 	float patch_sigma					= atof(pick_option(&argc, &argv, "psigma" , "10000.0"));	// uniform weights
 	string show_nnf_file				=      pick_option(&argc, &argv, "shownnf", "");
 	string show_pyramid_file			=      pick_option(&argc, &argv, "showpyr", "");
+	string propagation_scheme_name		=      pick_option(&argc, &argv, "pmsched", "scanline");	// scanline, checkerboard, tiles
+	bool use_active_set					=      pick_option(&argc, &argv, "pmactive", NULL) != NULL;
+	bool use_tree_initialization		=      pick_option(&argc, &argv, "pmkdtree", NULL) != NULL;
+	string seed_value					=      pick_option(&argc, &argv, "seed"   , "");			// empty for a time based seed
+	float refresh_threshold				= atof(pick_option(&argc, &argv, "pmrefresh", "-1"));		// negative to disable
+	string stats_file					=      pick_option(&argc, &argv, "pmstats", "");
+	int memo_size						= atoi(pick_option(&argc, &argv, "pmmemo" , "0"));			// 0 to disable
+	int dominant_offsets_count			= atoi(pick_option(&argc, &argv, "pmoffsets", "0"));		// 0 to disable
+	int search_window_size				= atoi(pick_option(&argc, &argv, "pmwindow", "-1"));		// -1 for the whole source
+	bool use_adaptive_search_windows	=      pick_option(&argc, &argv, "pmadaptive", NULL) != NULL;
+	int sparse_target_stride			= atoi(pick_option(&argc, &argv, "pmstride", "1"));		// 1 to disable
+	int sparse_target_scales			= atoi(pick_option(&argc, &argv, "pmstridescales", "1"));
+	int exhaustive_search_threshold		= atoi(pick_option(&argc, &argv, "pmexact", "1024"));		// 0 to disable
+	string isa_name						=      pick_option(&argc, &argv, "isa"    , "");			// empty for the best supported
+	bool use_norm_decomposition			=      pick_option(&argc, &argv, "pdecomp", NULL) != NULL;
+	string search_precision_name		=      pick_option(&argc, &argv, "pmprec" , "float");		// float, int16, uint8
+	string moment_bounds_name			=      pick_option(&argc, &argv, "pbound" , "none");		// none, mean, meanstd
+	int sparse_stride					= atoi(pick_option(&argc, &argv, "psparse", "1"));			// 1 to disable
 
 	if (argc < 4) {
 		// display usage message and quit
@@ -91,8 +111,26 @@ int main(int argc, char *argv[])
 		fprintf(stderr, " -lambda \tlambda (%g)\n", lambda);
 		fprintf(stderr, " -init   \tinitialization type [poisson/black/avg/none] (%s)\n", initialization_type_name.c_str());
 		fprintf(stderr, " -psigma \tGaussian patch weights (%g)\n", patch_sigma);
+		fprintf(stderr, " -pdecomp\tL2 patch distances by the decomposition into norms and dot products\n");
+		fprintf(stderr, " -pbound \tPatchMatch rejects candidates by lower bounds of the distances [none/mean/meanstd] (%s)\n", moment_bounds_name.c_str());
+		fprintf(stderr, " -psparse\tPatchMatch rejects candidates by distances of every n-th pixel of the patches (%d)\n", sparse_stride);
 		fprintf(stderr, " -showpyr\tPREFIX write intermediate pyramid results\n");
 		fprintf(stderr, " -shownnf\tFILENAME write illustration of the final NNF\n");
+		fprintf(stderr, " -pmsched\tPatchMatch propagation scheme [scanline/checkerboard/tiles] (%s)\n", propagation_scheme_name.c_str());
+		fprintf(stderr, " -pmactive\tPatchMatch revisits only points improved in the previous sweep\n");
+		fprintf(stderr, " -pmkdtree\tPatchMatch initializes NNF by a kd-tree of projected patches (instead of random)\n");
+		fprintf(stderr, " -pmrefresh\tPatchMatch recalculates only patches with pixels changed more than the threshold (%g)\n", refresh_threshold);
+		fprintf(stderr, " -pmexact\tNNF is searched exhaustively for images with at most this number of pixels (%d)\n", exhaustive_search_threshold);
+		fprintf(stderr, " -pmprec \tPatchMatch searches on images quantized to [float/int16/uint8] (%s)\n", search_precision_name.c_str());
+		fprintf(stderr, " -pmmemo \tPatchMatch skips candidates found in a per-thread memo of this number of entries (%d)\n", memo_size);
+		fprintf(stderr, " -pmoffsets\tPatchMatch tries this number of the most frequent offsets of the NNF before the random search (%d)\n", dominant_offsets_count);
+		fprintf(stderr, " -pmwindow\tPatchMatch random search starts in a window of this radius (%d, the whole source)\n", search_window_size);
+		fprintf(stderr, " -pmadaptive\tPatchMatch search windows of the finer scales follow the spread of the coarser NNF\n");
+		fprintf(stderr, " -pmstride\tPatchMatch searches every n-th target point in x and y at the finest scales, the others are interpolated (%d)\n", sparse_target_stride);
+		fprintf(stderr, " -pmstridescales\tnumber of the finest scales searched sparsely by -pmstride (%d)\n", sparse_target_scales);
+		fprintf(stderr, " -pmstats\tFILENAME write PatchMatch statistics (one line per sweep, tab separated)\n");
+		fprintf(stderr, " -isa    \tinstruction set of the kernels [scalar/sse2/avx2] (%s)\n", CpuDispatch::get_isa_name(CpuDispatch::get_isa()));
+		fprintf(stderr, " -seed   \tseed of the random number generator (time based)\n");
 		return 1;
 	}
 
@@ -173,6 +211,17 @@ int main(int argc, char *argv[])
 	if (scales_amount < 1) {
 		throw std::runtime_error("ERROR: number of scales must be at least 1.");
 	}
+	if (sparse_stride < 1) {
+		throw std::runtime_error("ERROR: sparse stride must be at least 1.");
+	}
+
+	if (sparse_target_stride < 1) {
+		throw std::runtime_error("ERROR: sparse target stride must be at least 1.");
+	}
+
+	if (search_window_size < 1 && search_window_size != -1) {
+		throw std::runtime_error("ERROR: search window size must be at least 1 (or -1 for the whole source).");
+	}
 
 	// if coarsest scale size ratio is equal to 1, set the number of scales to 1
 	if (std::abs(coarsest_rate - 1.0f) < 0.00001f) {
@@ -194,6 +243,48 @@ int main(int argc, char *argv[])
 		throw std::runtime_error("ERROR: Unknown initialization type");
 	}
 
+	// set instruction set of the kernels
+	if (!isa_name.empty()) {
+		CpuDispatch::Isa isa;
+		if (!CpuDispatch::parse_isa(isa_name, isa)) {
+			throw std::runtime_error("ERROR: Unknown instruction set");
+		}
+		if (!CpuDispatch::set_isa(isa)) {
+			throw std::runtime_error("ERROR: Instruction set is not supported by this CPU");
+		}
+	}
+	printf("\tisa %s\n", CpuDispatch::get_isa_name(CpuDispatch::get_isa()));
+
+	// set PatchMatch propagation scheme
+	PatchMatch::PropagationScheme propagation_scheme;
+	if (propagation_scheme_name.compare("scanline") == 0) {
+		propagation_scheme = PatchMatch::Scanline;
+	} else if (propagation_scheme_name.compare("checkerboard") == 0) {
+		propagation_scheme = PatchMatch::Checkerboard;
+	} else if (propagation_scheme_name.compare("tiles") == 0) {
+		propagation_scheme = PatchMatch::Tiles;
+	} else {
+		throw std::runtime_error("ERROR: Unknown PatchMatch propagation scheme");
+	}
+
+	// set precision of the PatchMatch search
+	QuantizedPatches::Precision search_precision;
+	if (!QuantizedPatches::parse_precision(search_precision_name, search_precision)) {
+		throw std::runtime_error("ERROR: Unknown PatchMatch search precision");
+	}
+
+	// set lower bounds of the patch distances (moments of the patches)
+	bool use_moment_bounds = false;
+	bool use_moment_deviations = false;
+	if (moment_bounds_name.compare("mean") == 0) {
+		use_moment_bounds = true;
+	} else if (moment_bounds_name.compare("meanstd") == 0) {
+		use_moment_bounds = true;
+		use_moment_deviations = true;
+	} else if (moment_bounds_name.compare("none") != 0) {
+		throw std::runtime_error("ERROR: Unknown lower bounds of the patch distances");
+	}
+
 	// define inpainting parameters
 	float tolerance = 0.1;
 	float subsampling_rate = ImageInpainting::calculate_subsampling_rate(coarsest_rate, scales_amount);
@@ -224,27 +315,60 @@ int main(int argc, char *argv[])
 	AImageUpdating *image_updating;
 	if(method_name.compare("nlmeans") == 0) {
 		image_updating = new PatchNonLocalMeans(image_update_patch_size, image_update_sigma);
-		patch_distance = new L2NormPatchDistance(weights_update_patch_size, weights_update_sigma);
+		L2NormPatchDistance *l2_distance = new L2NormPatchDistance(weights_update_patch_size, weights_update_sigma);
+		l2_distance->use_norm_decomposition(use_norm_decomposition);
+		patch_distance = l2_distance;
 	} else if(method_name.compare("nlmedians") == 0) {
 		image_updating = new PatchNonLocalMedians(image_update_patch_size, image_update_sigma);
 		patch_distance = new L1NormPatchDistance(weights_update_patch_size, weights_update_sigma);
 	} else if (method_name.compare("nlpoisson") == 0) {
 		image_updating = new PatchNonLocalPoisson(image_update_patch_size, image_update_sigma, lambda, 0.000001, 1000);	// 0.000001, 1000
-		patch_distance = new L2CombinedPatchDistance(lambda, weights_update_patch_size, weights_update_sigma);
+		L2CombinedPatchDistance *l2_combined_distance = new L2CombinedPatchDistance(lambda, weights_update_patch_size, weights_update_sigma);
+		l2_combined_distance->use_norm_decomposition(use_norm_decomposition);
+		patch_distance = l2_combined_distance;
 	} else {
 		throw std::runtime_error("ERROR: Unknown method name");
 	}
+	patch_distance->set_search_precision(search_precision);
+	patch_distance->use_moment_bounds(use_moment_bounds, use_moment_deviations);
+	patch_distance->set_sparse_stride(sparse_stride);
 
 	// create PatchMatch object
-	PatchMatch *patch_match = new PatchMatch(patch_distance, patch_match_iterations, random_shots_limit, -1);
+	PatchMatch *patch_match = new PatchMatch(patch_distance, patch_match_iterations, random_shots_limit, search_window_size);
+	patch_match->set_propagation_scheme(propagation_scheme);
+	patch_match->use_active_set(use_active_set);
+	patch_match->use_tree_initialization(use_tree_initialization);
+	patch_match->set_memo_size(memo_size);
+	patch_match->set_dominant_offsets_count(dominant_offsets_count);
+
+	// init random generator (for PatchMatch)
+	unsigned int seed = seed_value.empty() ? (unsigned int)time(NULL) : (unsigned int)strtoul(seed_value.c_str(), NULL, 10);
+	patch_match->set_seed(seed);
+	printf("\tseed %u\n", seed);
+
+	// write PatchMatch statistics, if needed
+	FILE *stats_output = NULL;
+	if (!stats_file.empty()) {
+		stats_output = fopen(stats_file.c_str(), "w");
+		if (!stats_output) {
+			throw std::runtime_error("ERROR: Cannot open the statistics file");
+		}
+		patch_match->set_metrics_output(stats_output);
+	}
+
+	// create exact search object (replaces PatchMatch for small images)
+	ExhaustiveSearch *exhaustive_search = new ExhaustiveSearch(patch_distance);
 
 	// link PacthMatch and ImageUpdating objects to multiscale image inpainter
 	image_inpainting.set_weights_updating(patch_match);
+	image_inpainting.set_exhaustive_search(exhaustive_search);
+	image_inpainting.set_exhaustive_search_threshold(exhaustive_search_threshold);
 	image_inpainting.set_image_updating(image_updating);
+	image_inpainting.set_refresh_threshold(refresh_threshold);
+	image_inpainting.use_adaptive_search_windows(use_adaptive_search_windows);
+	image_inpainting.set_sparse_target_stride(sparse_target_stride);
+	image_inpainting.set_sparse_target_scales(sparse_target_scales);
 
-	// init random generator (for PatchMatch)
-	srand(time(NULL));
-	
 	// tell algorithm to keep original image pyramid and nnf pyramid, if needed
 	image_inpainting.keep_intermediate(!show_nnf_file.empty() || !show_pyramid_file.empty());
 
@@ -252,7 +376,11 @@ int main(int argc, char *argv[])
 	Image<float> output = image_inpainting.process(input, mask);
 
 	// clean
+	if (stats_output) {
+		fclose(stats_output);
+	}
 	delete patch_match;
+	delete exhaustive_search;
 	delete patch_distance;
 	delete image_updating;
 
@@ -634,6 +634,7 @@ bool& Mask::operator() (uint x, uint y)
 {
 	_internal->is_first_last_valid = false;
 	_internal->is_points_cache_valid = false;
+	_internal->is_bounding_box_valid = false;
 
 	return _data[get_index(x, y, 0)];
 }
@@ -646,6 +647,7 @@ bool& Mask::operator() (uint x, uint y, uint channel)
 {
 	_internal->is_first_last_valid = false;
 	_internal->is_points_cache_valid = false;
+	_internal->is_bounding_box_valid = false;
 
 	return _data[get_index(x, y, channel)];
 }
@@ -658,6 +660,7 @@ bool& Mask::operator() (Point p)
 {
 	_internal->is_first_last_valid = false;
 	_internal->is_points_cache_valid = false;
+	_internal->is_bounding_box_valid = false;
 
 	return _data[get_index(p.x, p.y, 0)];
 }
@@ -670,6 +673,7 @@ bool& Mask::operator() (Point p, uint channel)
 {
 	_internal->is_first_last_valid = false;
 	_internal->is_points_cache_valid = false;
+	_internal->is_bounding_box_valid = false;
 
 	return _data[get_index(p.x, p.y, channel)];
 }
@@ -687,6 +691,7 @@ bool& Mask::at(uint x, uint y)
 
 	_internal->is_first_last_valid = false;
 	_internal->is_points_cache_valid = false;
+	_internal->is_bounding_box_valid = false;
 
 	return _data[get_index(x, y, 0)];
 }
@@ -704,6 +709,7 @@ bool& Mask::at(uint x, uint y, uint channel)
 
 	_internal->is_first_last_valid = false;
 	_internal->is_points_cache_valid = false;
+	_internal->is_bounding_box_valid = false;
 
 	return _data[get_index(x, y, channel)];
 }
@@ -721,6 +727,7 @@ bool& Mask::at(Point p)
 
 	_internal->is_first_last_valid = false;
 	_internal->is_points_cache_valid = false;
+	_internal->is_bounding_box_valid = false;
 
 	return _data[get_index(p.x, p.y, 0)];
 }
@@ -738,6 +745,7 @@ bool& Mask::at(Point p, uint channel)
 
 	_internal->is_first_last_valid = false;
 	_internal->is_points_cache_valid = false;
+	_internal->is_bounding_box_valid = false;
 
 	return _data[get_index(p.x, p.y, channel)];
 }
@@ -755,6 +763,7 @@ void Mask::mask(uint x, uint y)
 
 	_internal->is_first_last_valid = false;
 	_internal->is_points_cache_valid = false;
+	_internal->is_bounding_box_valid = false;
 
 	_data[get_index(x, y, 0)] = true;
 }
@@ -772,6 +781,7 @@ void Mask::mask(uint x, uint y, uint channel)
 
 	_internal->is_first_last_valid = false;
 	_internal->is_points_cache_valid = false;
+	_internal->is_bounding_box_valid = false;
 
 	_data[get_index(x, y, channel)] = true;
 }
@@ -789,6 +799,7 @@ void Mask::mask(Point p)
 
 	_internal->is_first_last_valid = false;
 	_internal->is_points_cache_valid = false;
+	_internal->is_bounding_box_valid = false;
 
 	_data[get_index(p.x, p.y, 0)] = true;
 }
@@ -806,6 +817,7 @@ void Mask::mask(Point p, uint channel)
 
 	_internal->is_first_last_valid = false;
 	_internal->is_points_cache_valid = false;
+	_internal->is_bounding_box_valid = false;
 
 	_data[get_index(p.x, p.y, channel)] = true;
 }
@@ -823,6 +835,7 @@ void Mask::unmask(uint x, uint y)
 
 	_internal->is_first_last_valid = false;
 	_internal->is_points_cache_valid = false;
+	_internal->is_bounding_box_valid = false;
 
 	_data[get_index(x, y, 0)] = false;
 }
@@ -840,6 +853,7 @@ void Mask::unmask(uint x, uint y, uint channel)
 
 	_internal->is_first_last_valid = false;
 	_internal->is_points_cache_valid = false;
+	_internal->is_bounding_box_valid = false;
 
 	_data[get_index(x, y, channel)] = true;
 }
@@ -857,6 +871,7 @@ void Mask::unmask(Point p)
 
 	_internal->is_first_last_valid = false;
 	_internal->is_points_cache_valid = false;
+	_internal->is_bounding_box_valid = false;
 
 	_data[get_index(p.x, p.y, 0)] = true;
 }
@@ -874,6 +889,7 @@ void Mask::unmask(Point p, uint channel)
 
 	_internal->is_first_last_valid = false;
 	_internal->is_points_cache_valid = false;
+	_internal->is_bounding_box_valid = false;
 
 	_data[get_index(p.x, p.y, channel)] = true;
 }
@@ -936,6 +952,7 @@ void Mask::invert()
 
 	_internal->is_first_last_valid = false;
 	_internal->is_points_cache_valid = false;
+	_internal->is_bounding_box_valid = false;
 }
 
 /* Protected */
@@ -0,0 +1,91 @@
+/**
+ * Copyright (C) 2015, Vadim Fedorov <vadim.fedorov@upf.edu>
+ * Copyright (C) 2015, Gabriele Facciolo <facciolo@ens-cachan.fr>
+ * Copyright (C) 2015, Pablo Arias <pablo.arias@cmla.ens-cachan.fr>
+ *
+ * This program is free software: you can use, modify and/or
+ * redistribute it under the terms of the simplified BSD
+ * License. You should have received a copy of this license along
+ * this program. If not, see
+ * <http://www.opensource.org/licenses/bsd-license.html>.
+ */
+
+#include "patch_distance_kernels.h"
+#include "cpu_dispatch.h"
+
+
+float PatchDistanceKernels::weighted_squared_difference(const float *a, const float *b, const float *weights, int length)
+{
+	return CpuDispatch::get_kernels().squared_difference(a, b, weights, length);
+}
+
+
+float PatchDistanceKernels::weighted_absolute_difference(const float *a, const float *b, const float *weights, int length)
+{
+	return CpuDispatch::get_kernels().absolute_difference(a, b, weights, length);
+}
+
+
+/**
+ * Selects the squared difference kernel (of the instruction set selected by CpuDispatch) for the rows of patches
+ * of the given side. Patch sides 5, 7, 9, 11, 13 and 1, 2, 3, 6 or 9 channels are specialized (2 and 6 are the channels
+ * of the gradients of 1 and 3 channel images, 9 of the stacked features of 3 channel images).
+ *
+ * @param is_uniform If true, all weights are assumed to be equal to the first one.
+ */
+PatchDistanceKernels::RowKernel PatchDistanceKernels::select_squared_difference(int patch_side, int number_of_channels, bool is_uniform)
+{
+	return CpuDispatch::get_kernels().select_squared_difference(patch_side, number_of_channels, is_uniform);
+}
+
+
+/**
+ * Selects the absolute difference kernel (of the instruction set selected by CpuDispatch) for the rows of patches
+ * of the given side. Patch sides 5, 7, 9, 11, 13 and 1 or 3 channels are specialized.
+ *
+ * @param is_uniform If true, all weights are assumed to be equal to the first one.
+ */
+PatchDistanceKernels::RowKernel PatchDistanceKernels::select_absolute_difference(int patch_side, int number_of_channels, bool is_uniform)
+{
+	return CpuDispatch::get_kernels().select_absolute_difference(patch_side, number_of_channels, is_uniform);
+}
+
+
+/**
+ * Selects the dot product kernel (of the instruction set selected by CpuDispatch) for the rows of patches
+ * of the given side (specialized as the squared difference).
+ *
+ * @param is_uniform If true, all weights are assumed to be equal to the first one.
+ */
+PatchDistanceKernels::RowKernel PatchDistanceKernels::select_dot_product(int patch_side, int number_of_channels, bool is_uniform)
+{
+	return CpuDispatch::get_kernels().select_dot_product(patch_side, number_of_channels, is_uniform);
+}
+
+
+/**
+ * Selects the kernels of the quantized images (of the instruction set selected by CpuDispatch) for the rows of
+ * patches of the given side (specialized as the kernels above).
+ */
+PatchDistanceKernels::Int16RowKernel PatchDistanceKernels::select_int16_squared_difference(int patch_side, int number_of_channels)
+{
+	return CpuDispatch::get_kernels().select_int16_squared_difference(patch_side, number_of_channels);
+}
+
+
+PatchDistanceKernels::Int16RowKernel PatchDistanceKernels::select_int16_absolute_difference(int patch_side, int number_of_channels)
+{
+	return CpuDispatch::get_kernels().select_int16_absolute_difference(patch_side, number_of_channels);
+}
+
+
+PatchDistanceKernels::UInt8RowKernel PatchDistanceKernels::select_uint8_squared_difference(int patch_side, int number_of_channels)
+{
+	return CpuDispatch::get_kernels().select_uint8_squared_difference(patch_side, number_of_channels);
+}
+
+
+PatchDistanceKernels::UInt8RowKernel PatchDistanceKernels::select_uint8_absolute_difference(int patch_side, int number_of_channels)
+{
+	return CpuDispatch::get_kernels().select_uint8_absolute_difference(patch_side, number_of_channels);
+}
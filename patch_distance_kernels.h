@@ -0,0 +1,57 @@
+/**
+ * Copyright (C) 2015, Vadim Fedorov <vadim.fedorov@upf.edu>
+ * Copyright (C) 2015, Gabriele Facciolo <facciolo@ens-cachan.fr>
+ * Copyright (C) 2015, Pablo Arias <pablo.arias@cmla.ens-cachan.fr>
+ *
+ * This program is free software: you can use, modify and/or
+ * redistribute it under the terms of the simplified BSD
+ * License. You should have received a copy of this license along
+ * this program. If not, see
+ * <http://www.opensource.org/licenses/bsd-license.html>.
+ */
+
+#ifndef PATCH_DISTANCE_KERNELS_H_
+#define PATCH_DISTANCE_KERNELS_H_
+
+#include <stdint.h>
+
+/**
+ * Weighted sums over a row of a patch. In the images with interleaved channels, a row of
+ * a patch is a contiguous array of (patch width * number of channels) values, therefore
+ * the same kernels serve any number of channels (weights are repeated for each channel).
+ *
+ * @note The kernels of the instruction set selected by CpuDispatch are used (AVX2, SSE2 or
+ *       scalar), the remaining elements of a row are processed by the scalar code.
+ */
+class PatchDistanceKernels
+{
+public:
+	/// Sum of weights[i] * (a[i] - b[i])^2
+	static float weighted_squared_difference(const float *a, const float *b, const float *weights, int length);
+
+	/// Sum of weights[i] * |a[i] - b[i]|
+	static float weighted_absolute_difference(const float *a, const float *b, const float *weights, int length);
+
+	/// Kernel over a row of 'length' values (same arguments as above).
+	typedef float (*RowKernel)(const float *a, const float *b, const float *weights, int length);
+
+	/// Kernels specialized at compile time for common patch sides and numbers of channels (the generic
+	/// kernels otherwise), selected once per image. Uniform kernels use only the first weight.
+	static RowKernel select_squared_difference(int patch_side, int number_of_channels, bool is_uniform);
+	static RowKernel select_absolute_difference(int patch_side, int number_of_channels, bool is_uniform);
+
+	/// Sum of weights[i] * a[i] * b[i] (for the decomposition of the squared difference, see PatchRowNorms).
+	static RowKernel select_dot_product(int patch_side, int number_of_channels, bool is_uniform);
+
+	/// Kernels over the rows of the quantized images (see QuantizedPatches), the weights contain the quantization steps.
+	/// NOTE: the length is rounded up to a multiple of 8, the weights of the padding must be zeros.
+	typedef float (*Int16RowKernel)(const int16_t *a, const int16_t *b, const float *weights, int length);
+	typedef float (*UInt8RowKernel)(const uint8_t *a, const uint8_t *b, const float *weights, int length);
+	static Int16RowKernel select_int16_squared_difference(int patch_side, int number_of_channels);
+	static Int16RowKernel select_int16_absolute_difference(int patch_side, int number_of_channels);
+	static UInt8RowKernel select_uint8_squared_difference(int patch_side, int number_of_channels);
+	static UInt8RowKernel select_uint8_absolute_difference(int patch_side, int number_of_channels);
+};
+
+
+#endif /* PATCH_DISTANCE_KERNELS_H_ */
@@ -0,0 +1,371 @@
+/**
+ * Copyright (C) 2015, Vadim Fedorov <vadim.fedorov@upf.edu>
+ * Copyright (C) 2015, Gabriele Facciolo <facciolo@ens-cachan.fr>
+ * Copyright (C) 2015, Pablo Arias <pablo.arias@cmla.ens-cachan.fr>
+ *
+ * This program is free software: you can use, modify and/or
+ * redistribute it under the terms of the simplified BSD
+ * License. You should have received a copy of this license along
+ * this program. If not, see
+ * <http://www.opensource.org/licenses/bsd-license.html>.
+ */
+
+#include "patch_kd_tree.h"
+#include <math.h>
+#include <limits>
+#include <algorithm>
+
+// maximal number of patches used for the principal component analysis
+static const int PCA_SAMPLES_LIMIT = 2000;
+// number of power iterations per component
+static const int POWER_ITERATIONS = 30;
+// ranges smaller than this are built by the current thread (without new tasks)
+static const int TASK_SIZE_THRESHOLD = 4096;
+
+/**
+ * Compares projections of the points (given by indices) along one dimension.
+ */
+struct __CoordinateLess {
+	const float *coordinates;
+	int number_of_components;
+	int dimension;
+
+	bool operator() (int a, int b) const
+	{
+		return coordinates[number_of_components * a + dimension] < coordinates[number_of_components * b + dimension];
+	}
+};
+
+
+PatchKdTree::PatchKdTree()
+{
+	_number_of_components = 0;
+}
+
+
+/**
+ * Calculates principal components of the source patches, projects all of them and builds the tree.
+ * Projections and subtrees are calculated in parallel (if OpenMP is used).
+ */
+PatchKdTree::PatchKdTree(FixedImage<float> source,
+						 FixedMask source_mask,
+						 FixedImage<float> patch_weighting,
+						 int number_of_components)
+{
+	_source = source;
+	_source_mask = source_mask;
+	_patch_size = patch_weighting.get_size();
+
+	int dimensions = _patch_size.size_x * _patch_size.size_y * source.get_number_of_channels();
+	_number_of_components = max(1, min(min(number_of_components, (int)MAX_COMPONENTS), dimensions));
+
+	vector<Point> source_points = source_mask.get_masked_points();
+	int count = source_points.size();
+	if (count == 0) {
+		return;
+	}
+
+	calculate_components(patch_weighting, source_points);
+
+	// project all source patches
+	vector<float> coordinates(_number_of_components * count);
+	#pragma omp parallel for schedule(static)
+	for (int i = 0; i < count; i++) {
+		project(source, source_points[i], &coordinates[_number_of_components * i]);
+	}
+
+	// build the tree on indices, then store the points and projections in the order of the tree nodes
+	vector<int> order(count);
+	for (int i = 0; i < count; i++) {
+		order[i] = i;
+	}
+
+	_coordinates.swap(coordinates);
+	_split_dimensions.assign(count, 0);
+
+	#pragma omp parallel
+	{
+		#pragma omp single
+		build(&order[0], 0, count);
+	}
+
+	_points.resize(count);
+	vector<float> ordered_coordinates(_number_of_components * count);
+	for (int i = 0; i < count; i++) {
+		_points[i] = source_points[order[i]];
+		for (int c = 0; c < _number_of_components; c++) {
+			ordered_coordinates[_number_of_components * i + c] = _coordinates[_number_of_components * order[i] + c];
+		}
+	}
+	_coordinates.swap(ordered_coordinates);
+}
+
+
+bool PatchKdTree::is_empty() const
+{
+	return _points.empty();
+}
+
+
+FixedImage<float> PatchKdTree::get_source() const
+{
+	return _source;
+}
+
+
+FixedMask PatchKdTree::get_source_mask() const
+{
+	return _source_mask;
+}
+
+
+/**
+ * Descends to the leaf containing the projection of the target patch and backtracks while the
+ * other subtrees may contain closer projections, at most 'max_checks' nodes are visited.
+ *
+ * @return Source point or (-1, -1) for the empty tree.
+ */
+Point PatchKdTree::find(FixedImage<float> target, Point target_point, int max_checks) const
+{
+	if (_points.empty()) {
+		return Point(-1, -1);
+	}
+
+	float query[MAX_COMPONENTS];
+	project(target, target_point, query);
+
+	int best = 0;
+	float best_distance = numeric_limits<float>::max();
+	int checks = max_checks;
+	search(query, 0, _points.size(), best, best_distance, checks);
+
+	return _points[best];
+}
+
+
+/* Private */
+
+/**
+ * Estimates the leading eigenvectors of the covariance matrix of the (weighted) source patches
+ * by the power iteration with deflation. At most PCA_SAMPLES_LIMIT patches (evenly spaced in the
+ * scanline order) are used.
+ */
+void PatchKdTree::calculate_components(FixedImage<float> patch_weighting, const vector<Point> &source_points)
+{
+	int number_of_channels = _source.get_number_of_channels();
+	int dimensions = _patch_size.size_x * _patch_size.size_y * number_of_channels;
+
+	// square roots of the weights repeated for every channel
+	vector<float> weights(dimensions);
+	const float *p_weight = patch_weighting.raw();
+	for (int i = 0; i < dimensions; i++) {
+		weights[i] = sqrt(p_weight[i / number_of_channels]);
+	}
+
+	// collect weighted samples
+	int samples_count = min((int)source_points.size(), PCA_SAMPLES_LIMIT);
+	vector<float> samples(samples_count * dimensions);
+	vector<double> mean(dimensions, 0.0);
+	int radius_x = _patch_size.size_x / 2;
+	int radius_y = _patch_size.size_y / 2;
+	int row_length = _patch_size.size_x * number_of_channels;
+	int stride = _source.get_size_x() * number_of_channels;
+	for (int s = 0; s < samples_count; s++) {
+		Point p = source_points[(long)s * source_points.size() / samples_count];
+		const float *patch = _source.raw() + stride * (p.y - radius_y) + number_of_channels * (p.x - radius_x);
+		float *sample = &samples[s * dimensions];
+		for (int row = 0; row < (int)_patch_size.size_y; row++) {
+			for (int i = 0; i < row_length; i++) {
+				int d = row * row_length + i;
+				sample[d] = weights[d] * patch[stride * row + i];
+				mean[d] += sample[d];
+			}
+		}
+	}
+	for (int d = 0; d < dimensions; d++) {
+		mean[d] /= samples_count;
+	}
+	for (int s = 0; s < samples_count; s++) {
+		for (int d = 0; d < dimensions; d++) {
+			samples[s * dimensions + d] -= mean[d];
+		}
+	}
+
+	// covariance matrix
+	vector<double> covariance(dimensions * dimensions);
+	#pragma omp parallel for schedule(dynamic)
+	for (int a = 0; a < dimensions; a++) {
+		for (int b = a; b < dimensions; b++) {
+			double sum = 0.0;
+			for (int s = 0; s < samples_count; s++) {
+				sum += samples[s * dimensions + a] * samples[s * dimensions + b];
+			}
+			covariance[a * dimensions + b] = sum / samples_count;
+			covariance[b * dimensions + a] = sum / samples_count;
+		}
+	}
+
+	// leading eigenvectors
+	_components.assign(_number_of_components * dimensions, 0.0f);
+	vector<double> vector_a(dimensions);
+	vector<double> vector_b(dimensions);
+	for (int c = 0; c < _number_of_components; c++) {
+		// NOTE: deterministic start, orthogonalized against the previous components in every iteration
+		for (int d = 0; d < dimensions; d++) {
+			vector_a[d] = 1.0 + (double)((d * 7 + c * 13) % 17) / 17.0;
+		}
+
+		double eigenvalue = 0.0;
+		for (int iteration = 0; iteration < POWER_ITERATIONS; iteration++) {
+			for (int prev = 0; prev < c; prev++) {
+				double projection = 0.0;
+				for (int d = 0; d < dimensions; d++) {
+					projection += vector_a[d] * _components[prev * dimensions + d];
+				}
+				for (int d = 0; d < dimensions; d++) {
+					vector_a[d] -= projection * _components[prev * dimensions + d];
+				}
+			}
+
+			for (int a = 0; a < dimensions; a++) {
+				double sum = 0.0;
+				for (int b = 0; b < dimensions; b++) {
+					sum += covariance[a * dimensions + b] * vector_a[b];
+				}
+				vector_b[a] = sum;
+			}
+
+			double norm = 0.0;
+			for (int d = 0; d < dimensions; d++) {
+				norm += vector_b[d] * vector_b[d];
+			}
+			norm = sqrt(norm);
+			if (norm == 0.0) {
+				break;	// NOTE: no variance left, the component stays zero
+			}
+			for (int d = 0; d < dimensions; d++) {
+				vector_a[d] = vector_b[d] / norm;
+			}
+			eigenvalue = norm;
+		}
+
+		if (eigenvalue > 0.0) {
+			for (int d = 0; d < dimensions; d++) {
+				_components[c * dimensions + d] = vector_a[d];
+			}
+		}
+	}
+
+	// fold the weights into the components and the mean into the offsets
+	for (int c = 0; c < _number_of_components; c++) {
+		double offset = 0.0;
+		for (int d = 0; d < dimensions; d++) {
+			offset += _components[c * dimensions + d] * mean[d];
+			_components[c * dimensions + d] *= weights[d];
+		}
+		_offsets[c] = offset;
+	}
+}
+
+
+inline void PatchKdTree::project(FixedImage<float> image, Point point, float *coordinates) const
+{
+	int number_of_channels = image.get_number_of_channels();
+	int dimensions = _patch_size.size_x * _patch_size.size_y * number_of_channels;
+	int row_length = _patch_size.size_x * number_of_channels;
+	int stride = image.get_size_x() * number_of_channels;
+
+	// NOTE: direct access - we sacrifice readability in favor of performance
+	const float *patch = image.raw() + stride * (point.y - _patch_size.size_y / 2) + number_of_channels * (point.x - _patch_size.size_x / 2);
+
+	for (int c = 0; c < _number_of_components; c++) {
+		const float *component = &_components[c * dimensions];
+		float sum = 0.0f;
+		for (int row = 0; row < (int)_patch_size.size_y; row++) {
+			for (int i = 0; i < row_length; i++) {
+				sum += component[row * row_length + i] * patch[stride * row + i];
+			}
+		}
+		coordinates[c] = sum - _offsets[c];
+	}
+}
+
+
+/**
+ * Splits the range [begin, end) of indices by the median along the dimension of the largest spread.
+ * Large subranges are built by separate OpenMP tasks.
+ */
+void PatchKdTree::build(int *order, int begin, int end)
+{
+	if (end - begin <= 1) {
+		return;
+	}
+
+	// dimension of the largest spread
+	float lower[MAX_COMPONENTS];
+	float upper[MAX_COMPONENTS];
+	for (int c = 0; c < _number_of_components; c++) {
+		lower[c] = numeric_limits<float>::max();
+		upper[c] = -numeric_limits<float>::max();
+	}
+	for (int i = begin; i < end; i++) {
+		const float *coordinates = &_coordinates[_number_of_components * order[i]];
+		for (int c = 0; c < _number_of_components; c++) {
+			lower[c] = min(lower[c], coordinates[c]);
+			upper[c] = max(upper[c], coordinates[c]);
+		}
+	}
+	int dimension = 0;
+	for (int c = 1; c < _number_of_components; c++) {
+		if (upper[c] - lower[c] > upper[dimension] - lower[dimension]) {
+			dimension = c;
+		}
+	}
+
+	int middle = (begin + end) / 2;
+	__CoordinateLess less = { &_coordinates[0], _number_of_components, dimension };
+	nth_element(order + begin, order + middle, order + end, less);
+	_split_dimensions[middle] = dimension;
+
+	#pragma omp task if (middle - begin > TASK_SIZE_THRESHOLD)
+	build(order, begin, middle);
+
+	build(order, middle + 1, end);
+
+	#pragma omp taskwait
+}
+
+
+void PatchKdTree::search(const float *query, int begin, int end, int &best, float &best_distance, int &checks) const
+{
+	if (begin >= end || checks <= 0) {
+		return;
+	}
+
+	int middle = (begin + end) / 2;
+	const float *coordinates = &_coordinates[_number_of_components * middle];
+
+	float distance = 0.0f;
+	for (int c = 0; c < _number_of_components; c++) {
+		distance += (query[c] - coordinates[c]) * (query[c] - coordinates[c]);
+	}
+	checks--;
+	if (distance < best_distance) {
+		best_distance = distance;
+		best = middle;
+	}
+
+	int dimension = _split_dimensions[middle];
+	float difference = query[dimension] - coordinates[dimension];
+	if (difference < 0) {
+		search(query, begin, middle, best, best_distance, checks);
+		if (difference * difference < best_distance) {
+			search(query, middle + 1, end, best, best_distance, checks);
+		}
+	} else {
+		search(query, middle + 1, end, best, best_distance, checks);
+		if (difference * difference < best_distance) {
+			search(query, begin, middle, best, best_distance, checks);
+		}
+	}
+}
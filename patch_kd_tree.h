@@ -0,0 +1,73 @@
+/**
+ * Copyright (C) 2015, Vadim Fedorov <vadim.fedorov@upf.edu>
+ * Copyright (C) 2015, Gabriele Facciolo <facciolo@ens-cachan.fr>
+ * Copyright (C) 2015, Pablo Arias <pablo.arias@cmla.ens-cachan.fr>
+ *
+ * This program is free software: you can use, modify and/or
+ * redistribute it under the terms of the simplified BSD
+ * License. You should have received a copy of this license along
+ * this program. If not, see
+ * <http://www.opensource.org/licenses/bsd-license.html>.
+ */
+
+#ifndef PATCH_KD_TREE_H_
+#define PATCH_KD_TREE_H_
+
+#include <vector>
+#include "image.h"
+#include "mask.h"
+#include "point.h"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+using namespace std;
+
+/**
+ * Approximate nearest neighbor search among the source patches: all valid source
+ * patches are projected onto a few principal components (patches are weighted by the
+ * square roots of the patch weights) and stored in a kd-tree. The search stops after
+ * visiting the given number of tree nodes.
+ *
+ * @note The tree depends only on the source image and the source mask, thus it is
+ *       built once and reused while both stay the same (e.g. at one scale).
+ */
+class PatchKdTree
+{
+public:
+	static const int MAX_COMPONENTS = 16;
+
+	PatchKdTree();
+	PatchKdTree(FixedImage<float> source,
+				FixedMask source_mask,
+				FixedImage<float> patch_weighting,
+				int number_of_components = 6);
+
+	bool is_empty() const;
+	FixedImage<float> get_source() const;
+	FixedMask get_source_mask() const;
+
+	/// Finds a source point with the patch similar to the target patch.
+	Point find(FixedImage<float> target, Point target_point, int max_checks = 64) const;
+
+private:
+	FixedImage<float> _source;
+	FixedMask _source_mask;
+	Shape _patch_size;
+	int _number_of_components;
+	// principal components (multiplied by the square roots of the weights) and projections of the mean
+	vector<float> _components;
+	float _offsets[MAX_COMPONENTS];
+	// nodes of the tree: range [begin, end) is split by its middle node
+	vector<Point> _points;
+	vector<float> _coordinates;
+	vector<unsigned char> _split_dimensions;
+
+	void calculate_components(FixedImage<float> patch_weighting, const vector<Point> &source_points);
+	inline void project(FixedImage<float> image, Point point, float *coordinates) const;
+	void build(int *order, int begin, int end);
+	void search(const float *query, int begin, int end, int &best, float &best_distance, int &checks) const;
+};
+
+
+#endif /* PATCH_KD_TREE_H_ */
@@ -11,6 +11,53 @@
  */
 
 #include "patch_match.h"
+#include <algorithm>
+#include "patch_match_engine.h"
+#include "l1_norm_patch_distance.h"
+#include "l2_norm_patch_distance.h"
+#include "l2_combined_patch_distance.h"
+
+PatchMatchCounters::PatchMatchCounters()
+{
+	reset();
+}
+
+
+void PatchMatchCounters::reset()
+{
+	distance_evaluations = 0;
+	pruned_candidates = 0;
+	screened_candidates = 0;
+	duplicate_candidates = 0;
+	memo_lookups = 0;
+	memo_hits = 0;
+	propagations = 0;
+	offset_improvements = 0;
+	improvements = 0;
+	active_points = 0;
+	wasted_shots = 0;
+	max_random_shots = 0;
+	energy = 0.0;
+}
+
+
+void PatchMatchCounters::add(const PatchMatchCounters &other)
+{
+	distance_evaluations += other.distance_evaluations;
+	pruned_candidates += other.pruned_candidates;
+	screened_candidates += other.screened_candidates;
+	duplicate_candidates += other.duplicate_candidates;
+	memo_lookups += other.memo_lookups;
+	memo_hits += other.memo_hits;
+	propagations += other.propagations;
+	offset_improvements += other.offset_improvements;
+	improvements += other.improvements;
+	active_points += other.active_points;
+	wasted_shots += other.wasted_shots;
+	max_random_shots = max(max_random_shots, other.max_random_shots);
+	energy += other.energy;
+}
+
 
 PatchMatch::PatchMatch()
 {
@@ -18,6 +65,21 @@ PatchMatch::PatchMatch()
 	_search_window_size = -1;
 	_random_shots_limit = 20;
 	_distance_calculation = 0;
+	_propagation_scheme = Scanline;
+	_tile_size = 32;
+	_use_active_set = false;
+	_memo_size = 0;
+	_dominant_offsets_count = 0;
+	_target_stride = 1;
+	_use_tree_initialization = false;
+	_context = 0;
+	_seed = 0;
+	_calls_count = 0;
+	_random_key = 0;
+	_collect_metrics = false;
+	_metrics_file = 0;
+	_sweep_start_time = 0.0;
+	_sweeps_count = 0;
 	_max_random_shots_count = 0;
 }
 
@@ -28,6 +90,21 @@ PatchMatch::PatchMatch(APatchDistance *distance_calculation)
 	_search_window_size = -1;
 	_random_shots_limit = 20;
 	_distance_calculation = distance_calculation;
+	_propagation_scheme = Scanline;
+	_tile_size = 32;
+	_use_active_set = false;
+	_memo_size = 0;
+	_dominant_offsets_count = 0;
+	_target_stride = 1;
+	_use_tree_initialization = false;
+	_context = 0;
+	_seed = 0;
+	_calls_count = 0;
+	_random_key = 0;
+	_collect_metrics = false;
+	_metrics_file = 0;
+	_sweep_start_time = 0.0;
+	_sweeps_count = 0;
 	_max_random_shots_count = 0;
 }
 
@@ -38,6 +115,21 @@ PatchMatch::PatchMatch(int iteration_count, int random_shots_limit, int search_w
 	_search_window_size = search_window_size;
 	_random_shots_limit = random_shots_limit;
 	_distance_calculation = 0;
+	_propagation_scheme = Scanline;
+	_tile_size = 32;
+	_use_active_set = false;
+	_memo_size = 0;
+	_dominant_offsets_count = 0;
+	_target_stride = 1;
+	_use_tree_initialization = false;
+	_context = 0;
+	_seed = 0;
+	_calls_count = 0;
+	_random_key = 0;
+	_collect_metrics = false;
+	_metrics_file = 0;
+	_sweep_start_time = 0.0;
+	_sweeps_count = 0;
 	_max_random_shots_count = 0;
 }
 
@@ -51,503 +143,554 @@ PatchMatch::PatchMatch(APatchDistance *distance_calculation,
 	_search_window_size = search_window_size;
 	_random_shots_limit = random_shots_limit;
 	_distance_calculation = distance_calculation;
+	_propagation_scheme = Scanline;
+	_tile_size = 32;
+	_use_active_set = false;
+	_memo_size = 0;
+	_dominant_offsets_count = 0;
+	_target_stride = 1;
+	_use_tree_initialization = false;
+	_context = 0;
+	_seed = 0;
+	_calls_count = 0;
+	_random_key = 0;
+	_collect_metrics = false;
+	_metrics_file = 0;
+	_sweep_start_time = 0.0;
+	_sweeps_count = 0;
 	_max_random_shots_count = 0;
 }
 
-#ifdef _OPENMP
-
 /**
  * Estimates NNF using the given initial nearest neighbors field.
- * Uses OpenMP for parallelization.
  *
- * @param initial_field Initial nearest neighbors field. Null pointer causes random initialization.
+ * @param initial_field Initial nearest neighbors field. Empty image causes random initialization.
+ * @param changed_region Pixels of the source and target images changed since the previous call. It is used only if
+ *        the masks are the same as in the previous call and the initial field is the (unmodified) result of that call:
+ *        then only distances of patches overlapping the changed region are recalculated and only these target points
+ *        (and the points improved later) are visited. Empty mask causes the full recalculation.
+ * @param scale_context Source data prepared for the same distance calculation, images and source mask (see ScaleContext),
+ *        e.g. once per scale of the inpainting. Without it (or if it was prepared for other images) the distance
+ *        calculation is initialized and the source data is built by this call.
  */
 Image<Point> PatchMatch::calculate(FixedImage<float> source,
 									FixedMask source_mask,
 									FixedImage<float> target,
 									FixedMask target_mask,
-									Image<Point> initial_field)
+									Image<Point> initial_field,
+									FixedMask changed_region,
+									const ScaleContext *scale_context)
 {
 	if ((!initial_field.is_empty() && initial_field.get_size() != target.get_size()) ||
+			(!changed_region.is_empty() && changed_region.get_size() != target.get_size()) ||
 			(source.get_size() != source_mask.get_size()) ||
 			(target.get_size() != target_mask.get_size()) ||
 			!_distance_calculation) {
 		return Image<Point>();
 	}
 
-	// Initialize distance calculation
-	_distance_calculation->initialize(source, target);
+	drop_metrics();
 
-	Shape target_shape = target.get_size();
-	Shape source_shape = source.get_size();
+	// Initialize distance calculation and build the source data (the index of valid source points, the tree),
+	// unless they were prepared by the caller
+	// NOTE: the images and the mask are compared by reference, the mask should not be modified between the calls
+	if (scale_context && scale_context->is_prepared_for(_distance_calculation, source, source_mask, target)) {
+		_context = scale_context;
+	} else {
+		bool use_tree = _use_tree_initialization && initial_field.is_empty();
+		_own_context = ScaleContext(_distance_calculation, source, source_mask, target, use_tree);
+		_context = &_own_context;
+	}
 
-	// Allocate memory for nearest neighbors and distances
-	// NOTE: we need two buffers for both distances and neighbors to avoid data access conflicts for adjacent threads.
-	//		 Threads with odd indices work with *_odd buffers, while threads with even indices work with *_even.
-	Image<float> distances_odd(target_shape.size_x, target_shape.size_y, numeric_limits<float>::max());
-	Image<float> distances_even(target_shape.size_x, target_shape.size_y, numeric_limits<float>::max());
-	Image<Point> neighbors_odd(target_shape.size_x, target_shape.size_y, Point(-1, -1));
-	Image<Point> neighbors_even(target_shape.size_x, target_shape.size_y, Point(-1, -1));
+	// Key of the random streams of this call
+	_random_key = RandomGenerator::mix(_seed, _calls_count++);
 
 	// Build masked points cache for speedup
 	vector<Point> target_points = target_mask.get_masked_points();
 
-	// Use given nearest neighbor field (NNF) or initialize NNF at random.
-	if (!initial_field.is_empty() && initial_field.get_size() == target_shape) {
-		// Reinitialize shifts pointing outside the target region and calculate distances
-		for (uint i = 0; i < target_points.size(); i++) {
-			Point p = target_points[i];
-			Point neighbor = initial_field(p);
-
-			int number_of_tries = 0;
-			while (!source_mask.test(neighbor.x, neighbor.y) && number_of_tries < _random_shots_limit) {
-				neighbor.x = rand() % source_shape.size_x;
-				neighbor.y = rand() % source_shape.size_y;
-				number_of_tries++;
-			}
+	// Allocate memory for nearest neighbors and distances of the bounding box of the target region
+	// NOTE: the buffers of the call (and the ones kept for the next call) scale with the target region,
+	//       only the returned NNF has the size of the target image
+	Point top_left = target_mask.bounding_box_top_left();
+	Point bottom_right = target_mask.bounding_box_bottom_right();
+	if (target_points.empty()) {
+		top_left = bottom_right = Point(0, 0);
+	}
+	Shape box_shape(bottom_right.x - top_left.x + 1, bottom_right.y - top_left.y + 1);
+	_target_origin = top_left;
+	_target_size = target.get_size();
+
+	Image<float> distances(box_shape, numeric_limits<float>::max());
+	Image<Point> neighbors(box_shape, Point(-1, -1));
+
+	// Target points and mask relative to the bounding box
+	Mask box_target_mask(box_shape, false);
+	for (uint i = 0; i < target_points.size(); i++) {
+		target_points[i] -= top_left;
+		box_target_mask.mask(target_points[i].x, target_points[i].y);
+	}
 
-			if (source_mask.test(neighbor.x, neighbor.y)) {
-				neighbors_odd(p) = neighbor;
-				neighbors_even(p) = neighbor;
+	if (!can_refresh_field(source_mask, target_mask, target_points, initial_field, changed_region)) {
+		changed_region = FixedMask();
+	}
 
-				float distance = _distance_calculation->calculate(neighbor, p);
-				distances_odd(p) = distance;
-				distances_even(p) = distance;
-			}
-		}
+	// Improve the NNF by the engine specialized on the type of the distance (selected once per call)
+	if (L2CombinedPatchDistance *distance = dynamic_cast<L2CombinedPatchDistance *>(_distance_calculation)) {
+		calculate_field(*distance, source_mask, target, box_target_mask, target_points, initial_field, changed_region, neighbors, distances);
+	} else if (L2NormPatchDistance *distance = dynamic_cast<L2NormPatchDistance *>(_distance_calculation)) {
+		calculate_field(*distance, source_mask, target, box_target_mask, target_points, initial_field, changed_region, neighbors, distances);
+	} else if (L1NormPatchDistance *distance = dynamic_cast<L1NormPatchDistance *>(_distance_calculation)) {
+		calculate_field(*distance, source_mask, target, box_target_mask, target_points, initial_field, changed_region, neighbors, distances);
 	} else {
-		// Initialize shifts at random and calculate distances
-		for (uint i = 0; i < target_points.size(); i++) {
-			Point p = target_points[i];
-			Point neighbor = Point(-1, -1);
-
-			int number_of_tries = 0;
-			while ((neighbor.x < 0 || !source_mask.get(neighbor.x, neighbor.y)) && number_of_tries < _random_shots_limit) {
-				neighbor.x = rand() % source_shape.size_x;
-				neighbor.y = rand() % source_shape.size_y;
-				number_of_tries++;
-			}
-
-			if (source_mask.test(neighbor.x, neighbor.y)) {
-				neighbors_odd(p) = neighbor;
-				neighbors_even(p) = neighbor;
+		calculate_field(*_distance_calculation, source_mask, target, box_target_mask, target_points, initial_field, changed_region, neighbors, distances);
+	}
 
-				float distance = _distance_calculation->calculate(neighbor, p);
-				distances_odd(p) = distance;
-				distances_even(p) = distance;
+	// The search on the quantized images gives approximate distances, the final ones are recalculated in floats
+	// NOTE: these are also the distances reused by the incremental refresh in the next call
+	if (_distance_calculation->get_search_precision() != QuantizedPatches::Float) {
+		#pragma omp parallel for schedule(static)
+		for (int i = 0; i < (int)target_points.size(); i++) {
+			Point p = target_points[i];
+			if (source_mask.test(neighbors(p).x, neighbors(p).y)) {
+				distances(p) = _distance_calculation->calculate_exact(neighbors(p), p + top_left);
 			}
 		}
 	}
 
-	int inpainting_domain_width = target_mask.bounding_box_bottom_right().x - target_mask.bounding_box_top_left().x + 1;
+	// Keep the state for the incremental refresh in the next call
+	_previous_origin = top_left;
+	_previous_neighbors = neighbors;
+	_previous_distances = distances;
+	_previous_source_mask = source_mask;
+	_previous_target_mask = target_mask;
 
-	// Base seed for random number generator
-	uint seed = time(NULL);
+	if (_metrics_file) {
+		write_metrics(_metrics_file, target_points.size());
+	}
 
-	// NOTE: each thread should get the number of target points not less then doubled inpainting domain width.
-	//       In this case we can safely copy data from one buffer to another after each iteration.
-	#pragma omp parallel firstprivate(seed) num_threads( min(omp_get_max_threads(), (int)target_points.size() / (int)(2 * inpainting_domain_width)) )
-	{	// === start of parallel block ===
+	// NNF of the target image
+	Image<Point> field(_target_size, Point(-1, -1));
+	for (uint i = 0; i < target_points.size(); i++) {
+		field(target_points[i] + top_left) = neighbors(target_points[i]);
+	}
 
-		// Get thread-specific data
-#ifdef _OPENMP
-		int thread_id = omp_get_thread_num();
-		int number_of_threads = omp_get_num_threads();
-#else 
-		int thread_id = 0;
-		int number_of_threads = 1;
-#endif
+	return field;
+}
 
-		// Specify seed for each thread
-		seed += thread_id;
-
-		int chunk_size = target_points.size() / number_of_threads;
-
-		// Initialize appropriate shortcuts for buffers
-		Image<Point> *my_neighbors;
-		Image<Point> *other_neighbors;
-		Image<float> *my_distances;
-		Image<float> *other_distances;
-		if ( thread_id % 2 != 0 ) {
-			my_neighbors = &neighbors_odd;
-			other_neighbors = &neighbors_even;
-			my_distances = &distances_odd;
-			other_distances = &distances_even;
-		} else {
-			my_neighbors = &neighbors_even;
-			other_neighbors = &neighbors_odd;
-			my_distances = &distances_even;
-			other_distances = &distances_odd;
-		}
 
-		// In each iteration, improve the NNF, by looping in scanline or reverse-scanline order.
-		for (int iter = 0; iter < _iteration_count; iter++) {
-			// Iterate forward in even iteration and backward in odd ones (indices depend on the thread id)
-			int index_begin, index_end, shift;
-			if ( iter % 2 == 0 ) {
-				index_begin = chunk_size * thread_id;
-				index_end = (thread_id < number_of_threads - 1) ? chunk_size * (thread_id + 1) : target_points.size();
-				shift = -1;
+/**
+ * Initializes (or refreshes) the NNF and improves it by the sweeps of the engine for the type of the distance.
+ *
+ * @param target_mask Target mask of the bounding box of the target region (the target points are relative to it).
+ * @param changed_region Pixels changed since the previous call, if the field is refreshed (empty otherwise).
+ * @param neighbors Nearest neighbors of the bounding box.
+ * @param distances Distances of the bounding box.
+ */
+template <class Distance>
+void PatchMatch::calculate_field(Distance &distance,
+								 FixedMask source_mask,
+								 FixedImage<float> target,
+								 FixedMask target_mask,
+								 const vector<Point> &target_points,
+								 Image<Point> initial_field,
+								 FixedMask changed_region,
+								 Image<Point> &neighbors,
+								 Image<float> &distances)
+{
+	PatchMatchEngine<Distance> engine(*this, distance);
+	Shape box_shape = target_mask.get_size();
+
+	// Sparse target: the sweeps search only the lattice of the target points, the other ones are filled from it
+	vector<Point> lattice_points, filled_points;
+	if (_target_stride > 1) {
+		for (uint i = 0; i < target_points.size(); i++) {
+			Point p = target_points[i] + _target_origin;
+			if (p.x % _target_stride == 0 && p.y % _target_stride == 0) {
+				lattice_points.push_back(target_points[i]);
 			} else {
-				index_begin = (thread_id < number_of_threads - 1) ? chunk_size * (thread_id + 1) - 1 : target_points.size() - 1;
-				index_end = chunk_size * thread_id - 1;
-				shift = 1;
+				filled_points.push_back(target_points[i]);
 			}
-
-			for (int index = index_begin; index != index_end; index -= shift) {
-				int x = target_points[index].x;
-				int y = target_points[index].y;
-
-				float distance = (*my_distances)(x, y);
-				float original_distance = distance;
-				Point neighbor(-1, -1);
-
-				/// Propagation: Improve current guess by trying instead correspondences from left and above (below and right on odd iterations).
-				if (target_mask.test(x + shift, y)) {
-					Point candidate = (*my_neighbors)(x + shift, y);
-					candidate.x -= shift;
-
-					if (source_mask.test(candidate.x, candidate.y)) {
-						// Check for improvement
-						float candidate_distance = _distance_calculation->calculate(candidate, Point(x, y));
-						if (candidate_distance < distance) {
-							distance = candidate_distance;
-							neighbor = candidate;
-						}
-					}
-				}
-
-				if (target_mask.test(x, y + shift)) {
-					Point candidate = (*my_neighbors)(x, y + shift);
-					candidate.y -= shift;
-
-					if (source_mask.test(candidate.x, candidate.y)) {
-						// Check for improvement
-						float candidate_distance = _distance_calculation->calculate(candidate, Point(x, y));
-						if (candidate_distance < distance) {
-							distance = candidate_distance;
-							neighbor = candidate;
-						}
-					}
+		}
+	}
+	bool use_lattice = !lattice_points.empty();
+
+	if (changed_region.is_not_empty()) {
+		// Reuse the previous distances, only points affected by the changes are active in the first sweep
+		vector<Point> refreshed_points;
+		engine.refresh_field(source_mask, changed_region, target_points, neighbors, distances, refreshed_points);
+
+		// NOTE: the lattice point of the cell is activated for a refreshed point off the lattice
+		if (use_lattice) {
+			for (uint i = 0, count = refreshed_points.size(); i < count; i++) {
+				Point p = refreshed_points[i] + _target_origin;
+				Point lattice_point(p.x - p.x % _target_stride, p.y - p.y % _target_stride);
+				lattice_point -= _target_origin;
+				if (refreshed_points[i] != lattice_point && target_mask.test(lattice_point.x, lattice_point.y)) {
+					refreshed_points.push_back(lattice_point);
 				}
+			}
+		}
+		prepare_active_set(box_shape, refreshed_points, true);
+	} else {
+		// Use given nearest neighbor field (NNF) or initialize NNF at random (or by the tree).
+		engine.initialize_field(source_mask, target, target_points, initial_field, neighbors, distances);
 
-				if (neighbor.x < 0) {
-					neighbor = (*my_neighbors)(x, y);
-				}
+		// All target points are active in the first sweep
+		prepare_active_set(box_shape, target_points, false);
+	}
 
-				/// Random search: Improve current guess by searching in boxes of exponentially decreasing size around the current best guess.
-				int max_window_size = (_search_window_size != -1) ? _search_window_size :
-																	std::max(source_shape.size_x, source_shape.size_y);
-
-				Point search_center = neighbor;
-				for (int window_size = max_window_size; window_size >= 1; window_size /= 2) {
-					// Limit sampling window
-					int x_min = max(search_center.x - window_size, 0);
-					int y_min = max(search_center.y - window_size, 0);
-					int x_max = min(search_center.x + window_size + 1, (int)source_shape.size_x);
-					int y_max = min(search_center.y + window_size + 1, (int)source_shape.size_y);
-
-					// Sample
-					Point candidate;
-					for (int k = 0; k < _random_shots_limit; k++)
-					{
-						candidate.x = x_min + rand_r(&seed) % (x_max - x_min);
-						candidate.y = y_min + rand_r(&seed) % (y_max - y_min);
-
-						if (source_mask.test(candidate.x, candidate.y)) {
-							// Check for improvement
-							float candidate_distance = _distance_calculation->calculate(candidate, Point(x, y));
-							if (candidate_distance < distance) {
-								distance = candidate_distance;
-								neighbor = candidate;
-							}
-
-							break;
-						}
-					}	// for (int k = 0; k < _random_shots_limit; k++)
-				}	// for (int window_size = max_window_size; window_size >= 1; window_size /= 2)
-
-				if (original_distance > distance) {
-					(*my_distances)(x, y) = distance;
-					(*my_neighbors)(x, y) = neighbor;
-				}
+	find_dominant_offsets(neighbors, target_points);
 
-			}	// for (ind = ind_begin; ind != ind_end; ind -= shift)
+	// In each iteration, improve the NNF by propagation and random search.
+	_sweep_start_time = get_time();
+	if (use_lattice) {
+		engine.iterate(source_mask, target_mask, lattice_points, neighbors, distances, _target_stride);
+		engine.fill_field(source_mask, target_mask, target_points, filled_points, neighbors, distances);
+	} else {
+		engine.iterate(source_mask, target_mask, target_points, neighbors, distances);
+	}
+}
 
 
-			#pragma omp barrier
+/**
+ * Finds the dominant offsets: the most frequent offsets (neighbor - point) of the initial NNF, which occur
+ * at least twice. The offsets are sorted by their frequencies (and by their values for equal frequencies).
+ */
+void PatchMatch::find_dominant_offsets(FixedImage<Point> neighbors, const vector<Point> &target_points)
+{
+	_dominant_offsets.clear();
+	if (_dominant_offsets_count == 0 || target_points.empty()) {
+		return;
+	}
 
-			// Copy values at the front boundary of the chunk to the second buffer to allow information propagation to the next thread.
-			// NOTE: we do not calculate the precise number of points that have to be copied, instead we copy at most N points,
-			//       where N is the width of the inpainting domain's bounding box. In this way we can be sure that we copy everything that is needed (and maybe a bit more).
-			if (iter < _iteration_count - 1) {
-				int count = 0;
-				for (int index = index_end + shift; (index != index_begin + shift) && (count < inpainting_domain_width); index += shift, count++) {
-					Point p = target_points[index];
-					(*other_distances)(p) = (*my_distances)(p);
-					(*other_neighbors)(p) = (*my_neighbors)(p);
-				}
-			} else {
-				// Synchronize buffers (only neighbors) in the end of the last iteration.
-				for (int ind = index_end + shift; ind != index_begin + shift; ind += shift) {
-					(*other_neighbors)(target_points[ind]) = (*my_neighbors)(target_points[ind]);
-				}
+	// Histogram of the offsets: the sorted offsets (packed into integers) are counted by runs
+	vector<uint64_t> offsets(target_points.size());
+	for (uint i = 0; i < target_points.size(); i++) {
+		Point offset = neighbors(target_points[i]) - (target_points[i] + _target_origin);
+		offsets[i] = ((uint64_t)(uint32_t)offset.x << 32) | (uint64_t)(uint32_t)offset.y;
+	}
+	sort(offsets.begin(), offsets.end());
+
+	// NOTE: pairs of the negated frequency and the offset (the most frequent offsets are the first ones)
+	vector< pair<int, uint64_t> > peaks;
+	uint begin = 0;
+	for (uint i = 1; i <= offsets.size(); i++) {
+		if (i == offsets.size() || offsets[i] != offsets[begin]) {
+			if (i - begin >= 2) {
+				peaks.push_back(make_pair(-(int)(i - begin), offsets[begin]));
 			}
+			begin = i;
+		}
+	}
+
+	int count = min(_dominant_offsets_count, (int)peaks.size());
+	partial_sort(peaks.begin(), peaks.begin() + count, peaks.end());
+	for (int i = 0; i < count; i++) {
+		_dominant_offsets.push_back(Point((int)(uint32_t)(peaks[i].second >> 32), (int)(uint32_t)peaks[i].second));
+	}
+}
 
-			#pragma omp barrier
-		} // for (int i = 0; i < _iteration_count; i++) {
-	} // === end of parallel block ===
 
-	return neighbors_odd;
+/**
+ * Checks if the state of the previous call can be reused: the masks are the same objects and the initial
+ * field has the nearest neighbors found by the previous call.
+ *
+ * @param target_points Target points relative to the bounding box of the target region.
+ */
+bool PatchMatch::can_refresh_field(FixedMask source_mask,
+								   FixedMask target_mask,
+								   const vector<Point> &target_points,
+								   FixedImage<Point> initial_field,
+								   FixedMask changed_region)
+{
+	if (changed_region.is_empty() ||
+			initial_field.is_empty() ||
+			_previous_neighbors.is_empty() ||
+			!(source_mask == _previous_source_mask) ||
+			!(target_mask == _previous_target_mask) ||
+			_target_origin != _previous_origin) {
+		return false;
+	}
+
+	// NOTE: only the kept box is compared, the field is not kept by reference to avoid holding a full-size image
+	for (uint i = 0; i < target_points.size(); i++) {
+		if (initial_field(target_points[i] + _target_origin) != _previous_neighbors(target_points[i])) {
+			return false;
+		}
+	}
+
+	return true;
 }
 
-#else	// undefined _OPENMP
 
 /**
- * Estimates NNF using the given initial nearest neighbors field.
+ * Prepares the active set for the first sweep: with the active set enabled only the points marked in
+ * 'improved_before' (and their propagation neighbors) are visited.
  *
- * @param initial_field Initial nearest neighbors field. Null pointer causes random initialization.
+ * @param active_points Points marked for the first sweep.
+ * @param is_restricted Use the active set even if it is disabled (the incremental refresh).
  */
-Image<Point> PatchMatch::calculate(FixedImage<float> source,
-									FixedMask source_mask,
-									FixedImage<float> target,
-									FixedMask target_mask,
-									Image<Point> initial_field)
+void PatchMatch::prepare_active_set(Shape target_shape, const vector<Point> &active_points, bool is_restricted)
 {
-	if ((!initial_field.is_empty() && initial_field.get_size() != target.get_size()) ||
-			(source.get_size() != source_mask.get_size()) ||
-			(target.get_size() != target_mask.get_size()) ||
-			!_distance_calculation) {
-		return Image<Point>();
+	if (!_use_active_set && !is_restricted) {
+		_improved_before = Image<bool>();
+		_improved_now = Image<bool>();
+		return;
 	}
 
-#ifdef METRICS
-	drop_metrics();
-#endif
+	_improved_before = Image<bool>(target_shape, false);
+	_improved_now = Image<bool>(target_shape, false);
+	for (uint i = 0; i < active_points.size(); i++) {
+		_improved_before(active_points[i]) = true;
+	}
+}
 
-	// Initialize distance calculation
-	_distance_calculation->initialize(source, target);
 
-	// Allocate memory for nearest neighbors and distances
-	Shape target_shape = target.get_size();
-	Shape source_shape = source.get_size();
-	Image<float> distances(target_shape.size_x, target_shape.size_y, numeric_limits<float>::max());
-	Image<Point> neighbors(target_shape.size_x, target_shape.size_y, Point(-1, -1));
+/**
+ * Stores the counters of the sweep (the numbers of active points, improvements and propagations) and the other
+ * sweep metrics (if enabled), and swaps the improvement flags of the active set.
+ *
+ * @param counters Counters of all threads merged.
+ * @return False, if the next sweep would have no active points (i.e. nothing has been improved).
+ */
+bool PatchMatch::finish_sweep(const vector<Point> &target_points, const PatchMatchCounters &counters)
+{
+	// NOTE: the cheap counters of the active set are always kept, the other metrics only if enabled
+	_sweeps_count++;
+	_active_points_per_iteration.push_back(counters.active_points);
+	_improvements_per_iteration.push_back(counters.improvements);
+	_propagations_per_iteration.push_back(counters.propagations);
+
+	if (_collect_metrics) {
+		double time = get_time();
+		_offset_improvements_per_iteration.push_back(counters.offset_improvements);
+		_distance_evaluations_per_iteration.push_back(counters.distance_evaluations);
+		_pruned_candidates_per_iteration.push_back(counters.pruned_candidates);
+		_screened_candidates_per_iteration.push_back(counters.screened_candidates);
+		_duplicate_candidates_per_iteration.push_back(counters.duplicate_candidates);
+		_memo_lookups_per_iteration.push_back(counters.memo_lookups);
+		_memo_hits_per_iteration.push_back(counters.memo_hits);
+		_wasted_shots_per_iteration.push_back(counters.wasted_shots);
+		_time_per_iteration.push_back(time - _sweep_start_time);
+		_total_distance_per_iteration.push_back(counters.energy);
+		_max_random_shots_count = max(_max_random_shots_count, counters.max_random_shots);
+		_sweep_start_time = time;
+	}
 
-	// Build masked points cache for speedup
-	vector<Point> target_points = target_mask.get_masked_points();
+	if (_improved_before.is_empty()) {
+		return true;
+	}
 
-	// Use given nearest neighbor field (NNF) or initialize NNF at random.
-	if (!initial_field.is_empty() && initial_field.get_size() == target_shape) {
-		// Reinitialize shifts pointing outside the target region and calculate distances
-		for (uint i = 0; i < target_points.size(); i++) {
-			Point p = target_points[i];
-			Point neighbor = initial_field(p);
+	// current flags become the previous ones, clear the flags for the next sweep
+	Image<bool> improved = _improved_before;
+	_improved_before = _improved_now;
+	_improved_now = improved;
+	for (uint i = 0; i < target_points.size(); i++) {
+		_improved_now(target_points[i]) = false;
+	}
 
-			int number_of_tries = 0;
-			while (!source_mask.test(neighbor.x, neighbor.y) && number_of_tries < _random_shots_limit) {
-				neighbor.x = rand() % source_shape.size_x;
-				neighbor.y = rand() % source_shape.size_y;
-				number_of_tries++;
-			}
+	return counters.improvements > 0;
+}
 
-			if (source_mask.test(neighbor.x, neighbor.y)) {
-				neighbors(p) = neighbor;
 
-				float distance = _distance_calculation->calculate(neighbor, p);
-				distances(p) = distance;
-			}
-		}
-	} else {
-		// Initialize shifts at random and calculate distances
-		for (uint i = 0; i < target_points.size(); i++) {
-			Point p = target_points[i];
-			Point neighbor = Point(-1, -1);
+/* getters, setters */
+int PatchMatch::get_iteration_count()
+{
+	return _iteration_count;
+}
 
-			int number_of_tries = 0;
-			while ((neighbor.x < 0 || !source_mask.get(neighbor.x, neighbor.y)) && number_of_tries < _random_shots_limit) {
-				neighbor.x = rand() % source_shape.size_x;
-				neighbor.y = rand() % source_shape.size_y;
-				number_of_tries++;
-			}
+void PatchMatch::set_iteration_count(int iteration_count)
+{
+	_iteration_count = iteration_count;
+}
 
-			if (source_mask.test(neighbor.x, neighbor.y)) {
-				neighbors(p) = neighbor;
+int PatchMatch::get_search_window_size()
+{
+	return _search_window_size;
+}
 
-				float distance = _distance_calculation->calculate(neighbor, p);
-				distances(p) = distance;
-			}
-		}
-	}
+void PatchMatch::set_search_window_size(int search_window_size)
+{
+	_search_window_size = search_window_size;
+}
 
-#ifdef METRICS
-	// metrics
-	int metric_max_random_shots_count;
-	int metric_propagations_count;
-	double metric_total_distance;
-#endif
+Image<int> PatchMatch::get_search_windows()
+{
+	return _search_windows;
+}
 
-	// In each iteration, improve the NNF, by looping in scanline or reverse-scanline order.
-	for (int iter = 0; iter < _iteration_count; iter++) {
+/**
+ * Sets the sizes of the first window of the random search for every target point (-1 for the whole source).
+ * The image is used instead of the global search window size by the calls with targets of the same size.
+ * Empty image disables the per point windows.
+ */
+void PatchMatch::set_search_windows(Image<int> search_windows)
+{
+	_search_windows = search_windows;
+}
 
-#ifdef METRICS
-		// Clear metrics
-		metric_propagations_count = 0;
-		metric_max_random_shots_count = 0;
-		metric_total_distance = 0.0;
-#endif
+int PatchMatch::get_target_stride()
+{
+	return _target_stride;
+}
 
-		// Iterate forward in even iteration and backward in odd ones.
-		int index, index_end, shift;
-		if ( iter % 2 == 0 ) {
-			index = 0;
-			index_end = target_points.size();
-			shift = -1;
-		} else {
-			index = target_points.size() - 1;
-			index_end = -1;
-			shift = 1;
-		}
+/**
+ * Sets the stride of the sparse target: only the target points whose coordinates are multiples of the stride
+ * are searched by the sweeps, the other ones take the best offset of the corners of their lattice cell and are
+ * refined by one propagation pass. 1 searches all target points.
+ */
+void PatchMatch::set_target_stride(int target_stride)
+{
+	_target_stride = max(target_stride, 1);
+}
 
-		for (; index != index_end; index -= shift) {
-			int x = target_points[index].x;
-			int y = target_points[index].y;
-
-			float distance = distances(x, y);
-			float original_distance = distance;
-			Point neighbor(-1, -1);
-
-			/// Propagation: Improve current guess by trying instead correspondences from left and above (below and right on odd iterations).
-			if (target_mask.test(x + shift, y)) {
-				Point candidate = neighbors(x + shift, y);
-				candidate.x -= shift;
-
-				if (source_mask.test(candidate.x, candidate.y)) {
-					// Check for improvement
-					float candidate_distance = _distance_calculation->calculate(candidate, Point(x, y));
-					if (candidate_distance < distance) {
-						distance = candidate_distance;
-						neighbor = candidate;
-					}
-				}
-			}
+int PatchMatch::get_random_shots_limit()
+{
+	return _random_shots_limit;
+}
 
-			if (target_mask.test(x, y + shift)) {
-				Point candidate = neighbors(x, y + shift);
-				candidate.y -= shift;
-
-				if (source_mask.test(candidate.x, candidate.y)) {
-					// Check for improvement
-					float candidate_distance = _distance_calculation->calculate(candidate, Point(x, y));
-					if (candidate_distance < distance) {
-						distance = candidate_distance;
-						neighbor = candidate;
-					}
-				}
-			}
+void PatchMatch::set_random_shots_limit(int random_shots_limit)
+{
+	_random_shots_limit = random_shots_limit;
+}
 
-			if (neighbor.x < 0) {
-				neighbor = neighbors(x, y);
-			}
-#ifdef METRICS
-			else {
-				metric_propagations_count++;
-			}
-#endif
+PatchMatch::PropagationScheme PatchMatch::get_propagation_scheme()
+{
+	return _propagation_scheme;
+}
 
-			/// Random search: Improve current guess by searching in boxes of exponentially decreasing size around the current best guess.
-			int max_window_size = (_search_window_size != -1) ? _search_window_size :
-																std::max(source_shape.size_x, source_shape.size_y);
-
-			Point search_center = neighbor;
-			for (int window_size = max_window_size; window_size >= 1; window_size /= 2) {
-				// Limit sampling window
-				int x_min = max(search_center.x - window_size, 0);
-				int y_min = max(search_center.y - window_size, 0);
-				int x_max = min(search_center.x + window_size + 1, (int)source_shape.size_x);
-				int y_max = min(search_center.y + window_size + 1, (int)source_shape.size_y);
-
-				// Sample
-				Point candidate;
-				for (int k = 0; k < _random_shots_limit; k++)
-				{
-					candidate.x = x_min + rand() % (x_max - x_min);
-					candidate.y = y_min + rand() % (y_max - y_min);
-
-					if (source_mask.test(candidate.x, candidate.y)) {
-						// Check for improvement
-						float candidate_distance = _distance_calculation->calculate(candidate, Point(x, y));
-						if (candidate_distance < distance) {
-							distance = candidate_distance;
-							neighbor = candidate;
-						}
-
-#ifdef METRICS
-						if (k > metric_max_random_shots_count) {
-							metric_max_random_shots_count = k;
-						}
-#endif
+void PatchMatch::set_propagation_scheme(PropagationScheme propagation_scheme)
+{
+	_propagation_scheme = propagation_scheme;
+}
 
-						break;
-					}
-				}	// for (int k = 0; k < _random_shots_limit; k++)
-			}	// for (int window_size = max_window_size; window_size >= 1; window_size /= 2)
+int PatchMatch::get_tile_size()
+{
+	return _tile_size;
+}
 
-			if (original_distance > distance) {
-				distances(x, y) = distance;
-				neighbors(x, y) = neighbor;
-			}
+/**
+ * Sets the side of the tiles of the tiled propagation scheme. The sweeps of a lattice of the target points
+ * (see set_target_stride()) use tiles of at least two strides.
+ */
+void PatchMatch::set_tile_size(int tile_size)
+{
+	_tile_size = max(tile_size, 1);
+}
 
-#ifdef METRICS
-			metric_total_distance += min(original_distance, distance);
-#endif
-		}	// for (; ind != ind_end; ind -= shift)
+/**
+ * Specifies whether only the points improved in the previous sweep (and their propagation neighbors)
+ * should be revisited. The calculation returns as soon as a sweep improves nothing.
+ *
+ * @param value True to use the active set.
+ */
+void PatchMatch::use_active_set(bool value)
+{
+	_use_active_set = value;
+}
 
-#ifdef METRICS
-		push_metrics(metric_propagations_count, metric_max_random_shots_count, metric_total_distance);
-#endif
-	}	// for (int iter = 0; iter < _iteration_count; iter++)
+int PatchMatch::get_memo_size()
+{
+	return _memo_size;
+}
 
-	return neighbors;
+/**
+ * Sets the number of entries of the memo of the evaluated candidates kept by every thread during a call
+ * (see CandidateMemo), 0 to disable it. The candidates found in the memo or equal to the current match
+ * are not evaluated again.
+ */
+void PatchMatch::set_memo_size(int memo_size)
+{
+	_memo_size = max(memo_size, 0);
 }
 
-#endif	// #ifdef _OPENMP
+int PatchMatch::get_dominant_offsets_count()
+{
+	return _dominant_offsets_count;
+}
 
+/**
+ * Sets the number of the dominant offsets (the most frequent displacements of the NNF, e.g. of repeated
+ * structures), which are tested by every point after the propagation and before the random search.
+ * 0 disables them. The random search may be limited then (see set_search_window_size()).
+ */
+void PatchMatch::set_dominant_offsets_count(int count)
+{
+	_dominant_offsets_count = min(max(count, 0), 32);
+}
 
-/* getters, setters */
-int PatchMatch::get_iteration_count()
+vector<Point> PatchMatch::get_dominant_offsets()
 {
-	return _iteration_count;
+	return _dominant_offsets;
 }
 
-void PatchMatch::set_iteration_count(int iteration_count)
+/**
+ * Specifies whether the NNF should be initialized by the approximate nearest neighbors found
+ * in a kd-tree of projected source patches (instead of random matches), if no initial field is given.
+ */
+void PatchMatch::use_tree_initialization(bool value)
 {
-	_iteration_count = iteration_count;
+	_use_tree_initialization = value;
 }
 
-int PatchMatch::get_search_window_size()
+
+bool PatchMatch::is_tree_initialization_used()
 {
-	return _search_window_size;
+	return _use_tree_initialization;
 }
 
-void PatchMatch::set_search_window_size(int search_window_size)
+
+unsigned int PatchMatch::get_seed()
 {
-	_search_window_size = search_window_size;
+	return _seed;
 }
 
-int PatchMatch::get_random_shots_limit()
+/**
+ * Sets the seed of the random number generator. For a given seed (and, for the scanline
+ * propagation scheme, a given number of threads) the sequence of calculations is reproducible.
+ */
+void PatchMatch::set_seed(unsigned int seed)
 {
-	return _random_shots_limit;
+	_seed = seed;
+	_calls_count = 0;
 }
 
-void PatchMatch::set_random_shots_limit(int random_shots_limit)
+APatchDistance* PatchMatch::get_distance_calculation()
 {
-	_random_shots_limit = random_shots_limit;
+	return _distance_calculation;
 }
 
+
 void PatchMatch::set_distance_calculation(APatchDistance *distance_calculation)
 {
 	_distance_calculation = distance_calculation;
+
+	// distances of the previous call are not valid anymore
+	_previous_neighbors = Image<Point>();
+	_previous_distances = Image<float>();
+}
+
+
+/**
+ * Specifies whether the metrics of the sweeps (other than the counters of the active set) should be collected.
+ */
+void PatchMatch::collect_metrics(bool value)
+{
+	_collect_metrics = value;
+}
+
+
+/**
+ * Enables the metrics and writes them after every call to the given file (NULL to stop writing):
+ * a header line followed by one line per sweep with tab separated values.
+ */
+void PatchMatch::set_metrics_output(FILE *file)
+{
+	_metrics_file = file;
+	if (file) {
+		_collect_metrics = true;
+		fprintf(file, "call\ttarget_points\tsweep\tactive_points\timprovements\tpropagations\toffset_improvements\tdistance_evaluations\tpruned_candidates\tscreened_candidates\tduplicate_candidates\tmemo_lookups\tmemo_hits\twasted_shots\ttime\tenergy\n");
+	}
 }
 
 
@@ -563,29 +706,141 @@ vector<int> PatchMatch::get_propagations_per_iteration_metric()
 }
 
 
+vector<int> PatchMatch::get_offset_improvements_per_iteration_metric()
+{
+	return _offset_improvements_per_iteration;
+}
+
+
+int PatchMatch::get_sweeps_metric()
+{
+	return _sweeps_count;
+}
+
+
+vector<int> PatchMatch::get_active_points_per_iteration_metric()
+{
+	return _active_points_per_iteration;
+}
+
+
 vector<double> PatchMatch::get_total_distance_per_iteration()
 {
 	return _total_distance_per_iteration;
 }
 
 
+vector<int> PatchMatch::get_improvements_per_iteration_metric()
+{
+	return _improvements_per_iteration;
+}
+
+
+vector<long> PatchMatch::get_distance_evaluations_per_iteration_metric()
+{
+	return _distance_evaluations_per_iteration;
+}
+
+
+vector<long> PatchMatch::get_pruned_candidates_per_iteration_metric()
+{
+	return _pruned_candidates_per_iteration;
+}
+
+
+vector<long> PatchMatch::get_screened_candidates_per_iteration_metric()
+{
+	return _screened_candidates_per_iteration;
+}
+
+
+vector<long> PatchMatch::get_duplicate_candidates_per_iteration_metric()
+{
+	return _duplicate_candidates_per_iteration;
+}
+
+
+vector<long> PatchMatch::get_memo_lookups_per_iteration_metric()
+{
+	return _memo_lookups_per_iteration;
+}
+
+
+vector<long> PatchMatch::get_memo_hits_per_iteration_metric()
+{
+	return _memo_hits_per_iteration;
+}
+
+
+vector<int> PatchMatch::get_wasted_shots_per_iteration_metric()
+{
+	return _wasted_shots_per_iteration;
+}
+
+
+vector<double> PatchMatch::get_time_per_iteration_metric()
+{
+	return _time_per_iteration;
+}
+
+
 /* Private */
 
-#ifdef METRICS
-void PatchMatch::push_metrics(int propagations_count, int max_random_shots_count, double total_distance)
+/**
+ * Returns the wall time (the processor time without OpenMP) in seconds.
+ */
+double PatchMatch::get_time()
 {
-	// store metrics
-	_propagations_per_iteration.push_back(propagations_count);
-	_total_distance_per_iteration.push_back(total_distance);
-	_max_random_shots_count = max(_max_random_shots_count, max_random_shots_count);
+#ifdef _OPENMP
+	return omp_get_wtime();
+#else
+	return (double)clock() / CLOCKS_PER_SEC;
+#endif
 }
 
 
 void PatchMatch::drop_metrics()
 {
 	// drop stored metrics
+	_sweeps_count = 0;
+	_active_points_per_iteration.clear();
+	_improvements_per_iteration.clear();
 	_propagations_per_iteration.clear();
+	_offset_improvements_per_iteration.clear();
+	_distance_evaluations_per_iteration.clear();
+	_pruned_candidates_per_iteration.clear();
+	_screened_candidates_per_iteration.clear();
+	_duplicate_candidates_per_iteration.clear();
+	_memo_lookups_per_iteration.clear();
+	_memo_hits_per_iteration.clear();
+	_wasted_shots_per_iteration.clear();
+	_time_per_iteration.clear();
 	_total_distance_per_iteration.clear();
 	_max_random_shots_count = 0;
 }
-#endif
+
+
+/**
+ * Writes the metrics of the last call, one line per sweep (tab separated values).
+ */
+void PatchMatch::write_metrics(FILE *file, int target_points_count)
+{
+	for (uint i = 0; i < _time_per_iteration.size(); i++) {
+		fprintf(file, "%u\t%d\t%u\t%d\t%d\t%d\t%d\t%ld\t%ld\t%ld\t%ld\t%ld\t%ld\t%d\t%.6f\t%.6f\n",
+				_calls_count, target_points_count, i + 1,
+				_active_points_per_iteration[i],
+				_improvements_per_iteration[i],
+				_propagations_per_iteration[i],
+				_offset_improvements_per_iteration[i],
+				_distance_evaluations_per_iteration[i],
+				_pruned_candidates_per_iteration[i],
+				_screened_candidates_per_iteration[i],
+				_duplicate_candidates_per_iteration[i],
+				_memo_lookups_per_iteration[i],
+				_memo_hits_per_iteration[i],
+				_wasted_shots_per_iteration[i],
+				_time_per_iteration[i],
+				_total_distance_per_iteration[i]);
+	}
+	fflush(file);
+}
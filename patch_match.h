@@ -13,11 +13,9 @@
 #ifndef PATCH_MATCH_H_
 #define PATCH_MATCH_H_
 
-/// NOTE: if METRICS is not defined, metrics will not be collected (but still can be requested, even though
-///		 the value will always remain the same).
-//#define METRICS
-
 #include <stdlib.h>
+#include <stdio.h>
+#include <ctime>
 #include <iostream>
 #include <vector>
 #include <limits>
@@ -25,19 +23,62 @@
 #include "mask.h"
 #include "point.h"
 #include "a_patch_distance.h"
+#include "random_generator.h"
+#include "scale_context.h"
 #ifdef _OPENMP
 #include <omp.h>
 #endif
 
 using namespace std;
 
+/**
+ * Counters of a sweep, collected by every thread and merged in the end of the sweep.
+ */
+struct PatchMatchCounters
+{
+	long distance_evaluations;
+	long pruned_candidates;	// candidates rejected by the lower bounds of the distances (not evaluated)
+	long screened_candidates;	// candidates rejected by the sparse stage of the distances (not evaluated)
+	long duplicate_candidates;	// candidates equal to the current match (not evaluated, if the memo is used)
+	long memo_lookups;		// candidates looked up in the memo of the evaluated candidates
+	long memo_hits;			// candidates found in the memo (not evaluated)
+	int propagations;		// points improved by propagation
+	int offset_improvements;	// points improved by the dominant offsets
+	int improvements;		// points improved by propagation or random search
+	int active_points;		// points visited (in the active set)
+	int wasted_shots;		// random shots outside of the source region
+	int max_random_shots;
+	double energy;			// sum of the distances after the sweep
+
+	PatchMatchCounters();
+	void reset();
+	void add(const PatchMatchCounters &other);
+};
+
+template <class Distance>
+class PatchMatchEngine;
+
 /**
  * Implements Patch-Match algorithm (see "PatchMatch: A Randomized
  * Correspondence Algorithm for Structural Image Editing" by Barnes et al.)
+ *
+ * Keeps the parameters and the state between the calls, the sweeps are made by PatchMatchEngine
+ * specialized on the type of the patch distance, which is selected once per call.
  */
 class PatchMatch
 {
+	// NOTE: the sweeps are made by the engine specialized on the type of the distance (see calculate())
+	template <class Distance>
+	friend class PatchMatchEngine;
+
 public:
+	/// Order in which the target points are visited during the propagation.
+	enum PropagationScheme {
+		Scanline,		// scanline and reverse-scanline sweeps (contiguous chunks of points per thread)
+		Checkerboard,	// red/black sweeps: all points of one colour are updated concurrently
+		Tiles			// scanline sweeps inside square tiles, tiles are handed to threads by a work-stealing queue
+	};
+
 	PatchMatch();
 	PatchMatch(APatchDistance *distance_calculation);
 	PatchMatch(int iteration_count, int random_shots_limit = 20, int search_window_size = -1);
@@ -51,36 +92,140 @@ public:
 						   FixedMask source_mask,
 						   FixedImage<float> target,
 						   FixedMask target_mask,
-						   Image<Point> initial_field = Image<Point>());
+						   Image<Point> initial_field = Image<Point>(),
+						   FixedMask changed_region = FixedMask(),
+						   const ScaleContext *scale_context = 0);
 
 	/// getters and setters for parameters
 	int get_iteration_count();
 	void set_iteration_count(int iteration_count);
 	int get_search_window_size();
 	void set_search_window_size(int search_window_size);
+	Image<int> get_search_windows();
+	void set_search_windows(Image<int> search_windows);
+	int get_target_stride();
+	void set_target_stride(int target_stride);
 	int get_random_shots_limit();
 	void set_random_shots_limit(int random_shots_limit);
+	PropagationScheme get_propagation_scheme();
+	void set_propagation_scheme(PropagationScheme propagation_scheme);
+	int get_tile_size();
+	void set_tile_size(int tile_size);
+	void use_active_set(bool value = true);
+	int get_memo_size();
+	void set_memo_size(int memo_size);
+	int get_dominant_offsets_count();
+	void set_dominant_offsets_count(int count);
+	vector<Point> get_dominant_offsets();	// NOTE: of the last call
+	void use_tree_initialization(bool value = true);
+	bool is_tree_initialization_used();
+	unsigned int get_seed();
+	void set_seed(unsigned int seed);
+	APatchDistance* get_distance_calculation();
 	void set_distance_calculation(APatchDistance *distance_calculation);
 
-	/// metrics
+	/// metrics (of the last call, per sweep; collected only if enabled, except for the numbers of sweeps,
+	/// active points, improvements and propagations)
+	void collect_metrics(bool value = true);
+	void set_metrics_output(FILE *file);
 	int get_max_random_shots_metric();
 	vector<int> get_propagations_per_iteration_metric();
+	vector<int> get_offset_improvements_per_iteration_metric();
 	vector<double> get_total_distance_per_iteration();
+	int get_sweeps_metric();
+	vector<int> get_active_points_per_iteration_metric();
+	vector<int> get_improvements_per_iteration_metric();
+	vector<long> get_distance_evaluations_per_iteration_metric();
+	vector<long> get_pruned_candidates_per_iteration_metric();
+	vector<long> get_screened_candidates_per_iteration_metric();
+	vector<long> get_duplicate_candidates_per_iteration_metric();
+	vector<long> get_memo_lookups_per_iteration_metric();
+	vector<long> get_memo_hits_per_iteration_metric();
+	vector<int> get_wasted_shots_per_iteration_metric();
+	vector<double> get_time_per_iteration_metric();
 
 private:
 	APatchDistance *_distance_calculation;
 	int _iteration_count;
 	int _search_window_size;
+	// per target point sizes of the search window (empty to use the global one)
+	Image<int> _search_windows;
+	// stride of the lattice of the searched target points, the others are filled from it (1 to search all of them)
+	int _target_stride;
 	int _random_shots_limit;
+	PropagationScheme _propagation_scheme;
+	int _tile_size;
+	bool _use_active_set;
+	// entries of the per-thread memo of the evaluated candidates (0 to disable)
+	int _memo_size;
+	// the most frequent offsets of the NNF tested by every point before the random search (0 to disable)
+	int _dominant_offsets_count;
+	vector<Point> _dominant_offsets;
+	// initialization by the approximate nearest neighbors (the tree of the source patches)
+	bool _use_tree_initialization;
+	// source data of the call: the given scale context or the own one (prepared by the call)
+	const ScaleContext *_context;
+	ScaleContext _own_context;
+	// random numbers
+	unsigned int _seed;
+	unsigned int _calls_count;
+	uint64_t _random_key;
+	// target of the call: the origin of the bounding box of the target region (the buffers cover only the box)
+	Point _target_origin;
+	Shape _target_size;
+	// state of the previous call (for the incremental refresh): the buffers of the bounding box of its target region
+	Point _previous_origin;
+	Image<Point> _previous_neighbors;
+	Image<float> _previous_distances;
+	FixedMask _previous_source_mask;
+	FixedMask _previous_target_mask;
+	// active set (improvement flags of the previous and the current sweeps)
+	Image<bool> _improved_before;
+	Image<bool> _improved_now;
 	// metrics
+	bool _collect_metrics;
+	FILE *_metrics_file;
+	double _sweep_start_time;
 	vector<int> _propagations_per_iteration;
+	vector<int> _offset_improvements_per_iteration;
 	vector<double> _total_distance_per_iteration;
 	int _max_random_shots_count;
+	int _sweeps_count;
+	vector<int> _active_points_per_iteration;
+	vector<int> _improvements_per_iteration;
+	vector<long> _distance_evaluations_per_iteration;
+	vector<long> _pruned_candidates_per_iteration;
+	vector<long> _screened_candidates_per_iteration;
+	vector<long> _duplicate_candidates_per_iteration;
+	vector<long> _memo_lookups_per_iteration;
+	vector<long> _memo_hits_per_iteration;
+	vector<int> _wasted_shots_per_iteration;
+	vector<double> _time_per_iteration;
+
+	template <class Distance>
+	void calculate_field(Distance &distance,
+						 FixedMask source_mask,
+						 FixedImage<float> target,
+						 FixedMask target_mask,
+						 const vector<Point> &target_points,
+						 Image<Point> initial_field,
+						 FixedMask changed_region,
+						 Image<Point> &neighbors,
+						 Image<float> &distances);
 
-#ifdef METRICS
-	void push_metrics(int propagations_count, int max_random_shots_count, double total_distance);
+	void find_dominant_offsets(FixedImage<Point> neighbors, const vector<Point> &target_points);
+
+	bool can_refresh_field(FixedMask source_mask,
+						   FixedMask target_mask,
+						   const vector<Point> &target_points,
+						   FixedImage<Point> initial_field,
+						   FixedMask changed_region);
+
+	void prepare_active_set(Shape target_shape, const vector<Point> &active_points, bool is_restricted);
+	bool finish_sweep(const vector<Point> &target_points, const PatchMatchCounters &counters);
+	static double get_time();
 	void drop_metrics();
-#endif
+	void write_metrics(FILE *file, int target_points_count);
 };
 
 #endif /* PATCH_MATCH_H_ */
@@ -0,0 +1,192 @@
+/**
+ * Copyright (C) 2015, Vadim Fedorov <vadim.fedorov@upf.edu>
+ * Copyright (C) 2015, Gabriele Facciolo <facciolo@ens-cachan.fr>
+ * Copyright (C) 2015, Pablo Arias <pablo.arias@cmla.ens-cachan.fr>
+ *
+ * This program is free software: you can use, modify and/or
+ * redistribute it under the terms of the simplified BSD
+ * License. You should have received a copy of this license along
+ * this program. If not, see
+ * <http://www.opensource.org/licenses/bsd-license.html>.
+ */
+
+#ifndef PATCH_MATCH_ENGINE_H_
+#define PATCH_MATCH_ENGINE_H_
+
+#include <vector>
+#include "image.h"
+#include "mask.h"
+#include "point.h"
+#include "a_patch_distance.h"
+#include "candidate_memo.h"
+#include "patch_match.h"
+#include "random_generator.h"
+#include "scale_context.h"
+#include "work_stealing_queue.h"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+using namespace std;
+
+/**
+ * Sweeps of PatchMatch specialized on the type of the patch distance: the distances of the candidates are
+ * calculated by calls resolved at compile time (no virtual dispatch per candidate). Made by PatchMatch for
+ * a single call of PatchMatch::calculate(), which selects the type once; the parameters and the state
+ * (e.g. the active set, the metrics) are kept by PatchMatch.
+ *
+ * @note Distance may be APatchDistance itself (any other distance), then the calls are virtual.
+ */
+template <class Distance>
+class PatchMatchEngine
+{
+public:
+	PatchMatchEngine(PatchMatch &patch_match, Distance &distance);
+
+	void initialize_field(FixedMask source_mask,
+						  FixedImage<float> target,
+						  const vector<Point> &target_points,
+						  FixedImage<Point> initial_field,
+						  Image<Point> &neighbors,
+						  Image<float> &distances);
+
+	void refresh_field(FixedMask source_mask,
+					   FixedMask changed_region,
+					   const vector<Point> &target_points,
+					   Image<Point> &neighbors,
+					   Image<float> &distances,
+					   vector<Point> &refreshed_points);
+
+	// Improves the NNF by the sweeps of the propagation scheme of PatchMatch.
+	void iterate(FixedMask source_mask,
+				 FixedMask target_mask,
+				 const vector<Point> &target_points,
+				 Image<Point> &neighbors,
+				 Image<float> &distances,
+				 int step = 1);
+
+	// Fills the target points off the lattice searched by iterate() from its points and refines them by one propagation pass.
+	void fill_field(FixedMask source_mask,
+					FixedMask target_mask,
+					const vector<Point> &target_points,
+					const vector<Point> &filled_points,
+					Image<Point> &neighbors,
+					Image<float> &distances);
+
+private:
+	PatchMatch &_patch_match;
+	Distance &_distance;
+	const ScaleContext *_context;
+	const SourceIndex &_source_index;
+	// parameters of the call (copied from PatchMatch)
+	int _iteration_count;
+	int _search_window_size;
+	FixedImage<int> _search_windows;	// empty, if the global size is used
+	// the buffers cover the bounding box of the target region: the points are relative to its origin
+	Point _origin;
+	Shape _target_size;
+	int _random_shots_limit;
+	int _tile_size;
+	int _step;	// distance of the propagation neighbors (the stride of the lattice of the searched target points)
+	PatchMatch::PropagationScheme _propagation_scheme;
+	bool _use_tree_initialization;
+	bool _use_moment_bounds;	// the distance has the lower bounds (for the float images)
+	bool _use_sparse_stage;		// the distance has the sparse stage
+	int _memo_size;
+	// memo of the evaluated candidates per thread (kept during the call, empty if disabled)
+	vector<CandidateMemo> _memos;
+	uint64_t _random_key;
+
+	// Neighbors around the chunk of target points of a thread of the scanline scheme, copied after every sweep.
+	// The points are identified by their keys y * width + x in the bounding box.
+	struct Halo
+	{
+		int width;
+		int begin_key;			// key of the first point of the chunk
+		int end_key;			// key of the last point of the chunk
+		vector<Point> before;	// neighbors of the keys [begin_key - before.size(), begin_key)
+		vector<Point> after;	// neighbors of the keys (end_key, end_key + after.size()]
+	};
+
+	void iterate_scanline(FixedMask source_mask,
+						  FixedMask target_mask,
+						  const vector<Point> &target_points,
+						  Image<Point> &neighbors,
+						  Image<float> &distances);
+
+	void iterate_checkerboard(FixedMask source_mask,
+							  FixedMask target_mask,
+							  const vector<Point> &target_points,
+							  Image<Point> &neighbors,
+							  Image<float> &distances);
+
+	void iterate_tiles(FixedMask source_mask,
+					   FixedMask target_mask,
+					   const vector<Point> &target_points,
+					   Image<Point> &neighbors,
+					   Image<float> &distances);
+
+	void fill_halo(const Image<Point> &neighbors, Halo &halo) const;
+
+	inline bool is_active(int x, int y) const;
+
+	inline void visit_point(int x, int y, int shift, int iteration,
+							const FixedMask &source_mask,
+							const FixedMask &target_mask,
+							Image<Point> &neighbors,
+							Image<float> &distances,
+							PatchMatchCounters &counters,
+							const Halo *halo = 0);
+
+	inline const Point &get_neighbor(const Image<Point> &neighbors, const Halo *halo, int x, int y) const;
+
+	inline uint64_t get_stream(const Point &point) const;
+	inline CandidateMemo *get_memo();
+	inline int recall(const CandidateMemo &memo,
+					  Point *candidates,
+					  int count,
+					  const Point &target_point,
+					  const Point &match,
+					  float &distance,
+					  Point &neighbor,
+					  PatchMatchCounters &counters) const;
+	inline int prune(Point *candidates, int count, const Point &target_point, float distance, PatchMatchCounters &counters) const;
+	inline int screen(Point *candidates, int count, const Point &target_point, float distance, PatchMatchCounters &counters) const;
+
+	inline void evaluate(Point *candidates,
+						 int count,
+						 const Point &target_point,
+						 const Point &match,
+						 float &distance,
+						 Point &neighbor,
+						 PatchMatchCounters &counters);
+
+	inline bool fill_point(int x, int y,
+						   Point *candidates,
+						   int count,
+						   Image<Point> &neighbors,
+						   Image<float> &distances,
+						   PatchMatchCounters &counters);
+
+	inline bool improve_point(int x, int y, int shift,
+							  const FixedMask &source_mask,
+							  const FixedMask &target_mask,
+							  Image<Point> &neighbors,
+							  Image<float> &distances,
+							  RandomGenerator &random,
+							  PatchMatchCounters &counters,
+							  const Halo *halo);
+
+	inline float calculate(const Point &source_point, const Point &target_point);
+
+	inline void calculate(const Point *source_points,
+						  int count,
+						  const Point &target_point,
+						  float bound,
+						  float *distances);
+};
+
+// NOTE: include implementation, because PatchMatchEngine is a template
+#include "patch_match_engine.hpp"
+
+#endif /* PATCH_MATCH_ENGINE_H_ */
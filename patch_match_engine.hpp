@@ -0,0 +1,1107 @@
+/**
+ * Copyright (C) 2015, Vadim Fedorov <vadim.fedorov@upf.edu>
+ * Copyright (C) 2015, Gabriele Facciolo <facciolo@ens-cachan.fr>
+ * Copyright (C) 2015, Pablo Arias <pablo.arias@cmla.ens-cachan.fr>
+ *
+ * This program is free software: you can use, modify and/or
+ * redistribute it under the terms of the simplified BSD
+ * License. You should have received a copy of this license along
+ * this program. If not, see
+ * <http://www.opensource.org/licenses/bsd-license.html>.
+ */
+
+template <class Distance>
+PatchMatchEngine<Distance>::PatchMatchEngine(PatchMatch &patch_match, Distance &distance)
+	: _patch_match(patch_match),
+	  _distance(distance),
+	  _context(patch_match._context),
+	  _source_index(patch_match._context->get_source_index())
+{
+	_iteration_count = patch_match._iteration_count;
+	_search_window_size = patch_match._search_window_size;
+	_search_windows = patch_match._search_windows;
+	_origin = patch_match._target_origin;
+	_target_size = patch_match._target_size;
+	_step = 1;
+	_random_shots_limit = patch_match._random_shots_limit;
+	_tile_size = patch_match._tile_size;
+	_propagation_scheme = patch_match._propagation_scheme;
+	_use_tree_initialization = patch_match._use_tree_initialization;
+	_random_key = patch_match._random_key;
+	_use_moment_bounds = distance.has_moment_bounds();
+	_use_sparse_stage = distance.has_sparse_stage();
+	_memo_size = patch_match._memo_size;
+}
+
+
+/**
+ * Calculates the distance by the method of the concrete type (the call is not virtual).
+ */
+template <class Distance>
+inline float PatchMatchEngine<Distance>::calculate(const Point &source_point, const Point &target_point)
+{
+	return _distance.Distance::calculate(source_point, target_point);
+}
+
+
+/**
+ * Calculates the distances of the batch by the method of the concrete type (the call is not virtual).
+ */
+template <class Distance>
+inline void PatchMatchEngine<Distance>::calculate(const Point *source_points,
+												  int count,
+												  const Point &target_point,
+												  float bound,
+												  float *distances)
+{
+	_distance.Distance::calculate(source_points, count, target_point, bound, distances);
+}
+
+
+/**
+ * Any other distance: the calls are virtual.
+ */
+template <>
+inline float PatchMatchEngine<APatchDistance>::calculate(const Point &source_point, const Point &target_point)
+{
+	return _distance.calculate(source_point, target_point);
+}
+
+
+template <>
+inline void PatchMatchEngine<APatchDistance>::calculate(const Point *source_points,
+														int count,
+														const Point &target_point,
+														float bound,
+														float *distances)
+{
+	_distance.calculate(source_points, count, target_point, bound, distances);
+}
+
+
+/**
+ * Copies the initial nearest neighbors field (reinitializing shifts pointing outside the source region)
+ * or initializes it at random, and calculates the corresponding distances.
+ *
+ * @param initial_field Initial nearest neighbors field. Empty image causes random initialization
+ *        or, if the tree initialization is used, the approximate nearest neighbors.
+ */
+template <class Distance>
+void PatchMatchEngine<Distance>::initialize_field(FixedMask source_mask,
+												  FixedImage<float> target,
+												  const vector<Point> &target_points,
+												  FixedImage<Point> initial_field,
+												  Image<Point> &neighbors,
+												  Image<float> &distances)
+{
+	Shape source_shape = source_mask.get_size();
+	bool use_initial_field = !initial_field.is_empty();
+	const PatchKdTree &kd_tree = _context->get_kd_tree();
+	bool use_tree = !use_initial_field && _use_tree_initialization && !kd_tree.is_empty();
+	int source_count = _source_index.count(0, 0, source_shape.size_x, source_shape.size_y);
+
+	#pragma omp parallel for schedule(static)
+	for (int i = 0; i < (int)target_points.size(); i++) {
+		Point p = target_points[i];
+		Point target_point = p + _origin;
+		Point neighbor = use_initial_field ? initial_field(target_point) : Point(-1, -1);
+		if (use_tree) {
+			neighbor = kd_tree.find(target, target_point);
+		}
+
+		// NOTE: the initialization uses its own stream (the iteration index is never reached by the sweeps)
+		RandomGenerator random(_random_key, (0xFFFFFFFFULL << 32) | get_stream(p));
+
+		// NOTE: the whole source region is sampled, thus the point is drawn from the index directly
+		if (!source_mask.test(neighbor.x, neighbor.y) && source_count > 0) {
+			neighbor = _source_index.sample(0, 0, source_shape.size_x, source_shape.size_y, random.uniform(source_count));
+		}
+
+		if (source_mask.test(neighbor.x, neighbor.y)) {
+			neighbors(p) = neighbor;
+			distances(p) = calculate(neighbor, target_point);
+		}
+	}
+}
+
+
+/**
+ * Copies the nearest neighbors field and the distances of the previous call. Distances are recalculated only for
+ * target points whose patch or whose nearest neighbor's patch overlaps the changed region, and for target points
+ * whose nearest neighbor is outside the source region (it is drawn again, as by initialize_field()).
+ *
+ * @note The distances of the previous call are exact. They are reused only if the search is in floats, otherwise
+ *       all distances are recalculated on the quantized images of this call (which are quantized by the ranges of
+ *       the changed images), thus the sweeps compare the distances of a single precision.
+ *
+ * @param changed_region Pixels changed since the previous call.
+ * @param refreshed_points Target points with recalculated distances.
+ */
+template <class Distance>
+void PatchMatchEngine<Distance>::refresh_field(FixedMask source_mask,
+											   FixedMask changed_region,
+											   const vector<Point> &target_points,
+											   Image<Point> &neighbors,
+											   Image<float> &distances,
+											   vector<Point> &refreshed_points)
+{
+	Shape shape = changed_region.get_size();
+	Shape source_shape = source_mask.get_size();
+	Shape patch_size = _distance.get_patch_size();
+	int source_count = _source_index.count(0, 0, source_shape.size_x, source_shape.size_y);
+	bool use_previous_distances = _distance.get_search_precision() == QuantizedPatches::Float;
+
+	// Mark centers of the patches overlapping the changed region.
+	// NOTE: one more pixel is added to the patch radius, since the features computed by forward differences
+	//       (e.g. gradients of the combined distance) change in the pixels adjacent to the changed ones.
+	//       The marks are kept for the bounding box of the changed region extended by the radius only.
+	int radius_x = patch_size.size_x / 2 + 1;
+	int radius_y = patch_size.size_y / 2 + 1;
+	Point top_left = changed_region.bounding_box_top_left();
+	Point bottom_right = changed_region.bounding_box_bottom_right();
+	Point affected_origin(max(0, top_left.x - radius_x), max(0, top_left.y - radius_y));
+	Mask affected(max(0, min((int)shape.size_x - 1, bottom_right.x + radius_x) - affected_origin.x + 1),
+				  max(0, min((int)shape.size_y - 1, bottom_right.y + radius_y) - affected_origin.y + 1),
+				  false);
+	FixedMask::iterator it;
+	for (it = changed_region.begin(); it != changed_region.end(); ++it) {
+		int x_begin = max(0, (*it).x - radius_x) - affected_origin.x;
+		int x_end = min((int)shape.size_x - 1, (*it).x + radius_x) - affected_origin.x;
+		int y_begin = max(0, (*it).y - radius_y) - affected_origin.y;
+		int y_end = min((int)shape.size_y - 1, (*it).y + radius_y) - affected_origin.y;
+		for (int y = y_begin; y <= y_end; y++) {
+			for (int x = x_begin; x <= x_end; x++) {
+				affected.mask(x, y);
+			}
+		}
+	}
+
+	for (uint i = 0; i < target_points.size(); i++) {
+		Point p = target_points[i];
+		Point target_point = p + _origin;
+		Point neighbor = _patch_match._previous_neighbors(p);
+		bool is_valid = source_mask.test(neighbor.x, neighbor.y);
+
+		// NOTE: the same stream as of the initialization (the iteration index is never reached by the sweeps)
+		if (!is_valid && source_count > 0) {
+			RandomGenerator random(_random_key, (0xFFFFFFFFULL << 32) | get_stream(p));
+			neighbor = _source_index.sample(0, 0, source_shape.size_x, source_shape.size_y, random.uniform(source_count));
+		}
+
+		neighbors(p) = neighbor;
+		distances(p) = is_valid ? _patch_match._previous_distances(p) : numeric_limits<float>::max();
+
+		Point affected_point = target_point - affected_origin;
+		Point affected_neighbor = neighbor - affected_origin;
+		if (!is_valid || affected.test(affected_point.x, affected_point.y) || affected.test(affected_neighbor.x, affected_neighbor.y)) {
+			refreshed_points.push_back(p);
+		}
+	}
+
+	const vector<Point> &calculated_points = use_previous_distances ? refreshed_points : target_points;
+
+	#pragma omp parallel for schedule(static)
+	for (int i = 0; i < (int)calculated_points.size(); i++) {
+		Point p = calculated_points[i];
+		if (source_mask.test(neighbors(p).x, neighbors(p).y)) {
+			distances(p) = calculate(neighbors(p), p + _origin);
+		}
+	}
+}
+
+
+
+/**
+ * Improves the NNF by the sweeps in the order given by the propagation scheme.
+ *
+ * @param step Stride of the lattice of the target points (1 if all target points are searched).
+ */
+template <class Distance>
+void PatchMatchEngine<Distance>::iterate(FixedMask source_mask,
+										 FixedMask target_mask,
+										 const vector<Point> &target_points,
+										 Image<Point> &neighbors,
+										 Image<float> &distances,
+										 int step)
+{
+	_step = step;
+
+	// NOTE: the per point windows are given for the targets of some scale, they are ignored at the other scales
+	if (!_search_windows.is_empty() && _search_windows.get_size() != _target_size) {
+		_search_windows = FixedImage<int>();
+	}
+
+	// NOTE: the memos are kept during the call (the images are not modified between the sweeps)
+	if (_memo_size > 0) {
+#ifdef _OPENMP
+		_memos.assign(omp_get_max_threads(), CandidateMemo(_memo_size));
+#else
+		_memos.assign(1, CandidateMemo(_memo_size));
+#endif
+	}
+
+	if (_propagation_scheme == PatchMatch::Checkerboard) {
+		iterate_checkerboard(source_mask, target_mask, target_points, neighbors, distances);
+	} else if (_propagation_scheme == PatchMatch::Tiles) {
+		iterate_tiles(source_mask, target_mask, target_points, neighbors, distances);
+	} else {
+		iterate_scanline(source_mask, target_mask, target_points, neighbors, distances);
+	}
+}
+
+
+/**
+ * Fills the target points off the lattice searched by iterate(): every point takes the best of its current
+ * neighbor and the offsets of the lattice points at the corners of its cell, then one propagation pass tries
+ * the offsets of its four adjacent points. The pass is red/black (as the checkerboard scheme), thus the points
+ * of one colour are filled concurrently. It is reported as one more sweep.
+ *
+ * @param target_points All target points (for the energy of the sweep).
+ * @param filled_points Target points off the lattice.
+ */
+template <class Distance>
+void PatchMatchEngine<Distance>::fill_field(FixedMask source_mask,
+											FixedMask target_mask,
+											const vector<Point> &target_points,
+											const vector<Point> &filled_points,
+											Image<Point> &neighbors,
+											Image<float> &distances)
+{
+	// Split filled points by colour
+	vector<Point> coloured_points[2];
+	for (uint i = 0; i < filled_points.size(); i++) {
+		Point p = filled_points[i] + _origin;
+		coloured_points[(p.x + p.y) % 2].push_back(filled_points[i]);
+	}
+
+	// Sweep counters shared by the team
+	PatchMatchCounters counters;
+
+	#pragma omp parallel
+	{	// === start of parallel block ===
+
+		PatchMatchCounters my_counters;
+
+		/// Interpolation: Take the offsets of the lattice points at the corners of the cell.
+		// NOTE: only the lattice points are read, they are not modified by the loop
+		#pragma omp for schedule(static)
+		for (int index = 0; index < (int)filled_points.size(); index++) {
+			int x = filled_points[index].x;
+			int y = filled_points[index].y;
+
+			// NOTE: the lattice is aligned to the target image
+			Point target_point = filled_points[index] + _origin;
+			Point corner(target_point.x - target_point.x % _step - _origin.x, target_point.y - target_point.y % _step - _origin.y);
+
+			Point candidates[4];
+			int candidates_count = 0;
+			for (int k = 0; k < 4; k++) {
+				Point lattice_point(corner.x + (k % 2) * _step, corner.y + (k / 2) * _step);
+				if (!target_mask.test(lattice_point.x, lattice_point.y)) {
+					continue;
+				}
+
+				Point candidate = neighbors(lattice_point) - lattice_point + Point(x, y);
+				if (source_mask.test(candidate.x, candidate.y)) {
+					candidates[candidates_count++] = candidate;
+				}
+			}
+
+			my_counters.active_points++;
+			fill_point(x, y, candidates, candidates_count, neighbors, distances, my_counters);
+		}
+
+		/// Propagation: Try the offsets of the adjacent points (lattice points or filled points of the other colour).
+		for (int colour = 0; colour < 2; colour++) {
+			const vector<Point> &points = coloured_points[colour];
+
+			// NOTE: implicit barrier at the end of the loop separates the colours
+			#pragma omp for schedule(static)
+			for (int index = 0; index < (int)points.size(); index++) {
+				int x = points[index].x;
+				int y = points[index].y;
+
+				Point candidates[4];
+				int candidates_count = 0;
+				for (int k = 0; k < 4; k++) {
+					Point adjacent_point(x + (k == 0) - (k == 1), y + (k == 2) - (k == 3));
+					if (!target_mask.test(adjacent_point.x, adjacent_point.y)) {
+						continue;
+					}
+
+					Point candidate = neighbors(adjacent_point) - adjacent_point + Point(x, y);
+					if (source_mask.test(candidate.x, candidate.y)) {
+						candidates[candidates_count++] = candidate;
+					}
+				}
+
+				if (fill_point(x, y, candidates, candidates_count, neighbors, distances, my_counters)) {
+					my_counters.propagations++;
+				}
+			}
+		}
+
+		#pragma omp for schedule(static)
+		for (int index = 0; index < (int)target_points.size(); index++) {
+			my_counters.energy += distances(target_points[index]);
+		}
+
+		#pragma omp critical
+		counters.add(my_counters);
+	} // === end of parallel block ===
+
+	_patch_match.finish_sweep(target_points, counters);
+}
+
+
+/* Private */
+
+#ifdef _OPENMP
+
+/**
+ * Improves the NNF by sweeps in scanline or reverse-scanline order.
+ * Uses OpenMP for parallelization: every thread sweeps its own contiguous chunk of target points.
+ */
+template <class Distance>
+void PatchMatchEngine<Distance>::iterate_scanline(FixedMask source_mask,
+												  FixedMask target_mask,
+												  const vector<Point> &target_points,
+												  Image<Point> &neighbors,
+												  Image<float> &distances)
+{
+	if (target_points.empty()) {
+		return;
+	}
+
+	// NOTE: threads write only the points of their own chunks to the buffers. The propagation neighbors outside the chunk
+	//       (at most _step rows of the bounding box away from it) are read from the halo of the thread instead, which
+	//       is copied from the buffer between the sweeps. Thus adjacent threads see the values of each other from the previous sweep.
+	int inpainting_domain_width = target_mask.get_size().size_x;
+	int halo_size = inpainting_domain_width * _step;
+
+	// Sweep counters shared by the team
+	PatchMatchCounters counters;
+	bool is_finished = false;
+
+	// NOTE: each thread should get the number of target points not less then doubled inpainting domain width,
+	//       otherwise the halos are comparable to the chunks.
+	int max_threads = max(1, min(omp_get_max_threads(), (int)target_points.size() / (int)(2 * inpainting_domain_width)));
+
+	#pragma omp parallel num_threads(max_threads)
+	{	// === start of parallel block ===
+
+		// Get thread-specific data
+		int thread_id = omp_get_thread_num();
+		int number_of_threads = omp_get_num_threads();
+
+		int chunk_size = target_points.size() / number_of_threads;
+		int chunk_begin = chunk_size * thread_id;
+		int chunk_end = (thread_id < number_of_threads - 1) ? chunk_size * (thread_id + 1) : target_points.size();
+
+		Halo halo;
+		halo.width = inpainting_domain_width;
+		halo.begin_key = target_points[chunk_begin].y * halo.width + target_points[chunk_begin].x;
+		halo.end_key = target_points[chunk_end - 1].y * halo.width + target_points[chunk_end - 1].x;
+		halo.before.resize(halo_size);
+		halo.after.resize(halo_size);
+		fill_halo(neighbors, halo);
+
+		#pragma omp barrier
+
+		// In each iteration, improve the NNF, by looping in scanline or reverse-scanline order.
+		for (int iter = 0; iter < _iteration_count; iter++) {
+			// Iterate forward in even iteration and backward in odd ones
+			int index_begin, index_end, shift;
+			if ( iter % 2 == 0 ) {
+				index_begin = chunk_begin;
+				index_end = chunk_end;
+				shift = -1;
+			} else {
+				index_begin = chunk_end - 1;
+				index_end = chunk_begin - 1;
+				shift = 1;
+			}
+
+			PatchMatchCounters my_counters;
+			for (int index = index_begin; index != index_end; index -= shift) {
+				visit_point(target_points[index].x, target_points[index].y, shift, iter,
+							source_mask, target_mask, neighbors, distances,
+							my_counters, &halo);
+			}
+
+			#pragma omp critical
+			counters.add(my_counters);
+
+			#pragma omp barrier
+
+			// NOTE: implicit barrier at the end of the single construct
+			#pragma omp single
+			{
+				is_finished = !_patch_match.finish_sweep(target_points, counters) || iter == _iteration_count - 1;
+				counters.reset();
+			}
+
+			if (is_finished) {
+				break;
+			}
+
+			// Exchange the halos: the buffers are not written until all threads have copied them
+			fill_halo(neighbors, halo);
+
+			#pragma omp barrier
+		} // for (int i = 0; i < _iteration_count; i++) {
+	} // === end of parallel block ===
+}
+
+#else	// undefined _OPENMP
+
+/**
+ * Improves the NNF by sweeps in scanline or reverse-scanline order.
+ */
+template <class Distance>
+void PatchMatchEngine<Distance>::iterate_scanline(FixedMask source_mask,
+												  FixedMask target_mask,
+												  const vector<Point> &target_points,
+												  Image<Point> &neighbors,
+												  Image<float> &distances)
+{
+	// In each iteration, improve the NNF, by looping in scanline or reverse-scanline order.
+	for (int iter = 0; iter < _iteration_count; iter++) {
+		PatchMatchCounters counters;
+
+		// Iterate forward in even iteration and backward in odd ones.
+		int index, index_end, shift;
+		if ( iter % 2 == 0 ) {
+			index = 0;
+			index_end = target_points.size();
+			shift = -1;
+		} else {
+			index = target_points.size() - 1;
+			index_end = -1;
+			shift = 1;
+		}
+
+		for (; index != index_end; index -= shift) {
+			visit_point(target_points[index].x, target_points[index].y, shift, iter,
+						source_mask, target_mask, neighbors, distances,
+						counters);
+		}	// for (; ind != ind_end; ind -= shift)
+
+		if (!_patch_match.finish_sweep(target_points, counters)) {
+			break;
+		}
+	}	// for (int iter = 0; iter < _iteration_count; iter++)
+}
+
+#endif	// #ifdef _OPENMP
+
+
+/**
+ * Improves the NNF by red/black sweeps: target points are split into two colours by the parity of x + y,
+ * so the propagation neighbors of a point always have the other colour. All points of one colour are
+ * therefore independent and are updated concurrently (if OpenMP is used) working on a single buffer.
+ * The scaling depends on the number of target points only, not on the shape of the inpainting domain.
+ */
+template <class Distance>
+void PatchMatchEngine<Distance>::iterate_checkerboard(FixedMask source_mask,
+													  FixedMask target_mask,
+													  const vector<Point> &target_points,
+													  Image<Point> &neighbors,
+													  Image<float> &distances)
+{
+	// Split target points by colour
+	// NOTE: the points are coloured in the target image, the points of a lattice by their lattice coordinates
+	vector<Point> coloured_points[2];
+	for (uint i = 0; i < target_points.size(); i++) {
+		Point p = target_points[i] + _origin;
+		coloured_points[((p.x + p.y) / _step) % 2].push_back(target_points[i]);
+	}
+
+	// Sweep counters shared by the team
+	PatchMatchCounters counters;
+	bool is_finished = false;
+
+	#pragma omp parallel
+	{	// === start of parallel block ===
+
+		// Propagate from left and above in even iterations, from right and below in odd ones.
+		for (int iter = 0; iter < _iteration_count && !is_finished; iter++) {
+			int shift = (iter % 2 == 0) ? -1 : 1;
+			PatchMatchCounters my_counters;
+
+			for (int colour = 0; colour < 2; colour++) {
+				const vector<Point> &points = coloured_points[colour];
+
+				// NOTE: implicit barrier at the end of the loop separates the colours
+				#pragma omp for schedule(static)
+				for (int index = 0; index < (int)points.size(); index++) {
+					visit_point(points[index].x, points[index].y, shift, iter,
+								source_mask, target_mask, neighbors, distances,
+								my_counters);
+				}
+			}
+
+			#pragma omp critical
+			counters.add(my_counters);
+
+			#pragma omp barrier
+
+			// NOTE: implicit barrier at the end of the single construct
+			#pragma omp single
+			{
+				is_finished = !_patch_match.finish_sweep(target_points, counters);
+				counters.reset();
+			}
+		}
+	} // === end of parallel block ===
+}
+
+
+/**
+ * Improves the NNF by sweeps over square tiles of the inpainting domain's bounding box. Inside a tile the
+ * points are visited in scanline or reverse-scanline order, so the patches stay in cache. Tiles are coloured
+ * as a checkerboard: tiles of one colour read the NNF only at the edges of the adjacent tiles of the other
+ * colour, thus all tiles of one colour are processed concurrently (if OpenMP is used) on a single buffer.
+ * Tiles of the current colour are handed to threads by a work-stealing queue to balance irregular masks.
+ */
+template <class Distance>
+void PatchMatchEngine<Distance>::iterate_tiles(FixedMask source_mask,
+											   FixedMask target_mask,
+											   const vector<Point> &target_points,
+											   Image<Point> &neighbors,
+											   Image<float> &distances)
+{
+	if (target_points.empty()) {
+		return;
+	}
+
+	// Split target points by tiles (keeping the scanline order inside each tile)
+	// NOTE: the propagation neighbors are _step points apart, smaller tiles would let a point read a tile of its own
+	//       colour (or leave tiles without lattice points), thus the tiles span at least two steps of the lattice
+	int tile_size = max(_tile_size, 2 * _step);
+	Point top_left = target_mask.bounding_box_top_left();
+	Point bottom_right = target_mask.bounding_box_bottom_right();
+	int tiles_x = (bottom_right.x - top_left.x) / tile_size + 1;
+	int tiles_y = (bottom_right.y - top_left.y) / tile_size + 1;
+
+	vector<vector<Point> > tile_points(tiles_x * tiles_y);
+	for (uint i = 0; i < target_points.size(); i++) {
+		int tile_x = (target_points[i].x - top_left.x) / tile_size;
+		int tile_y = (target_points[i].y - top_left.y) / tile_size;
+		tile_points[tiles_x * tile_y + tile_x].push_back(target_points[i]);
+	}
+
+	// Group non-empty tiles by colour
+	vector<int> coloured_tiles[2];
+	for (int tile_y = 0; tile_y < tiles_y; tile_y++) {
+		for (int tile_x = 0; tile_x < tiles_x; tile_x++) {
+			int tile = tiles_x * tile_y + tile_x;
+			if (!tile_points[tile].empty()) {
+				coloured_tiles[(tile_x + tile_y) % 2].push_back(tile);
+			}
+		}
+	}
+
+#ifdef _OPENMP
+	WorkStealingQueue queue(omp_get_max_threads());
+#else
+	WorkStealingQueue queue(1);
+#endif
+
+	// Sweep counters shared by the team
+	PatchMatchCounters counters;
+	bool is_finished = false;
+
+	#pragma omp parallel num_threads(queue.get_number_of_queues())
+	{	// === start of parallel block ===
+
+#ifdef _OPENMP
+		int thread_id = omp_get_thread_num();
+#else
+		int thread_id = 0;
+#endif
+
+		for (int iter = 0; iter < _iteration_count && !is_finished; iter++) {
+			// Iterate forward in even iteration and backward in odd ones.
+			int shift = (iter % 2 == 0) ? -1 : 1;
+			PatchMatchCounters my_counters;
+
+			for (int colour = 0; colour < 2; colour++) {
+				const vector<int> &tiles = coloured_tiles[colour];
+
+				// NOTE: implicit barrier at the end of the single construct
+				#pragma omp single
+				queue.assign(tiles.size());
+
+				int item;
+				while (queue.pop(thread_id, item)) {
+					const vector<Point> &points = tile_points[tiles[item]];
+
+					int index, index_end;
+					if (shift < 0) {
+						index = 0;
+						index_end = points.size();
+					} else {
+						index = points.size() - 1;
+						index_end = -1;
+					}
+
+					for (; index != index_end; index -= shift) {
+						visit_point(points[index].x, points[index].y, shift, iter,
+									source_mask, target_mask, neighbors, distances,
+									my_counters);
+					}
+				}
+
+				#pragma omp barrier
+			}
+
+			#pragma omp critical
+			counters.add(my_counters);
+
+			#pragma omp barrier
+
+			// NOTE: implicit barrier at the end of the single construct
+			#pragma omp single
+			{
+				is_finished = !_patch_match.finish_sweep(target_points, counters);
+				counters.reset();
+			}
+		}
+	} // === end of parallel block ===
+}
+
+/**
+ * Checks if the point or one of its propagation neighbors was improved in the previous sweep.
+ */
+template <class Distance>
+inline bool PatchMatchEngine<Distance>::is_active(int x, int y) const
+{
+	if (_patch_match._improved_before.is_empty()) {
+		return true;
+	}
+
+	int size_x = _patch_match._improved_before.get_size_x();
+	int size_y = _patch_match._improved_before.get_size_y();
+
+	return _patch_match._improved_before(x, y) ||
+			(x >= _step && _patch_match._improved_before(x - _step, y)) ||
+			(x < size_x - _step && _patch_match._improved_before(x + _step, y)) ||
+			(y >= _step && _patch_match._improved_before(x, y - _step)) ||
+			(y < size_y - _step && _patch_match._improved_before(x, y + _step));
+}
+
+
+/**
+ * Index of the random stream of the point: its index in the target image (thus the streams do not depend
+ * on the bounding box of the target region).
+ */
+template <class Distance>
+inline uint64_t PatchMatchEngine<Distance>::get_stream(const Point &point) const
+{
+	return (uint64_t)(_target_size.size_x * (point.y + _origin.y) + (point.x + _origin.x));
+}
+
+
+/**
+ * Memo of the evaluated candidates of the calling thread (null, if disabled).
+ */
+template <class Distance>
+inline CandidateMemo *PatchMatchEngine<Distance>::get_memo()
+{
+	if (_memos.empty()) {
+		return 0;
+	}
+
+#ifdef _OPENMP
+	return &_memos[omp_get_thread_num()];
+#else
+	return &_memos[0];
+#endif
+}
+
+
+/**
+ * Removes the candidates equal to the current match (they cannot improve it) and the candidates, whose distances
+ * are found in the memo.
+ * A found distance smaller than the current one is exact (the distances stopped by the bound are not smaller than
+ * the distance of the point after their evaluation, which only decreases during the call), thus it is used directly.
+ *
+ * @return Number of the remaining candidates (moved to the beginning of the array in the original order).
+ */
+template <class Distance>
+inline int PatchMatchEngine<Distance>::recall(const CandidateMemo &memo,
+											  Point *candidates,
+											  int count,
+											  const Point &target_point,
+											  const Point &match,
+											  float &distance,
+											  Point &neighbor,
+											  PatchMatchCounters &counters) const
+{
+	int remaining_count = 0;
+	for (int i = 0; i < count; i++) {
+		float candidate_distance;
+		if (candidates[i].x == match.x && candidates[i].y == match.y) {
+			counters.duplicate_candidates++;
+			continue;
+		}
+
+		counters.memo_lookups++;
+		if (memo.find(candidates[i], target_point, candidate_distance)) {
+			counters.memo_hits++;
+			if (candidate_distance < distance) {
+				distance = candidate_distance;
+				neighbor = candidates[i];
+			}
+		} else {
+			candidates[remaining_count++] = candidates[i];
+		}
+	}
+
+	return remaining_count;
+}
+
+
+/**
+ * Rejects the candidates, whose lower bounds of the distances (by the moments of the patches, see
+ * APatchDistance::use_moment_bounds()) are not smaller than the current distance, so they cannot improve it.
+ *
+ * @return Number of the remaining candidates (moved to the beginning of the array in the original order).
+ */
+template <class Distance>
+inline int PatchMatchEngine<Distance>::prune(Point *candidates,
+											 int count,
+											 const Point &target_point,
+											 float distance,
+											 PatchMatchCounters &counters) const
+{
+	if (!_use_moment_bounds) {
+		return count;
+	}
+
+	int remaining_count = 0;
+	for (int i = 0; i < count; i++) {
+		// NOTE: the bound is slightly relaxed against the rounding errors of the moments and of the distances
+		if (_distance.calculate_lower_bound(candidates[i], target_point) * 0.999f < distance) {
+			candidates[remaining_count++] = candidates[i];
+		}
+	}
+
+	counters.pruned_candidates += count - remaining_count;
+	return remaining_count;
+}
+
+
+/**
+ * Rejects the candidates, whose estimates of the distances by the sparse stage (see APatchDistance::set_sparse_stride())
+ * are not smaller than the current distance. Only the remaining candidates are evaluated by the full distance.
+ *
+ * @return Number of the remaining candidates (moved to the beginning of the array in the original order).
+ */
+template <class Distance>
+inline int PatchMatchEngine<Distance>::screen(Point *candidates,
+											  int count,
+											  const Point &target_point,
+											  float distance,
+											  PatchMatchCounters &counters) const
+{
+	if (!_use_sparse_stage) {
+		return count;
+	}
+
+	int remaining_count = 0;
+	for (int i = 0; i < count; i++) {
+		if (_distance.calculate_sparse(candidates[i], target_point, distance) < distance) {
+			candidates[remaining_count++] = candidates[i];
+		}
+	}
+
+	counters.screened_candidates += count - remaining_count;
+	return remaining_count;
+}
+
+
+/**
+ * Evaluates the candidates of a stage of the search (after the memo, the lower bounds and the sparse stage,
+ * if used) and updates the distance and the neighbor, if a candidate is better.
+ *
+ * @param match Match of the current distance.
+ */
+template <class Distance>
+inline void PatchMatchEngine<Distance>::evaluate(Point *candidates,
+												 int count,
+												 const Point &target_point,
+												 const Point &match,
+												 float &distance,
+												 Point &neighbor,
+												 PatchMatchCounters &counters)
+{
+	// NOTE: the patches are compared at the point of the target image
+	Point point = target_point + _origin;
+
+	CandidateMemo *memo = get_memo();
+	if (memo) {
+		count = recall(*memo, candidates, count, point, match, distance, neighbor, counters);
+	}
+	count = prune(candidates, count, point, distance, counters);
+	count = screen(candidates, count, point, distance, counters);
+	if (count == 0) {
+		return;
+	}
+
+	float candidate_distances[32];
+	calculate(candidates, count, point, distance, candidate_distances);
+	counters.distance_evaluations += count;
+	for (int i = 0; i < count; i++) {
+		if (candidate_distances[i] < distance) {
+			distance = candidate_distances[i];
+			neighbor = candidates[i];
+		}
+	}
+
+	if (memo) {
+		for (int i = 0; i < count; i++) {
+			memo->store(candidates[i], point, candidate_distances[i]);
+		}
+	}
+}
+
+
+/**
+ * Copies the neighbors of the keys around the chunk of a thread of the scanline scheme to its halo.
+ */
+template <class Distance>
+void PatchMatchEngine<Distance>::fill_halo(const Image<Point> &neighbors, Halo &halo) const
+{
+	int keys_count = neighbors.get_size().size_x * neighbors.get_size().size_y;
+	int before_begin = halo.begin_key - (int)halo.before.size();
+	for (int k = max(0, -before_begin); k < (int)halo.before.size(); k++) {
+		int key = before_begin + k;
+		halo.before[k] = neighbors(key % halo.width, key / halo.width);
+	}
+
+	int after_begin = halo.end_key + 1;
+	for (int k = 0; k < (int)halo.after.size() && after_begin + k < keys_count; k++) {
+		int key = after_begin + k;
+		halo.after[k] = neighbors(key % halo.width, key / halo.width);
+	}
+}
+
+
+/**
+ * Returns the nearest neighbor of a point of the bounding box: the one from the halo, if the point is outside
+ * the chunk of the thread of the scanline scheme (if any), and the one from the buffer otherwise.
+ */
+template <class Distance>
+inline const Point &PatchMatchEngine<Distance>::get_neighbor(const Image<Point> &neighbors, const Halo *halo, int x, int y) const
+{
+	if (halo) {
+		int key = y * halo->width + x;
+		if (key < halo->begin_key) {
+			return halo->before[key - halo->begin_key + (int)halo->before.size()];
+		} else if (key > halo->end_key) {
+			return halo->after[key - halo->end_key - 1];
+		}
+	}
+
+	return neighbors(x, y);
+}
+
+
+/**
+ * Improves the nearest neighbor of a single target point, if it is in the active set, and updates the counters.
+ *
+ * @param halo Neighbors outside the chunk of the thread (only for the OpenMP scanline scheme).
+ */
+template <class Distance>
+inline void PatchMatchEngine<Distance>::visit_point(int x, int y, int shift, int iteration,
+													const FixedMask &source_mask,
+													const FixedMask &target_mask,
+													Image<Point> &neighbors,
+													Image<float> &distances,
+													PatchMatchCounters &counters,
+													const Halo *halo)
+{
+	if (is_active(x, y)) {
+		// NOTE: random numbers depend only on the seed, the call, the iteration and the point (not on the thread)
+		RandomGenerator random(_random_key, ((uint64_t)iteration << 32) | get_stream(Point(x, y)));
+
+		counters.active_points++;
+		if (improve_point(x, y, shift, source_mask, target_mask, neighbors, distances, random, counters, halo)) {
+			counters.improvements++;
+			if (_patch_match._improved_now.is_not_empty()) {
+				_patch_match._improved_now(x, y) = true;
+			}
+		}
+	}
+
+	// NOTE: every point is visited once per sweep, its distance is final at this moment
+	counters.energy += distances(x, y);
+}
+
+
+/**
+ * Replaces the nearest neighbor of a point off the lattice by the best candidate, if it is better.
+ *
+ * @return True, if the nearest neighbor was improved.
+ */
+template <class Distance>
+inline bool PatchMatchEngine<Distance>::fill_point(int x, int y,
+												   Point *candidates,
+												   int count,
+												   Image<Point> &neighbors,
+												   Image<float> &distances,
+												   PatchMatchCounters &counters)
+{
+	float distance = distances(x, y);
+	Point neighbor(-1, -1);
+
+	evaluate(candidates, count, Point(x, y), neighbors(x, y), distance, neighbor, counters);
+
+	if (neighbor.x < 0) {
+		return false;
+	}
+
+	distances(x, y) = distance;
+	neighbors(x, y) = neighbor;
+	counters.improvements++;
+	return true;
+}
+
+
+/**
+ * Improves the nearest neighbor of a single target point: propagation from the (x + shift, y) and (x, y + shift)
+ * neighbors, the dominant offsets of the field (if any) and the random search in windows of exponentially decreasing size.
+ *
+ * @param counters Updated with the numbers of distance evaluations, propagations and wasted shots, and with the maximum
+ *        number of shots used to find a point in the source region (the point is drawn from the source index if all shots miss).
+ * @return True, if the nearest neighbor was improved.
+ */
+template <class Distance>
+inline bool PatchMatchEngine<Distance>::improve_point(int x, int y, int shift,
+													  const FixedMask &source_mask,
+													  const FixedMask &target_mask,
+													  Image<Point> &neighbors,
+													  Image<float> &distances,
+													  RandomGenerator &random,
+													  PatchMatchCounters &counters,
+													  const Halo *halo)
+{
+	Shape source_shape = source_mask.get_size();
+
+	float distance = distances(x, y);
+	float original_distance = distance;
+	Point neighbor(-1, -1);
+
+	// NOTE: candidates of each stage are evaluated by a single (batched) call; one candidate per window size
+	//       is drawn in the random search, thus 32 candidates are enough for any image size.
+	Point candidates[32];
+	int candidates_count = 0;
+
+	/// Propagation: Improve current guess by trying instead correspondences from left and above (below and right on odd iterations).
+	// NOTE: the neighbors are the adjacent points of the lattice, if only a lattice of the target points is searched
+	int step = shift * _step;
+
+	if (target_mask.test(x + step, y)) {
+		Point candidate = get_neighbor(neighbors, halo, x + step, y);
+		candidate.x -= step;
+
+		if (source_mask.test(candidate.x, candidate.y)) {
+			candidates[candidates_count++] = candidate;
+		}
+	}
+
+	if (target_mask.test(x, y + step)) {
+		Point candidate = get_neighbor(neighbors, halo, x, y + step);
+		candidate.y -= step;
+
+		if (source_mask.test(candidate.x, candidate.y)) {
+			candidates[candidates_count++] = candidate;
+		}
+	}
+
+	// Check for improvement
+	evaluate(candidates, candidates_count, Point(x, y), neighbors(x, y), distance, neighbor, counters);
+
+	if (neighbor.x < 0) {
+		neighbor = neighbors(x, y);
+	} else {
+		counters.propagations++;
+	}
+
+	/// Dominant offsets: Improve current guess by trying the offsets which are the most frequent in the field.
+	const vector<Point> &offsets = _patch_match._dominant_offsets;
+	if (!offsets.empty()) {
+		candidates_count = 0;
+		for (uint k = 0; k < offsets.size(); k++) {
+			Point candidate(x + _origin.x + offsets[k].x, y + _origin.y + offsets[k].y);
+
+			if (source_mask.test(candidate.x, candidate.y)) {
+				candidates[candidates_count++] = candidate;
+			}
+		}
+
+		Point match = neighbor;
+		evaluate(candidates, candidates_count, Point(x, y), match, distance, neighbor, counters);
+
+		if (neighbor != match) {
+			counters.offset_improvements++;
+		}
+	}
+
+	/// Random search: Improve current guess by searching in boxes of exponentially decreasing size around the current best guess.
+	int window_size_limit = _search_windows.is_empty() ? _search_window_size : _search_windows(x + _origin.x, y + _origin.y);
+	int max_window_size = (window_size_limit != -1) ? window_size_limit :
+													  std::max(source_shape.size_x, source_shape.size_y);
+
+	Point search_center = neighbor;
+	candidates_count = 0;
+	for (int window_size = max_window_size; window_size >= 1; window_size /= 2) {
+		// Limit sampling window
+		int x_min = max(search_center.x - window_size, 0);
+		int y_min = max(search_center.y - window_size, 0);
+		int x_max = min(search_center.x + window_size + 1, (int)source_shape.size_x);
+		int y_max = min(search_center.y + window_size + 1, (int)source_shape.size_y);
+
+		// Sample uniformly among the valid source points of the window.
+		// NOTE: uniform shots are cheap for windows which are mostly in the source region. If all of them miss,
+		//       the point is drawn from the index, so every window is sampled and the result is still uniform.
+		Point candidate;
+		bool is_found = false;
+		for (int k = 0; k < _random_shots_limit && !is_found; k++)
+		{
+			candidate.x = x_min + random.uniform(x_max - x_min);
+			candidate.y = y_min + random.uniform(y_max - y_min);
+			is_found = source_mask.test(candidate.x, candidate.y);
+			if (!is_found) {
+				counters.wasted_shots++;
+			}
+
+			if (k > counters.max_random_shots) {
+				counters.max_random_shots = k;
+			}
+		}
+
+		if (!is_found) {
+			int count = _source_index.count(x_min, y_min, x_max, y_max);
+			if (count == 0) {
+				continue;
+			}
+			candidate = _source_index.sample(x_min, y_min, x_max, y_max, random.uniform(count));
+		}
+
+		candidates[candidates_count++] = candidate;
+	}
+
+	// Check for improvement
+	evaluate(candidates, candidates_count, Point(x, y), search_center, distance, neighbor, counters);
+
+	if (original_distance > distance) {
+		distances(x, y) = distance;
+		neighbors(x, y) = neighbor;
+		return true;
+	}
+
+	return false;
+}
@@ -0,0 +1,311 @@
+/**
+ * Copyright (C) 2015, Vadim Fedorov <vadim.fedorov@upf.edu>
+ * Copyright (C) 2015, Gabriele Facciolo <facciolo@ens-cachan.fr>
+ * Copyright (C) 2015, Pablo Arias <pablo.arias@cmla.ens-cachan.fr>
+ *
+ * This program is free software: you can use, modify and/or
+ * redistribute it under the terms of the simplified BSD
+ * License. You should have received a copy of this license along
+ * this program. If not, see
+ * <http://www.opensource.org/licenses/bsd-license.html>.
+ */
+
+#include "patch_moments.h"
+#include <math.h>
+#include <algorithm>
+#include "a_patch_distance.h"	// NOTE: for the check of the uniform weights
+
+PatchMoments::PatchMoments()
+{
+	_values = 0;
+	_size_x = 0;
+	_size_y = 0;
+	_stride = 0;
+	_number_of_channels = 0;
+	_is_uniform_weighting = false;
+	_weights_sum = 0.0f;
+	_mean_values = 0;
+	_deviation_values = 0;
+}
+
+
+/**
+ * Calculates the moments of the patches of the image.
+ */
+PatchMoments::PatchMoments(FixedImage<float> image, FixedImage<float> patch_weighting, bool use_deviations)
+{
+	_image = image;
+	_values = image.raw();
+	_size_x = image.get_size_x();
+	_size_y = image.get_size_y();
+	_number_of_channels = image.get_number_of_channels();
+	_stride = _number_of_channels * _size_x;
+	_patch_weighting = patch_weighting;
+
+	initialize(use_deviations);
+}
+
+
+/**
+ * Calculates the moments of the patches of the interleaved values (e.g. the features of an image).
+ *
+ * @param stride Number of values per row.
+ * @note The values are not copied, they should stay valid (and be refreshed by refresh()) while the moments are used.
+ */
+PatchMoments::PatchMoments(const float *values,
+						   int size_x,
+						   int size_y,
+						   int stride,
+						   int number_of_channels,
+						   FixedImage<float> patch_weighting,
+						   bool use_deviations)
+{
+	_values = values;
+	_size_x = size_x;
+	_size_y = size_y;
+	_stride = stride;
+	_number_of_channels = number_of_channels;
+	_patch_weighting = patch_weighting;
+
+	initialize(use_deviations);
+}
+
+
+/**
+ * Recalculates the moments of the patches, whose pixels are in the bounding box of the region extended by the margin.
+ *
+ * @note The moments are shared by the copies, thus the copies are refreshed as well.
+ */
+void PatchMoments::refresh(FixedMask modified_region, int margin)
+{
+	Point top_left = modified_region.bounding_box_top_left();
+	Point bottom_right = modified_region.bounding_box_bottom_right();
+	if (top_left.x < 0) {
+		return;
+	}
+
+	int radius_x = _patch_weighting.get_size_x() / 2 + margin;
+	int radius_y = _patch_weighting.get_size_y() / 2 + margin;
+	calculate(top_left.x - radius_x, top_left.y - radius_y, bottom_right.x + radius_x + 1, bottom_right.y + radius_y + 1);
+}
+
+
+bool PatchMoments::is_empty() const
+{
+	return _mean_values == 0;
+}
+
+
+FixedImage<float> PatchMoments::get_image() const
+{
+	return _image;
+}
+
+
+bool PatchMoments::has_deviations() const
+{
+	return _deviation_values != 0;
+}
+
+
+int PatchMoments::get_number_of_channels() const
+{
+	return _number_of_channels;
+}
+
+
+/**
+ * Sum of the patch weights (the moments are normalized by it).
+ */
+float PatchMoments::get_weights_sum() const
+{
+	return _weights_sum;
+}
+
+
+/* Private */
+
+void PatchMoments::initialize(bool use_deviations)
+{
+	_is_uniform_weighting = APatchDistance::is_uniform(_patch_weighting);
+
+	_weights_sum = 0.0f;
+	const float *weights = _patch_weighting.raw();
+	for (uint i = 0; i < _patch_weighting.get_size_x() * _patch_weighting.get_size_y(); i++) {
+		_weights_sum += weights[i];
+	}
+
+	_means = Image<float>(_size_x, _size_y, (uint)_number_of_channels, 0.0f);
+	_mean_values = _means.raw();
+	if (use_deviations) {
+		_deviations = Image<float>(_size_x, _size_y, (uint)_number_of_channels, 0.0f);
+		_deviation_values = _deviations.raw();
+	} else {
+		_deviations = Image<float>();
+		_deviation_values = 0;
+	}
+
+	calculate(0, 0, _size_x, _size_y);
+}
+
+
+/**
+ * Calculates the moments of the points in [x_begin, x_end) x [y_begin, y_end), whose patches are inside the image.
+ */
+void PatchMoments::calculate(int x_begin, int y_begin, int x_end, int y_end)
+{
+	int radius_x = _patch_weighting.get_size_x() / 2;
+	int radius_y = _patch_weighting.get_size_y() / 2;
+
+	x_begin = max(x_begin, radius_x);
+	y_begin = max(y_begin, radius_y);
+	x_end = min(x_end, _size_x - radius_x);
+	y_end = min(y_end, _size_y - radius_y);
+	if (x_begin >= x_end || y_begin >= y_end) {
+		return;
+	}
+
+	if (_is_uniform_weighting) {
+		calculate_uniform(x_begin, y_begin, x_end, y_end);
+	} else {
+		calculate_weighted(x_begin, y_begin, x_end, y_end);
+	}
+}
+
+
+/**
+ * Box filters: running sums along the rows, followed by the sums of the patch rows.
+ * NOTE: the sums are accumulated in doubles, the variances are differences of large numbers.
+ */
+void PatchMoments::calculate_uniform(int x_begin, int y_begin, int x_end, int y_end)
+{
+	int patch_size_x = _patch_weighting.get_size_x();
+	int patch_size_y = _patch_weighting.get_size_y();
+	int radius_x = patch_size_x / 2;
+	int radius_y = patch_size_y / 2;
+	int channels = _number_of_channels;
+	int width = x_end - x_begin;
+	int rows = y_end - y_begin + 2 * radius_y;
+	bool use_deviations = has_deviations();
+
+	// Sums of the patch rows
+	vector<double> row_sums(rows * width * channels);
+	vector<double> row_square_sums(use_deviations ? rows * width * channels : 0);
+
+	#pragma omp parallel for schedule(static)
+	for (int row = 0; row < rows; row++) {
+		const float *values = _values + _stride * (y_begin - radius_y + row);
+		double *sums = &row_sums[width * channels * row];
+		double *square_sums = use_deviations ? &row_square_sums[width * channels * row] : 0;
+
+		for (int ch = 0; ch < channels; ch++) {
+			double sum = 0.0;
+			double square_sum = 0.0;
+			for (int dx = 0; dx < patch_size_x; dx++) {
+				double value = values[channels * (x_begin - radius_x + dx) + ch];
+				sum += value;
+				square_sum += value * value;
+			}
+
+			for (int x = x_begin; x < x_end; x++) {
+				if (x > x_begin) {
+					double added = values[channels * (x + radius_x) + ch];
+					double removed = values[channels * (x - radius_x - 1) + ch];
+					sum += added - removed;
+					square_sum += added * added - removed * removed;
+				}
+
+				sums[channels * (x - x_begin) + ch] = sum;
+				if (use_deviations) {
+					square_sums[channels * (x - x_begin) + ch] = square_sum;
+				}
+			}
+		}
+	}
+
+	// Sums of the patches
+	double weight = _weights_sum / (patch_size_x * patch_size_y);
+	float *means = _means.raw();
+	float *deviations = use_deviations ? _deviations.raw() : 0;
+
+	#pragma omp parallel for schedule(static)
+	for (int y = y_begin; y < y_end; y++) {
+		vector<double> sums(channels);
+		vector<double> square_sums(channels);
+		for (int x = x_begin; x < x_end; x++) {
+			for (int ch = 0; ch < channels; ch++) {
+				sums[ch] = 0.0;
+				square_sums[ch] = 0.0;
+				for (int dy = 0; dy < patch_size_y; dy++) {
+					int index = width * channels * (y - y_begin + dy) + channels * (x - x_begin) + ch;
+					sums[ch] += weight * row_sums[index];
+					if (use_deviations) {
+						square_sums[ch] += weight * row_square_sums[index];
+					}
+				}
+			}
+
+			int offset = channels * (_size_x * y + x);
+			store(&sums[0], &square_sums[0], means + offset, use_deviations ? deviations + offset : 0);
+		}
+	}
+}
+
+
+/**
+ * Weighted sums over the patches.
+ */
+void PatchMoments::calculate_weighted(int x_begin, int y_begin, int x_end, int y_end)
+{
+	int patch_size_x = _patch_weighting.get_size_x();
+	int patch_size_y = _patch_weighting.get_size_y();
+	int radius_x = patch_size_x / 2;
+	int radius_y = patch_size_y / 2;
+	int channels = _number_of_channels;
+	bool use_deviations = has_deviations();
+	const float *weights = _patch_weighting.raw();
+	float *means = _means.raw();
+	float *deviations = use_deviations ? _deviations.raw() : 0;
+
+	#pragma omp parallel for schedule(static)
+	for (int y = y_begin; y < y_end; y++) {
+		vector<double> sums(channels);
+		vector<double> square_sums(channels);
+		for (int x = x_begin; x < x_end; x++) {
+			for (int ch = 0; ch < channels; ch++) {
+				sums[ch] = 0.0;
+				square_sums[ch] = 0.0;
+			}
+
+			for (int dy = 0; dy < patch_size_y; dy++) {
+				const float *values = _values + _stride * (y - radius_y + dy) + channels * (x - radius_x);
+				for (int dx = 0; dx < patch_size_x; dx++) {
+					double weight = weights[patch_size_x * dy + dx];
+					for (int ch = 0; ch < channels; ch++) {
+						double value = values[channels * dx + ch];
+						sums[ch] += weight * value;
+						square_sums[ch] += weight * value * value;
+					}
+				}
+			}
+
+			int offset = channels * (_size_x * y + x);
+			store(&sums[0], &square_sums[0], means + offset, use_deviations ? deviations + offset : 0);
+		}
+	}
+}
+
+
+/**
+ * Stores the means (and the standard deviations) given by the weighted sums of the values (and of their squares).
+ */
+void PatchMoments::store(const double *sums, const double *square_sums, float *means, float *deviations) const
+{
+	for (int ch = 0; ch < _number_of_channels; ch++) {
+		double mean = sums[ch] / _weights_sum;
+		means[ch] = mean;
+		if (deviations) {
+			deviations[ch] = sqrt(max(0.0, square_sums[ch] / _weights_sum - mean * mean));
+		}
+	}
+}
@@ -0,0 +1,88 @@
+/**
+ * Copyright (C) 2015, Vadim Fedorov <vadim.fedorov@upf.edu>
+ * Copyright (C) 2015, Gabriele Facciolo <facciolo@ens-cachan.fr>
+ * Copyright (C) 2015, Pablo Arias <pablo.arias@cmla.ens-cachan.fr>
+ *
+ * This program is free software: you can use, modify and/or
+ * redistribute it under the terms of the simplified BSD
+ * License. You should have received a copy of this license along
+ * this program. If not, see
+ * <http://www.opensource.org/licenses/bsd-license.html>.
+ */
+
+#ifndef PATCH_MOMENTS_H_
+#define PATCH_MOMENTS_H_
+
+#include <vector>
+#include "image.h"
+#include "mask.h"
+#include "point.h"
+
+using namespace std;
+
+/**
+ * Weighted means and, optionally, standard deviations of the channels of all patches of an image (or of
+ * the features calculated from it), for the lower bounds of the patch distances (see APatchDistance).
+ * Uniform patch weights are handled by box filters (running sums), other weights directly.
+ *
+ * @note Only points whose patches are inside the image have moments (the remaining points are zero).
+ */
+class PatchMoments
+{
+public:
+	PatchMoments();
+	PatchMoments(FixedImage<float> image, FixedImage<float> patch_weighting, bool use_deviations);
+	PatchMoments(const float *values,
+				 int size_x,
+				 int size_y,
+				 int stride,
+				 int number_of_channels,
+				 FixedImage<float> patch_weighting,
+				 bool use_deviations);
+
+	// Recalculates the moments of the patches touching the modified pixels (or the pixels at most 'margin' from them).
+	void refresh(FixedMask modified_region, int margin = 0);
+
+	bool is_empty() const;
+	FixedImage<float> get_image() const;	// NOTE: empty for the moments of the values
+	bool has_deviations() const;
+	int get_number_of_channels() const;
+	float get_weights_sum() const;
+
+	/// Means of the channels of the patch centered at the point.
+	inline const float *get_means(const Point &center) const
+	{
+		return _mean_values + _number_of_channels * (_size_x * center.y + center.x);
+	}
+
+	/// Standard deviations of the channels of the patch centered at the point (if calculated).
+	inline const float *get_deviations(const Point &center) const
+	{
+		return _deviation_values + _number_of_channels * (_size_x * center.y + center.x);
+	}
+
+private:
+	FixedImage<float> _image;	// NOTE: keeps the values alive, if they are the ones of an image
+	const float *_values;
+	int _size_x;
+	int _size_y;
+	int _stride;
+	int _number_of_channels;
+	FixedImage<float> _patch_weighting;
+	bool _is_uniform_weighting;
+	float _weights_sum;
+	// NOTE: the images are shared by the copies (reference counting), so the pointers stay valid
+	Image<float> _means;
+	Image<float> _deviations;
+	const float *_mean_values;
+	const float *_deviation_values;
+
+	void initialize(bool use_deviations);
+	void calculate(int x_begin, int y_begin, int x_end, int y_end);
+	void calculate_uniform(int x_begin, int y_begin, int x_end, int y_end);
+	void calculate_weighted(int x_begin, int y_begin, int x_end, int y_end);
+	void store(const double *sums, const double *square_sums, float *means, float *deviations) const;
+};
+
+
+#endif /* PATCH_MOMENTS_H_ */
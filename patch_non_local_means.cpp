@@ -11,6 +11,7 @@
  */
 
 #include "patch_non_local_means.h"
+#include "cpu_dispatch.h"
 
 PatchNonLocalMeans::PatchNonLocalMeans()
 : AImageUpdating() { }
@@ -20,6 +21,11 @@ PatchNonLocalMeans::PatchNonLocalMeans(Shape patch_size, float gaussian_sigma)
 : AImageUpdating(patch_size, gaussian_sigma) { }
 
 
+/**
+ * Updates every pixel of the inpainting domain with the weighted average of the pixels of all patches (of their
+ * nearest neighbors) covering it. The patches are accumulated row by row (a row of a patch is contiguous in the
+ * images with interleaved channels), thus the kernels of CpuDispatch are used.
+ */
 double PatchNonLocalMeans::update(Image<float> image,
 								  Image<float> original_image,
 								  FixedMask inpainting_domain,
@@ -29,7 +35,8 @@ double PatchNonLocalMeans::update(Image<float> image,
 {
 	int half_patch_size_x = _patch_size.size_x / 2;
 	int half_patch_size_y = _patch_size.size_y / 2;
-	Shape image_size = image.get_size();
+	int size_x = image.get_size_x();
+	int size_y = image.get_size_y();
 	int number_of_channels = image.get_number_of_channels();
 
 	if (_patch_weighting.is_empty()) {
@@ -40,51 +47,73 @@ double PatchNonLocalMeans::update(Image<float> image,
 
 	}
 
-	double total_difference = 0.0;
-	Mask::iterator it;
-	for (it = inpainting_domain.begin(); it != inpainting_domain.end(); ++it) {
-		int x = it->x;
-		int y = it->y;
+	// Weight of the pixel at the offset (dx, dy) from the patch center is the weight of the patch center
+	// at the offset (-dx, -dy) from the pixel, thus the weights are mirrored (and repeated for every channel).
+	int patch_size_x = _patch_size.size_x;
+	int patch_size_y = _patch_size.size_y;
+	vector<float> weights(patch_size_x * patch_size_y);
+	vector<float> channel_weights(patch_size_x * patch_size_y * number_of_channels);
+	for (int y = 0; y < patch_size_y; y++) {
+		for (int x = 0; x < patch_size_x; x++) {
+			int index = patch_size_x * y + x;
+			weights[index] = _patch_weighting(patch_size_x - 1 - x, patch_size_y - 1 - y);
+			for (int ch = 0; ch < number_of_channels; ch++) {
+				channel_weights[number_of_channels * index + ch] = weights[index];
+			}
+		}
+	}
 
-		int x_a = max(x - half_patch_size_x, 0);
-		int x_b = min(x + half_patch_size_x, (int)image_size.size_x - 1);
-		int y_a = max(y - half_patch_size_y, 0);
-		int y_b = min(y + half_patch_size_y, (int)image_size.size_y - 1);
+	// NOTE: direct access - we sacrifice readability in favor of performance
+	const SimdKernels &kernels = CpuDispatch::get_kernels();
+	const float *image_values = image.raw();
+	vector<float> total_values(size_x * size_y * number_of_channels, 0.0f);
+	vector<float> total_weights(size_x * size_y, 0.0f);
+
+	// NOTE: all patches covering the inpainting domain are centered in the extended inpainting domain
+	FixedMask::iterator it;
+	for (it = extended_inpainting_domain.begin(); it != extended_inpainting_domain.end(); ++it) {
+		Point center = *it;
+		Point neighbor = nnf(center);
+		if (neighbor.x == -1) {
+			continue;
+		}
 
-		float total_value[number_of_channels];
-		for (int ch = 0; ch < number_of_channels; ch++) {
-			total_value[ch] = 0.0;
+		float scale = 1.0f;
+		if (confidence_mask.is_not_empty() && inpainting_domain.test(center.x, center.y)) {	// NOTE: outside the inpainting domain Confidence is 1.0, therefore multiplication might be skipped
+			scale = confidence_mask(center);
 		}
 
-		float total_weight = 0.0;
-		for (int i = x_a; i <= x_b; i++) {
-			for (int j = y_a; j <= y_b; j++) {
-				// get center of the corresponding patch
-				Point contributor = nnf(i, j);
-
-				if (contributor.x != -1) {
-					// apply offset w.r.t the patch center to obtain contributing point
-					contributor.x += x - i;
-					contributor.y += y - j;
-
-					if (image_size.contains(contributor)) {
-						float weight = _patch_weighting(i - x_a, j - y_a);
-						if (confidence_mask.is_not_empty() && inpainting_domain.test(i, j)) {	// NOTE: outside the inpainting domain Confidence is 1.0, therefore multiplication might be skipped
-							weight *= confidence_mask(i, j);
-						}
-						total_weight += weight;
-
-						for (int ch = 0; ch < number_of_channels; ch++) {
-							total_value[ch] += image(contributor.x, contributor.y, ch) * weight;
-						}
-					}
-				}
-			}
+		// offsets of the pixels inside the image in both patches
+		int dx_a = max(-half_patch_size_x, -min(center.x, neighbor.x));
+		int dx_b = min(half_patch_size_x, size_x - 1 - max(center.x, neighbor.x));
+		int dy_a = max(-half_patch_size_y, -min(center.y, neighbor.y));
+		int dy_b = min(half_patch_size_y, size_y - 1 - max(center.y, neighbor.y));
+		int length = dx_b - dx_a + 1;
+
+		for (int dy = dy_a; dy <= dy_b && length > 0; dy++) {
+			int pixel = size_x * (center.y + dy) + center.x + dx_a;
+			int contributor = size_x * (neighbor.y + dy) + neighbor.x + dx_a;
+			int weight = patch_size_x * (dy + half_patch_size_y) + dx_a + half_patch_size_x;
+
+			kernels.weighted_accumulate(&total_values[number_of_channels * pixel],
+			                            image_values + number_of_channels * contributor,
+			                            &channel_weights[number_of_channels * weight],
+			                            scale,
+			                            number_of_channels * length);
+			kernels.scaled_accumulate(&total_weights[pixel], &weights[weight], scale, length);
 		}
+	}
+
+	double total_difference = 0.0;
+	for (it = inpainting_domain.begin(); it != inpainting_domain.end(); ++it) {
+		int x = it->x;
+		int y = it->y;
+		int pixel = size_x * y + x;
 
+		float total_weight = total_weights[pixel];
 		if (total_weight > 0.0) {
 			for (int ch = 0; ch < number_of_channels; ch++) {
-				float color_value = total_value[ch] / total_weight;
+				float color_value = total_values[number_of_channels * pixel + ch] / total_weight;
 
 				// add to the total difference
 				float prev_value = image(x, y, ch);
@@ -11,6 +11,7 @@
  */
 
 #include "patch_non_local_poisson.h"
+#include "cpu_dispatch.h"
 
 PatchNonLocalPoisson::PatchNonLocalPoisson()
 	: AImageUpdating()
@@ -303,11 +304,27 @@ inline void PatchNonLocalPoisson::calculate_anisotropic_laplacian(double *image,
 	double a_top, a_bottom, a_right, a_left;	// coefficients
 	double u_top, u_bottom, u_right, u_left;	// color values
 
+	const SimdKernels &kernels = CpuDispatch::get_kernels();
+
 	// calculate anisotropic laplacian and store it in the buffer
 	for (unsigned int i = 0; i < points.size(); i++) {
 		Point p = points[i];
 		int index = size_x * p.y + p.x;
 
+		// NOTE: points are in the scanline order, runs of consecutive points away from the image border are
+		//       calculated at once (by the kernel)
+		if (p.y != 0 && p.y != size_y - 1 && p.x != 0 && p.x != size_x - 1) {
+			unsigned int run_end = i + 1;
+			while (run_end < points.size() && points[run_end].y == p.y &&
+					points[run_end].x == points[run_end - 1].x + 1 && points[run_end].x != size_x - 1) {
+				run_end++;
+			}
+
+			kernels.anisotropic_laplacian(image + index, coefficients + index, size_x, run_end - i, buffer + i);
+			i = run_end - 1;
+			continue;
+		}
+
 		if (p.y != 0) {
 			a_top = coefficients[index - size_x];
 			u_top = image[index - size_x];
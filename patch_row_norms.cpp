@@ -0,0 +1,183 @@
+/**
+ * Copyright (C) 2015, Vadim Fedorov <vadim.fedorov@upf.edu>
+ * Copyright (C) 2015, Gabriele Facciolo <facciolo@ens-cachan.fr>
+ * Copyright (C) 2015, Pablo Arias <pablo.arias@cmla.ens-cachan.fr>
+ *
+ * This program is free software: you can use, modify and/or
+ * redistribute it under the terms of the simplified BSD
+ * License. You should have received a copy of this license along
+ * this program. If not, see
+ * <http://www.opensource.org/licenses/bsd-license.html>.
+ */
+
+#include "patch_row_norms.h"
+#include <math.h>
+#include <algorithm>
+
+PatchRowNorms::PatchRowNorms()
+{
+	_size_x = 0;
+}
+
+
+/**
+ * Calculates the tables of the norms for all image points, whose patch rows are inside the image
+ * (the remaining points are zero).
+ */
+PatchRowNorms::PatchRowNorms(FixedImage<float> image, FixedImage<float> patch_weighting)
+{
+	_image = image;
+	_patch_weighting = patch_weighting;
+
+	int size_x = image.get_size_x();
+	int size_y = image.get_size_y();
+	int patch_size_x = patch_weighting.get_size_x();
+	int patch_size_y = patch_weighting.get_size_y();
+	int radius_y = patch_size_y / 2;
+	_size_x = size_x;
+
+	// Assign a table to every row of the patch weights
+	const float *weights = patch_weighting.raw();
+	_row_tables.resize(patch_size_y);
+	_factors.resize(patch_size_y);
+	for (int row = 0; row < patch_size_y; row++) {
+		_row_tables[row] = -1;
+		for (uint k = 0; k < _base_rows.size() && _row_tables[row] < 0; k++) {
+			if (is_proportional(weights + patch_size_x * row, weights + patch_size_x * _base_rows[k], patch_size_x, _factors[row])) {
+				_row_tables[row] = k;
+			}
+		}
+
+		if (_row_tables[row] < 0) {
+			_row_tables[row] = _base_rows.size();
+			_factors[row] = 1.0f;
+			_base_rows.push_back(row);
+		}
+	}
+
+	_tables.resize(_base_rows.size());
+	for (uint k = 0; k < _base_rows.size(); k++) {
+		_tables[k] = Image<float>(size_x, size_y, 0.0f);
+	}
+
+	calculate(0, 0, size_x, size_y);
+
+	// NOTE: the tables are shared by the copies (reference counting), so the pointers stay valid
+	_row_values.resize(patch_size_y);
+	for (int row = 0; row < patch_size_y; row++) {
+		_row_values[row] = _tables[_row_tables[row]].raw() + size_x * (row - radius_y);
+	}
+}
+
+
+/**
+ * Recalculates the norms of the pixels of the image given to the constructor, whose patch rows contain
+ * modified pixels: the bounding box of the region extended by the patch radius along the rows.
+ *
+ * @note The tables are shared by the copies, thus the copies are refreshed as well.
+ */
+void PatchRowNorms::refresh(FixedMask modified_region)
+{
+	Point top_left = modified_region.bounding_box_top_left();
+	Point bottom_right = modified_region.bounding_box_bottom_right();
+	if (top_left.x < 0) {
+		return;
+	}
+
+	int radius_x = _patch_weighting.get_size_x() / 2;
+	calculate(top_left.x - radius_x, top_left.y, bottom_right.x + radius_x + 1, bottom_right.y + 1);
+}
+
+
+bool PatchRowNorms::is_empty() const
+{
+	return _tables.empty();
+}
+
+
+FixedImage<float> PatchRowNorms::get_image() const
+{
+	return _image;
+}
+
+
+int PatchRowNorms::get_number_of_tables() const
+{
+	return _tables.size();
+}
+
+
+/* Private */
+
+/**
+ * Calculates the norms of the points in [x_begin, x_end) x [y_begin, y_end), whose patch rows are inside
+ * the image (the remaining points are left zero).
+ */
+void PatchRowNorms::calculate(int x_begin, int y_begin, int x_end, int y_end)
+{
+	int size_x = _image.get_size_x();
+	int number_of_channels = _image.get_number_of_channels();
+	int patch_size_x = _patch_weighting.get_size_x();
+	int radius_x = patch_size_x / 2;
+	const float *values = _image.raw();
+	const float *weights = _patch_weighting.raw();
+
+	x_begin = max(x_begin, radius_x);
+	x_end = min(x_end, size_x - radius_x);
+	if (x_begin >= x_end) {
+		return;
+	}
+
+	#pragma omp parallel for schedule(static)
+	for (int y = y_begin; y < y_end; y++) {
+		// squared values summed over the channels, for the pixels of the patch rows
+		vector<float> squares(x_end - x_begin + 2 * radius_x, 0.0f);
+		const float *p_value = values + number_of_channels * (size_x * y + x_begin - radius_x);
+		for (uint i = 0; i < squares.size(); i++) {
+			for (int ch = 0; ch < number_of_channels; ch++) {
+				squares[i] += p_value[number_of_channels * i + ch] * p_value[number_of_channels * i + ch];
+			}
+		}
+
+		// filter the squares along the row with the base rows of the weights
+		for (uint k = 0; k < _base_rows.size(); k++) {
+			const float *row_weights = weights + patch_size_x * _base_rows[k];
+			float *p_table = _tables[k].raw() + size_x * y;
+			for (int x = x_begin; x < x_end; x++) {
+				float norm = 0.0f;
+				for (int dx = 0; dx < patch_size_x; dx++) {
+					norm += row_weights[dx] * squares[x - x_begin + dx];
+				}
+				p_table[x] = norm;
+			}
+		}
+	}
+}
+
+
+/**
+ * Checks if the weights are equal to the base weights times a factor (up to a relative difference of 1e-5).
+ */
+bool PatchRowNorms::is_proportional(const float *weights, const float *base_weights, int size, float &factor)
+{
+	int max_index = 0;
+	for (int i = 1; i < size; i++) {
+		if (fabs(base_weights[i]) > fabs(base_weights[max_index])) {
+			max_index = i;
+		}
+	}
+
+	if (base_weights[max_index] == 0.0f) {
+		return false;
+	}
+
+	factor = weights[max_index] / base_weights[max_index];
+	float tolerance = 1e-5f * fabs(weights[max_index]);
+	for (int i = 0; i < size; i++) {
+		if (fabs(weights[i] - factor * base_weights[i]) > tolerance) {
+			return false;
+		}
+	}
+
+	return true;
+}
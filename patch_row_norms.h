@@ -0,0 +1,65 @@
+/**
+ * Copyright (C) 2015, Vadim Fedorov <vadim.fedorov@upf.edu>
+ * Copyright (C) 2015, Gabriele Facciolo <facciolo@ens-cachan.fr>
+ * Copyright (C) 2015, Pablo Arias <pablo.arias@cmla.ens-cachan.fr>
+ *
+ * This program is free software: you can use, modify and/or
+ * redistribute it under the terms of the simplified BSD
+ * License. You should have received a copy of this license along
+ * this program. If not, see
+ * <http://www.opensource.org/licenses/bsd-license.html>.
+ */
+
+#ifndef PATCH_ROW_NORMS_H_
+#define PATCH_ROW_NORMS_H_
+
+#include <vector>
+#include "image.h"
+#include "mask.h"
+#include "point.h"
+
+using namespace std;
+
+/**
+ * Weighted squared norms of the rows of all patches of an image (summed over the channels), so the
+ * squared L2 distance of two patch rows is ||a||^2 + ||b||^2 - 2<a, b> with only the dot product
+ * calculated per pair. The norms are kept per row (not per patch) for the early termination.
+ *
+ * Rows of patch weights proportional to each other share one table of norms (filtered along the
+ * image rows): uniform and separable weights need one table, other weights one table per distinct row.
+ */
+class PatchRowNorms
+{
+public:
+	PatchRowNorms();
+	PatchRowNorms(FixedImage<float> image, FixedImage<float> patch_weighting);
+
+	// Recalculates the norms of the patch rows touching the modified pixels of the image.
+	void refresh(FixedMask modified_region);
+
+	bool is_empty() const;
+	FixedImage<float> get_image() const;
+	int get_number_of_tables() const;
+
+	/// Norm of the given row of the patch centered at the point.
+	inline float get(const Point &center, int row) const
+	{
+		return _factors[row] * _row_values[row][_size_x * center.y + center.x];
+	}
+
+private:
+	FixedImage<float> _image;
+	FixedImage<float> _patch_weighting;
+	int _size_x;
+	vector<Image<float> > _tables;
+	vector<const float *> _row_values;	// table of each patch row shifted by the row offset (direct access)
+	vector<int> _row_tables;			// table of each patch row
+	vector<float> _factors;				// factor of each patch row (w.r.t. the weights of its table)
+	vector<int> _base_rows;				// row of the weights of each table
+
+	void calculate(int x_begin, int y_begin, int x_end, int y_end);
+	static bool is_proportional(const float *weights, const float *base_weights, int size, float &factor);
+};
+
+
+#endif /* PATCH_ROW_NORMS_H_ */
@@ -0,0 +1,221 @@
+/**
+ * Copyright (C) 2015, Vadim Fedorov <vadim.fedorov@upf.edu>
+ * Copyright (C) 2015, Gabriele Facciolo <facciolo@ens-cachan.fr>
+ * Copyright (C) 2015, Pablo Arias <pablo.arias@cmla.ens-cachan.fr>
+ *
+ * This program is free software: you can use, modify and/or
+ * redistribute it under the terms of the simplified BSD
+ * License. You should have received a copy of this license along
+ * this program. If not, see
+ * <http://www.opensource.org/licenses/bsd-license.html>.
+ */
+
+#include "quantized_patches.h"
+#include <math.h>
+#include <algorithm>
+#include <limits>
+
+QuantizedPatches::QuantizedPatches()
+{
+	_precision = Float;
+	_number_of_channels = 0;
+	_radius_x = 0;
+	_radius_y = 0;
+	_row_length = 0;
+	_weights_stride = 0;
+	_source_stride = 0;
+	_target_stride = 0;
+	_source_int16_values = 0;
+	_target_int16_values = 0;
+	_source_uint8_values = 0;
+	_target_uint8_values = 0;
+	_int16_kernel = 0;
+	_uint8_kernel = 0;
+}
+
+
+/**
+ * Quantizes the images uniformly between the minimum and the maximum of every channel (over both images),
+ * so the differences of the quantized values are proportional to the differences of the floats.
+ *
+ * @param precision Int16 or UInt8 (Float gives an empty object).
+ */
+QuantizedPatches::QuantizedPatches(FixedImage<float> source,
+								   FixedImage<float> target,
+								   FixedImage<float> patch_weighting,
+								   Precision precision,
+								   Norm norm)
+{
+	_precision = precision;
+	_number_of_channels = source.get_number_of_channels();
+	_radius_x = patch_weighting.get_size_x() / 2;
+	_radius_y = patch_weighting.get_size_y() / 2;
+	_row_length = _number_of_channels * patch_weighting.get_size_x();
+	_weights_stride = (_row_length + 7) / 8 * 8;
+	_source_stride = _number_of_channels * source.get_size_x();
+	_target_stride = _number_of_channels * target.get_size_x();
+	_source_int16_values = 0;
+	_target_int16_values = 0;
+	_source_uint8_values = 0;
+	_target_uint8_values = 0;
+	_int16_kernel = 0;
+	_uint8_kernel = 0;
+
+	if (precision == Float) {
+		return;
+	}
+
+	// Range of every channel
+	bool is_target_shared = (target == source);
+	vector<float> minimums(_number_of_channels, numeric_limits<float>::max());
+	vector<float> maximums(_number_of_channels, -numeric_limits<float>::max());
+	for (int k = 0; k < (is_target_shared ? 1 : 2); k++) {
+		FixedImage<float> image = (k == 0) ? source : target;
+		const float *values = image.raw();
+		int size = image.get_size_x() * image.get_size_y();
+		for (int i = 0; i < size; i++) {
+			for (int ch = 0; ch < _number_of_channels; ch++) {
+				minimums[ch] = min(minimums[ch], values[_number_of_channels * i + ch]);
+				maximums[ch] = max(maximums[ch], values[_number_of_channels * i + ch]);
+			}
+		}
+	}
+
+	float levels = (precision == Int16) ? 65535.0f : 255.0f;
+	_steps.resize(_number_of_channels);
+	for (int ch = 0; ch < _number_of_channels; ch++) {
+		_steps[ch] = (maximums[ch] > minimums[ch]) ? (maximums[ch] - minimums[ch]) / levels : 1.0f;
+	}
+
+	// Weights of the quantized values (the squared step for the squared difference)
+	int patch_size_x = patch_weighting.get_size_x();
+	int patch_size_y = patch_weighting.get_size_y();
+	const float *p_weight = patch_weighting.raw();
+	_weights.assign(_weights_stride * patch_size_y, 0.0f);
+	for (int y = 0; y < patch_size_y; y++) {
+		for (int x = 0; x < patch_size_x; x++) {
+			for (int ch = 0; ch < _number_of_channels; ch++) {
+				float step = (norm == SquaredDifference) ? _steps[ch] * _steps[ch] : _steps[ch];
+				_weights[_weights_stride * y + _number_of_channels * x + ch] = p_weight[patch_size_x * y + x] * step;
+			}
+		}
+	}
+
+	int patch_side = patch_size_x;
+	if (precision == Int16) {
+		_source_int16 = quantize_int16(source, minimums);
+		_target_int16 = is_target_shared ? _source_int16 : quantize_int16(target, minimums);
+		_source_int16_values = _source_int16.raw();
+		_target_int16_values = _target_int16.raw();
+		_int16_kernel = (norm == SquaredDifference) ?
+				PatchDistanceKernels::select_int16_squared_difference(patch_side, _number_of_channels) :
+				PatchDistanceKernels::select_int16_absolute_difference(patch_side, _number_of_channels);
+	} else {
+		_source_uint8 = quantize_uint8(source, minimums);
+		_target_uint8 = is_target_shared ? _source_uint8 : quantize_uint8(target, minimums);
+		_source_uint8_values = _source_uint8.raw();
+		_target_uint8_values = _target_uint8.raw();
+		_uint8_kernel = (norm == SquaredDifference) ?
+				PatchDistanceKernels::select_uint8_squared_difference(patch_side, _number_of_channels) :
+				PatchDistanceKernels::select_uint8_absolute_difference(patch_side, _number_of_channels);
+	}
+}
+
+
+bool QuantizedPatches::is_empty() const
+{
+	return _precision == Float;
+}
+
+
+QuantizedPatches::Precision QuantizedPatches::get_precision() const
+{
+	return _precision;
+}
+
+
+float QuantizedPatches::get_step(int channel) const
+{
+	return _steps[channel];
+}
+
+
+/**
+ * Parses the name of the precision (float, int16 or uint8).
+ *
+ * @return False, if the name is unknown.
+ */
+bool QuantizedPatches::parse_precision(const string &name, Precision &precision)
+{
+	if (name == "float") {
+		precision = Float;
+	} else if (name == "int16") {
+		precision = Int16;
+	} else if (name == "uint8") {
+		precision = UInt8;
+	} else {
+		return false;
+	}
+
+	return true;
+}
+
+
+const char *QuantizedPatches::get_precision_name(Precision precision)
+{
+	switch (precision) {
+		case Int16:
+			return "int16";
+		case UInt8:
+			return "uint8";
+		default:
+			return "float";
+	}
+}
+
+
+/* Private */
+
+Image<int16_t> QuantizedPatches::quantize_int16(FixedImage<float> image, const vector<float> &minimums)
+{
+	Image<int16_t> quantized(image.get_size_x(), image.get_size_y() + 1, (uint)_number_of_channels, (int16_t)0);
+	int size = image.get_size_x() * image.get_size_y() * _number_of_channels;
+	const float *p_value = image.raw();
+	int16_t *p_quantized = quantized.raw();
+	vector<float> inverse_steps(_number_of_channels);
+	for (int ch = 0; ch < _number_of_channels; ch++) {
+		inverse_steps[ch] = 1.0f / _steps[ch];
+	}
+
+	// NOTE: the levels are centered at zero (-32768..32767)
+	#pragma omp parallel for schedule(static)
+	for (int i = 0; i < size; i++) {
+		int ch = i % _number_of_channels;
+		float level = floor((p_value[i] - minimums[ch]) * inverse_steps[ch] + 0.5f);
+		p_quantized[i] = (int16_t)(min(max(level, 0.0f), 65535.0f) - 32768.0f);
+	}
+
+	return quantized;
+}
+
+
+Image<uint8_t> QuantizedPatches::quantize_uint8(FixedImage<float> image, const vector<float> &minimums)
+{
+	Image<uint8_t> quantized(image.get_size_x(), image.get_size_y() + 1, (uint)_number_of_channels, (uint8_t)0);
+	int size = image.get_size_x() * image.get_size_y() * _number_of_channels;
+	const float *p_value = image.raw();
+	uint8_t *p_quantized = quantized.raw();
+	vector<float> inverse_steps(_number_of_channels);
+	for (int ch = 0; ch < _number_of_channels; ch++) {
+		inverse_steps[ch] = 1.0f / _steps[ch];
+	}
+
+	#pragma omp parallel for schedule(static)
+	for (int i = 0; i < size; i++) {
+		int ch = i % _number_of_channels;
+		float level = floor((p_value[i] - minimums[ch]) * inverse_steps[ch] + 0.5f);
+		p_quantized[i] = (uint8_t)min(max(level, 0.0f), 255.0f);
+	}
+
+	return quantized;
+}
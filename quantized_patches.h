@@ -0,0 +1,121 @@
+/**
+ * Copyright (C) 2015, Vadim Fedorov <vadim.fedorov@upf.edu>
+ * Copyright (C) 2015, Gabriele Facciolo <facciolo@ens-cachan.fr>
+ * Copyright (C) 2015, Pablo Arias <pablo.arias@cmla.ens-cachan.fr>
+ *
+ * This program is free software: you can use, modify and/or
+ * redistribute it under the terms of the simplified BSD
+ * License. You should have received a copy of this license along
+ * this program. If not, see
+ * <http://www.opensource.org/licenses/bsd-license.html>.
+ */
+
+#ifndef QUANTIZED_PATCHES_H_
+#define QUANTIZED_PATCHES_H_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "image.h"
+#include "point.h"
+#include "patch_distance_kernels.h"
+
+using namespace std;
+
+/**
+ * Copies of the source and target images quantized to 16 or 8 bits per value (with a step per channel),
+ * for the patch distances of the search: a row of a patch is 2 or 4 times smaller than in floats. The
+ * quantization steps are folded into the patch weights, so the row sums approximate the sums of the floats.
+ *
+ * @note The copies are made once per initialization of the patch distance, the exact distances
+ *       are calculated on the float images.
+ */
+class QuantizedPatches
+{
+public:
+	/// Precision of the values of the search
+	enum Precision {
+		Float,		// no quantized copies (the float images are used)
+		Int16,		// 65536 levels per channel
+		UInt8		// 256 levels per channel
+	};
+
+	/// Sum calculated over the rows of the patches
+	enum Norm {
+		SquaredDifference,
+		AbsoluteDifference
+	};
+
+	QuantizedPatches();
+	QuantizedPatches(FixedImage<float> source,
+					 FixedImage<float> target,
+					 FixedImage<float> patch_weighting,
+					 Precision precision,
+					 Norm norm);
+
+	bool is_empty() const;
+	Precision get_precision() const;
+	float get_step(int channel) const;
+
+	/// Offsets of the patches centered at the points (the first value of the first row).
+	inline int get_source_offset(const Point &center) const
+	{
+		return _source_stride * (center.y - _radius_y) + _number_of_channels * (center.x - _radius_x);
+	}
+
+	inline int get_target_offset(const Point &center) const
+	{
+		return _target_stride * (center.y - _radius_y) + _number_of_channels * (center.x - _radius_x);
+	}
+
+	/// Weighted sum over the given row of the patches at the offsets.
+	inline float calculate_row(int source_offset, int target_offset, int row) const
+	{
+		const float *weights = &_weights[_weights_stride * row];
+
+		if (_precision == Int16) {
+			return _int16_kernel(_source_int16_values + source_offset + _source_stride * row,
+			                     _target_int16_values + target_offset + _target_stride * row,
+			                     weights,
+			                     _row_length);
+		} else {
+			return _uint8_kernel(_source_uint8_values + source_offset + _source_stride * row,
+			                     _target_uint8_values + target_offset + _target_stride * row,
+			                     weights,
+			                     _row_length);
+		}
+	}
+
+	static bool parse_precision(const string &name, Precision &precision);
+	static const char *get_precision_name(Precision precision);
+
+private:
+	Precision _precision;
+	int _number_of_channels;
+	int _radius_x;
+	int _radius_y;
+	int _row_length;
+	int _weights_stride;		// row length rounded up to a multiple of 8 (see the kernels)
+	int _source_stride;
+	int _target_stride;
+	vector<float> _steps;		// quantization step of every channel
+	vector<float> _weights;		// patch weights repeated for every channel, multiplied by the (squared) steps, zero padded
+	// NOTE: the images are shared by the copies (reference counting), so the pointers stay valid. They have
+	//       one more row, since the kernels read up to 7 values past the last row of a patch.
+	Image<int16_t> _source_int16;
+	Image<int16_t> _target_int16;
+	Image<uint8_t> _source_uint8;
+	Image<uint8_t> _target_uint8;
+	const int16_t *_source_int16_values;
+	const int16_t *_target_int16_values;
+	const uint8_t *_source_uint8_values;
+	const uint8_t *_target_uint8_values;
+	PatchDistanceKernels::Int16RowKernel _int16_kernel;
+	PatchDistanceKernels::UInt8RowKernel _uint8_kernel;
+
+	Image<int16_t> quantize_int16(FixedImage<float> image, const vector<float> &minimums);
+	Image<uint8_t> quantize_uint8(FixedImage<float> image, const vector<float> &minimums);
+};
+
+
+#endif /* QUANTIZED_PATCHES_H_ */
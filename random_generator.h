@@ -0,0 +1,113 @@
+/**
+ * Copyright (C) 2015, Vadim Fedorov <vadim.fedorov@upf.edu>
+ * Copyright (C) 2015, Gabriele Facciolo <facciolo@ens-cachan.fr>
+ * Copyright (C) 2015, Pablo Arias <pablo.arias@cmla.ens-cachan.fr>
+ *
+ * This program is free software: you can use, modify and/or
+ * redistribute it under the terms of the simplified BSD
+ * License. You should have received a copy of this license along
+ * this program. If not, see
+ * <http://www.opensource.org/licenses/bsd-license.html>.
+ */
+
+#ifndef RANDOM_GENERATOR_H_
+#define RANDOM_GENERATOR_H_
+
+#include <stdint.h>
+
+/**
+ * Counter-based pseudo-random number generator: xoshiro128** whose state is
+ * derived (by the splitmix64 mixing) from a key and a counter. Independent
+ * streams are obtained for different counters (e.g. point indices), thus
+ * threads need no shared state and the result does not depend on the order
+ * in which streams are used.
+ *
+ * @note Definitions are in header in order to allow inlining in hot loops.
+ */
+class RandomGenerator
+{
+public:
+	inline RandomGenerator(uint64_t key, uint64_t counter);
+
+	/// Mixes two values into a key (e.g. a seed and a call index).
+	static inline uint64_t mix(uint64_t a, uint64_t b);
+
+	/// Returns the next 32 random bits.
+	inline uint32_t next();
+
+	/// Returns a random integer from the range [0, n), n should be positive.
+	inline int uniform(int n);
+
+private:
+	uint32_t _state[4];
+
+	static inline uint64_t splitmix64(uint64_t &x);
+	static inline uint64_t finalize(uint64_t z);
+	static inline uint32_t rotl(uint32_t x, int k);
+};
+
+
+inline RandomGenerator::RandomGenerator(uint64_t key, uint64_t counter)
+{
+	uint64_t x = key ^ finalize(counter + 0x9E3779B97F4A7C15ULL);
+	uint64_t a = splitmix64(x);
+	uint64_t b = splitmix64(x);
+
+	_state[0] = (uint32_t)a;
+	_state[1] = (uint32_t)(a >> 32);
+	_state[2] = (uint32_t)b;
+	_state[3] = (uint32_t)(b >> 32);
+}
+
+
+inline uint64_t RandomGenerator::mix(uint64_t a, uint64_t b)
+{
+	return finalize(finalize(a) ^ (b + 0x9E3779B97F4A7C15ULL));
+}
+
+
+inline uint32_t RandomGenerator::next()
+{
+	uint32_t result = rotl(_state[1] * 5, 7) * 9;
+	uint32_t t = _state[1] << 9;
+
+	_state[2] ^= _state[0];
+	_state[3] ^= _state[1];
+	_state[1] ^= _state[2];
+	_state[0] ^= _state[3];
+	_state[2] ^= t;
+	_state[3] = rotl(_state[3], 11);
+
+	return result;
+}
+
+
+inline int RandomGenerator::uniform(int n)
+{
+	// NOTE: multiply-shift instead of modulo (the bias is negligible for image sizes)
+	return (int)(((uint64_t)next() * (uint32_t)n) >> 32);
+}
+
+
+inline uint64_t RandomGenerator::splitmix64(uint64_t &x)
+{
+	x += 0x9E3779B97F4A7C15ULL;
+	return finalize(x);
+}
+
+
+inline uint64_t RandomGenerator::finalize(uint64_t z)
+{
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+}
+
+
+inline uint32_t RandomGenerator::rotl(uint32_t x, int k)
+{
+	return (x << k) | (x >> (32 - k));
+}
+
+
+#endif /* RANDOM_GENERATOR_H_ */
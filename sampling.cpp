@@ -11,6 +11,7 @@
  */
 
 #include "sampling.h"
+#include "cpu_dispatch.h"
 #include <cmath>
 #include <cstdlib>
 
@@ -411,20 +412,51 @@ int get_sample_size(uint size, float factor)
 }
 
 
+/**
+ * Convolves the image with the separable filter (symmetric boundary conditions). Each output row is a weighted
+ * sum of (shifted) rows, calculated by the kernels of CpuDispatch, except for the pixels near the left and
+ * the right borders.
+ */
 void separate_convolution(const float *in, float *out, int size_x, int size_y, const float *filter_x, const float *filter_y, int filter_x_size, int filter_y_size)
 {
+	const SimdKernels &kernels = CpuDispatch::get_kernels();
+
 	// initialize temporal buffer
 	float *buffer;
 	buffer = new float[size_x * size_y];
 
+	// NOTE: the terms are summed in the order of the decreasing filter index
+	int max_filter_size = max(filter_x_size, filter_y_size);
+	const float **rows = new const float*[max_filter_size];
+	float *coefficients = new float[max_filter_size];
+
 	float sum;
 	int id;
 
 	// convolution along x axis
 	int radius = (filter_x_size - 1) / 2;
 
+	// pixels whose neighborhood is inside the row
+	int x_begin = filter_x_size - 1 - radius;
+	int x_end = max(x_begin, size_x - radius);
+
+	for (int i = filter_x_size - 1; i >= 0; i--) {
+		coefficients[filter_x_size - 1 - i] = filter_x[i];
+	}
+
 	for (int y = 0; y < size_y; y++) {
+		if (x_begin < x_end) {
+			for (int i = filter_x_size - 1; i >= 0; i--) {
+				rows[filter_x_size - 1 - i] = in + y * size_x + x_begin + radius - i;
+			}
+			kernels.weighted_rows_sum(buffer + y * size_x + x_begin, rows, coefficients, filter_x_size, x_end - x_begin);
+		}
+
 		for (int x = 0;x < size_x; x++) {
+			if (x >= x_begin && x < x_end) {
+				continue;	// calculated above
+			}
+
 			sum = 0.0;
 
 			for (int i = filter_x_size - 1; i >= 0; i--) {
@@ -441,23 +473,25 @@ void separate_convolution(const float *in, float *out, int size_x, int size_y, c
 	// convolution along y axis
 	radius = (filter_y_size - 1) / 2;
 
-	for (int y = 0;y < size_y; y++) {
-		for (int x = 0; x < size_x; x++) {
-			sum = 0.0;
-
-			for (int i = filter_y_size - 1; i >= 0; i--) {
-				id = y + radius - i;
-				id = symmetric_boundary_condition_A(id, size_y);
+	for (int i = filter_y_size - 1; i >= 0; i--) {
+		coefficients[filter_y_size - 1 - i] = filter_y[i];
+	}
 
-				sum += filter_y[i] * buffer[id * size_x + x];
-			}
+	for (int y = 0;y < size_y; y++) {
+		for (int i = filter_y_size - 1; i >= 0; i--) {
+			id = y + radius - i;
+			id = symmetric_boundary_condition_A(id, size_y);
 
-			out[y * size_x + x] = sum;
+			rows[filter_y_size - 1 - i] = buffer + id * size_x;
 		}
+
+		kernels.weighted_rows_sum(out + y * size_x, rows, coefficients, filter_y_size, size_x);
 	}
 
 	// free memory
 	delete [] buffer;
+	delete [] rows;
+	delete [] coefficients;
 }
 
 
@@ -0,0 +1,117 @@
+/**
+ * Copyright (C) 2015, Vadim Fedorov <vadim.fedorov@upf.edu>
+ * Copyright (C) 2015, Gabriele Facciolo <facciolo@ens-cachan.fr>
+ * Copyright (C) 2015, Pablo Arias <pablo.arias@cmla.ens-cachan.fr>
+ *
+ * This program is free software: you can use, modify and/or
+ * redistribute it under the terms of the simplified BSD
+ * License. You should have received a copy of this license along
+ * this program. If not, see
+ * <http://www.opensource.org/licenses/bsd-license.html>.
+ */
+
+#include "scale_context.h"
+
+ScaleContext::ScaleContext()
+{
+	_distance_calculation = 0;
+}
+
+
+/**
+ * Initializes the patch distance for the images and builds the source data.
+ *
+ * @param use_tree Builds the tree of the source patches (see PatchKdTree), e.g. for the initialization of PatchMatch.
+ */
+ScaleContext::ScaleContext(APatchDistance *distance_calculation,
+						   FixedImage<float> source,
+						   FixedMask source_mask,
+						   FixedImage<float> target,
+						   bool use_tree)
+{
+	_distance_calculation = distance_calculation;
+	_source = source;
+	_source_mask = source_mask;
+	_target = target;
+
+	_distance_calculation->initialize(source, target);
+
+	_source_points = source_mask.get_masked_points();
+	_source_index = SourceIndex(source_mask);
+
+	// NOTE: the patch weights are known after the initialization of the distance
+	if (use_tree) {
+		_kd_tree = PatchKdTree(source, source_mask, _distance_calculation->get_patch_weighting());
+	}
+}
+
+
+/**
+ * Refreshes the data of the patch distance calculated from the images, which were modified (in place) only
+ * inside the region. The source points, the index and the tree do not change, since they depend only
+ * on the patches of the source mask, which do not touch the region.
+ */
+void ScaleContext::update(FixedMask modified_region)
+{
+	if (_distance_calculation && modified_region.is_not_empty()) {
+		_distance_calculation->reinitialize(_source, _target, modified_region);
+	}
+}
+
+
+bool ScaleContext::is_empty() const
+{
+	return _distance_calculation == 0;
+}
+
+
+/**
+ * Checks if the context was prepared for the given patch distance, images and mask (compared by reference).
+ */
+bool ScaleContext::is_prepared_for(const APatchDistance *distance_calculation,
+								   FixedImage<float> source,
+								   FixedMask source_mask,
+								   FixedImage<float> target) const
+{
+	return _distance_calculation &&
+		   _distance_calculation == distance_calculation &&
+		   _source == source &&
+		   _source_mask == source_mask &&
+		   _target == target;
+}
+
+
+FixedImage<float> ScaleContext::get_source() const
+{
+	return _source;
+}
+
+
+FixedMask ScaleContext::get_source_mask() const
+{
+	return _source_mask;
+}
+
+
+FixedImage<float> ScaleContext::get_target() const
+{
+	return _target;
+}
+
+
+const vector<Point>& ScaleContext::get_source_points() const
+{
+	return _source_points;
+}
+
+
+const SourceIndex& ScaleContext::get_source_index() const
+{
+	return _source_index;
+}
+
+
+const PatchKdTree& ScaleContext::get_kd_tree() const
+{
+	return _kd_tree;
+}
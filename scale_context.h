@@ -0,0 +1,74 @@
+/**
+ * Copyright (C) 2015, Vadim Fedorov <vadim.fedorov@upf.edu>
+ * Copyright (C) 2015, Gabriele Facciolo <facciolo@ens-cachan.fr>
+ * Copyright (C) 2015, Pablo Arias <pablo.arias@cmla.ens-cachan.fr>
+ *
+ * This program is free software: you can use, modify and/or
+ * redistribute it under the terms of the simplified BSD
+ * License. You should have received a copy of this license along
+ * this program. If not, see
+ * <http://www.opensource.org/licenses/bsd-license.html>.
+ */
+
+#ifndef SCALE_CONTEXT_H_
+#define SCALE_CONTEXT_H_
+
+#include <vector>
+#include "image.h"
+#include "mask.h"
+#include "point.h"
+#include "a_patch_distance.h"
+#include "source_index.h"
+#include "patch_kd_tree.h"
+
+using namespace std;
+
+/**
+ * Data of the source side of the nearest neighbors search prepared once per scale of the inpainting: the
+ * patch distance initialized for the images (e.g. the features or the norms of the patches), the valid
+ * source points, their index and, optionally, the tree of the source patches.
+ *
+ * Within a scale the source mask does not change and excludes all patches touching the inpainting domain,
+ * so the source data stays valid while the image is updated. The owner reports the updated pixels by update(),
+ * the searches (PatchMatch, ExhaustiveSearch) only read the context.
+ *
+ * @note The patch distance should not be initialized for other images while the context is used.
+ */
+class ScaleContext
+{
+public:
+	ScaleContext();
+	ScaleContext(APatchDistance *distance_calculation,
+				 FixedImage<float> source,
+				 FixedMask source_mask,
+				 FixedImage<float> target,
+				 bool use_tree = false);
+
+	// Refreshes the patch distance after the images were modified inside the given region.
+	void update(FixedMask modified_region);
+
+	bool is_empty() const;
+	bool is_prepared_for(const APatchDistance *distance_calculation,
+						 FixedImage<float> source,
+						 FixedMask source_mask,
+						 FixedImage<float> target) const;
+
+	FixedImage<float> get_source() const;
+	FixedMask get_source_mask() const;
+	FixedImage<float> get_target() const;
+	const vector<Point>& get_source_points() const;
+	const SourceIndex& get_source_index() const;
+	const PatchKdTree& get_kd_tree() const;		// NOTE: empty, if the tree was not requested
+
+private:
+	APatchDistance *_distance_calculation;
+	FixedImage<float> _source;
+	FixedMask _source_mask;
+	FixedImage<float> _target;
+	vector<Point> _source_points;
+	SourceIndex _source_index;
+	PatchKdTree _kd_tree;
+};
+
+
+#endif /* SCALE_CONTEXT_H_ */
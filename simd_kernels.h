@@ -0,0 +1,58 @@
+/**
+ * Copyright (C) 2015, Vadim Fedorov <vadim.fedorov@upf.edu>
+ * Copyright (C) 2015, Gabriele Facciolo <facciolo@ens-cachan.fr>
+ * Copyright (C) 2015, Pablo Arias <pablo.arias@cmla.ens-cachan.fr>
+ *
+ * This program is free software: you can use, modify and/or
+ * redistribute it under the terms of the simplified BSD
+ * License. You should have received a copy of this license along
+ * this program. If not, see
+ * <http://www.opensource.org/licenses/bsd-license.html>.
+ */
+
+#ifndef SIMD_KERNELS_H_
+#define SIMD_KERNELS_H_
+
+#include "patch_distance_kernels.h"
+
+/**
+ * Table of the hot kernels compiled for one instruction set. The same implementation
+ * (simd_kernels.hpp) is compiled once per instruction set (simd_kernels_*.cpp, with the
+ * corresponding compiler flags), CpuDispatch selects the table at runtime.
+ */
+struct SimdKernels
+{
+	const char *name;
+	bool is_compiled;	// false, if the compiler flags of the instruction set were not available
+
+	/// patch distances (see PatchDistanceKernels)
+	PatchDistanceKernels::RowKernel squared_difference;
+	PatchDistanceKernels::RowKernel absolute_difference;
+	PatchDistanceKernels::RowKernel (*select_squared_difference)(int patch_side, int number_of_channels, bool is_uniform);
+	PatchDistanceKernels::RowKernel (*select_absolute_difference)(int patch_side, int number_of_channels, bool is_uniform);
+	PatchDistanceKernels::RowKernel (*select_dot_product)(int patch_side, int number_of_channels, bool is_uniform);
+	PatchDistanceKernels::Int16RowKernel (*select_int16_squared_difference)(int patch_side, int number_of_channels);
+	PatchDistanceKernels::Int16RowKernel (*select_int16_absolute_difference)(int patch_side, int number_of_channels);
+	PatchDistanceKernels::UInt8RowKernel (*select_uint8_squared_difference)(int patch_side, int number_of_channels);
+	PatchDistanceKernels::UInt8RowKernel (*select_uint8_absolute_difference)(int patch_side, int number_of_channels);
+
+	/// out[i] += scale * weights[i] * values[i] (accumulation of the weighted patches)
+	void (*weighted_accumulate)(float *out, const float *values, const float *weights, float scale, int length);
+
+	/// out[i] += scale * values[i]
+	void (*scaled_accumulate)(float *out, const float *values, float scale, int length);
+
+	/// out[i] = sum of coefficients[k] * rows[k][i] over k = 0..count-1 (separable convolution)
+	void (*weighted_rows_sum)(float *out, const float * const *rows, const float *coefficients, int count, int length);
+
+	/// Anisotropic laplacian of 'length' consecutive points of a row, none of them on the image border
+	/// (the coefficients of the bottom and right neighbors are at the center, see PatchNonLocalPoisson).
+	void (*anisotropic_laplacian)(const double *image, const double *coefficients, int stride, int length, double *out);
+};
+
+extern const SimdKernels SCALAR_SIMD_KERNELS;
+extern const SimdKernels SSE2_SIMD_KERNELS;
+extern const SimdKernels AVX2_SIMD_KERNELS;
+
+
+#endif /* SIMD_KERNELS_H_ */
@@ -0,0 +1,483 @@
+/**
+ * Copyright (C) 2015, Vadim Fedorov <vadim.fedorov@upf.edu>
+ * Copyright (C) 2015, Gabriele Facciolo <facciolo@ens-cachan.fr>
+ * Copyright (C) 2015, Pablo Arias <pablo.arias@cmla.ens-cachan.fr>
+ *
+ * This program is free software: you can use, modify and/or
+ * redistribute it under the terms of the simplified BSD
+ * License. You should have received a copy of this license along
+ * this program. If not, see
+ * <http://www.opensource.org/licenses/bsd-license.html>.
+ */
+
+/**
+ * Implementation of the kernels of SimdKernels, compiled once per instruction set.
+ * The including file defines SIMD_KERNELS_TABLE (the name of the table), SIMD_KERNELS_NAME
+ * and SIMD_KERNELS_IS_COMPILED, and SIMD_KERNELS_SCALAR for the scalar reference kernels.
+ *
+ * @note Everything here has internal linkage and no inline functions of other headers are
+ *       used: otherwise the linker could pick a copy compiled for a newer instruction set
+ *       for the code running on an older CPU.
+ */
+
+#include "simd_kernels.h"
+#include <math.h>
+#include <string.h>
+
+#if defined(__AVX2__) && !defined(SIMD_KERNELS_SCALAR)
+#include <immintrin.h>
+#elif defined(__SSE2__) && !defined(SIMD_KERNELS_SCALAR)
+#include <emmintrin.h>
+#endif
+
+#if defined(__AVX2__) && !defined(SIMD_KERNELS_SCALAR)
+
+static inline float horizontal_sum(__m256 values)
+{
+	__m128 sum = _mm_add_ps(_mm256_castps256_ps128(values), _mm256_extractf128_ps(values, 1));
+	sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+	sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+	return _mm_cvtss_f32(sum);
+}
+
+// 8 quantized values converted to floats
+static inline __m256 load_as_float(const int16_t *values)
+{
+	return _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)values)));
+}
+
+static inline __m256 load_as_float(const uint8_t *values)
+{
+	return _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)values)));
+}
+
+#elif defined(__SSE2__) && !defined(SIMD_KERNELS_SCALAR)
+
+static inline float horizontal_sum(__m128 values)
+{
+	__m128 sum = _mm_add_ps(values, _mm_movehl_ps(values, values));
+	sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+	return _mm_cvtss_f32(sum);
+}
+
+// 4 quantized values converted to floats
+static inline __m128 load_as_float(const int16_t *values)
+{
+	__m128i packed = _mm_loadl_epi64((const __m128i *)values);
+	return _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(packed, packed), 16));
+}
+
+static inline __m128 load_as_float(const uint8_t *values)
+{
+	int32_t bytes;
+	memcpy(&bytes, values, sizeof(bytes));
+	__m128i zero = _mm_setzero_si128();
+	return _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(bytes), zero), zero));
+}
+
+#endif
+
+
+/**
+ * Sum of weights[i] * (a[i] - b[i])^2. The length is either given at compile time (LENGTH > 0, the loops are
+ * unrolled) or at runtime (LENGTH = 0). Uniform weights are all equal to weights[0] (multiplied only once).
+ */
+template <int LENGTH, bool UNIFORM>
+static inline float squared_difference(const float *a, const float *b, const float *weights, int length)
+{
+	const int n = (LENGTH > 0) ? LENGTH : length;
+	float sum = 0.0f;
+	int i = 0;
+
+#if defined(__AVX2__) && !defined(SIMD_KERNELS_SCALAR)
+	__m256 accumulator = _mm256_setzero_ps();
+	for (; i + 8 <= n; i += 8) {
+		__m256 difference = _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+		__m256 weighted = UNIFORM ? difference : _mm256_mul_ps(_mm256_loadu_ps(weights + i), difference);
+#if defined(__FMA__)
+		accumulator = _mm256_fmadd_ps(weighted, difference, accumulator);
+#else
+		accumulator = _mm256_add_ps(accumulator, _mm256_mul_ps(weighted, difference));
+#endif
+	}
+	sum = horizontal_sum(accumulator);
+#elif defined(__SSE2__) && !defined(SIMD_KERNELS_SCALAR)
+	__m128 accumulator = _mm_setzero_ps();
+	for (; i + 4 <= n; i += 4) {
+		__m128 difference = _mm_sub_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i));
+		__m128 weighted = UNIFORM ? difference : _mm_mul_ps(_mm_loadu_ps(weights + i), difference);
+		accumulator = _mm_add_ps(accumulator, _mm_mul_ps(weighted, difference));
+	}
+	sum = horizontal_sum(accumulator);
+#endif
+
+	for (; i < n; i++) {
+		float difference = a[i] - b[i];
+		sum += (UNIFORM ? 1.0f : weights[i]) * difference * difference;
+	}
+
+	return UNIFORM ? weights[0] * sum : sum;
+}
+
+
+/**
+ * Sum of weights[i] * a[i] * b[i] (see squared_difference() for the template parameters).
+ */
+template <int LENGTH, bool UNIFORM>
+static inline float dot_product(const float *a, const float *b, const float *weights, int length)
+{
+	const int n = (LENGTH > 0) ? LENGTH : length;
+	float sum = 0.0f;
+	int i = 0;
+
+#if defined(__AVX2__) && !defined(SIMD_KERNELS_SCALAR)
+	__m256 accumulator = _mm256_setzero_ps();
+	for (; i + 8 <= n; i += 8) {
+		__m256 product = UNIFORM ? _mm256_loadu_ps(a + i) : _mm256_mul_ps(_mm256_loadu_ps(weights + i), _mm256_loadu_ps(a + i));
+#if defined(__FMA__)
+		accumulator = _mm256_fmadd_ps(product, _mm256_loadu_ps(b + i), accumulator);
+#else
+		accumulator = _mm256_add_ps(accumulator, _mm256_mul_ps(product, _mm256_loadu_ps(b + i)));
+#endif
+	}
+	sum = horizontal_sum(accumulator);
+#elif defined(__SSE2__) && !defined(SIMD_KERNELS_SCALAR)
+	__m128 accumulator = _mm_setzero_ps();
+	for (; i + 4 <= n; i += 4) {
+		__m128 product = UNIFORM ? _mm_loadu_ps(a + i) : _mm_mul_ps(_mm_loadu_ps(weights + i), _mm_loadu_ps(a + i));
+		accumulator = _mm_add_ps(accumulator, _mm_mul_ps(product, _mm_loadu_ps(b + i)));
+	}
+	sum = horizontal_sum(accumulator);
+#endif
+
+	for (; i < n; i++) {
+		sum += (UNIFORM ? 1.0f : weights[i]) * a[i] * b[i];
+	}
+
+	return UNIFORM ? weights[0] * sum : sum;
+}
+
+
+/**
+ * Sum of weights[i] * |a[i] - b[i]| (see squared_difference() for the template parameters).
+ */
+template <int LENGTH, bool UNIFORM>
+static inline float absolute_difference(const float *a, const float *b, const float *weights, int length)
+{
+	const int n = (LENGTH > 0) ? LENGTH : length;
+	float sum = 0.0f;
+	int i = 0;
+
+#if defined(__AVX2__) && !defined(SIMD_KERNELS_SCALAR)
+	// NOTE: the absolute value clears the sign bit
+	const __m256 sign_mask = _mm256_set1_ps(-0.0f);
+	__m256 accumulator = _mm256_setzero_ps();
+	for (; i + 8 <= n; i += 8) {
+		__m256 difference = _mm256_andnot_ps(sign_mask, _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+		if (UNIFORM) {
+			accumulator = _mm256_add_ps(accumulator, difference);
+		} else {
+#if defined(__FMA__)
+			accumulator = _mm256_fmadd_ps(_mm256_loadu_ps(weights + i), difference, accumulator);
+#else
+			accumulator = _mm256_add_ps(accumulator, _mm256_mul_ps(_mm256_loadu_ps(weights + i), difference));
+#endif
+		}
+	}
+	sum = horizontal_sum(accumulator);
+#elif defined(__SSE2__) && !defined(SIMD_KERNELS_SCALAR)
+	const __m128 sign_mask = _mm_set1_ps(-0.0f);
+	__m128 accumulator = _mm_setzero_ps();
+	for (; i + 4 <= n; i += 4) {
+		__m128 difference = _mm_andnot_ps(sign_mask, _mm_sub_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+		accumulator = _mm_add_ps(accumulator, UNIFORM ? difference : _mm_mul_ps(_mm_loadu_ps(weights + i), difference));
+	}
+	sum = horizontal_sum(accumulator);
+#endif
+
+	for (; i < n; i++) {
+		sum += (UNIFORM ? 1.0f : weights[i]) * fabs(a[i] - b[i]);
+	}
+
+	return UNIFORM ? weights[0] * sum : sum;
+}
+
+
+/**
+ * Sum of weights[i] * (a[i] - b[i])^2 over the quantized values (int16_t or uint8_t). The values are converted to
+ * floats (exactly), the quantization steps are in the weights. See squared_difference() for LENGTH.
+ *
+ * @note The length is rounded up to a multiple of 8 (no scalar remainder): the weights are padded with zeros
+ *       and the values may be read past the row (see QuantizedPatches).
+ */
+template <typename T, int LENGTH>
+static inline float quantized_squared_difference(const T *a, const T *b, const float *weights, int length)
+{
+	const int n = (LENGTH > 0) ? LENGTH : length;
+	float sum = 0.0f;
+	int i = 0;
+
+#if defined(__AVX2__) && !defined(SIMD_KERNELS_SCALAR)
+	__m256 accumulator = _mm256_setzero_ps();
+	for (; i < n; i += 8) {
+		__m256 difference = _mm256_sub_ps(load_as_float(a + i), load_as_float(b + i));
+		__m256 weighted = _mm256_mul_ps(_mm256_loadu_ps(weights + i), difference);
+#if defined(__FMA__)
+		accumulator = _mm256_fmadd_ps(weighted, difference, accumulator);
+#else
+		accumulator = _mm256_add_ps(accumulator, _mm256_mul_ps(weighted, difference));
+#endif
+	}
+	sum = horizontal_sum(accumulator);
+#elif defined(__SSE2__) && !defined(SIMD_KERNELS_SCALAR)
+	__m128 accumulator = _mm_setzero_ps();
+	for (; i < n; i += 4) {
+		__m128 difference = _mm_sub_ps(load_as_float(a + i), load_as_float(b + i));
+		__m128 weighted = _mm_mul_ps(_mm_loadu_ps(weights + i), difference);
+		accumulator = _mm_add_ps(accumulator, _mm_mul_ps(weighted, difference));
+	}
+	sum = horizontal_sum(accumulator);
+#endif
+
+	for (; i < n; i++) {
+		float difference = (float)a[i] - (float)b[i];
+		sum += weights[i] * difference * difference;
+	}
+
+	return sum;
+}
+
+
+/**
+ * Sum of weights[i] * |a[i] - b[i]| over the quantized values (see quantized_squared_difference(), also for the padding).
+ */
+template <typename T, int LENGTH>
+static inline float quantized_absolute_difference(const T *a, const T *b, const float *weights, int length)
+{
+	const int n = (LENGTH > 0) ? LENGTH : length;
+	float sum = 0.0f;
+	int i = 0;
+
+#if defined(__AVX2__) && !defined(SIMD_KERNELS_SCALAR)
+	const __m256 sign_mask = _mm256_set1_ps(-0.0f);
+	__m256 accumulator = _mm256_setzero_ps();
+	for (; i < n; i += 8) {
+		__m256 difference = _mm256_andnot_ps(sign_mask, _mm256_sub_ps(load_as_float(a + i), load_as_float(b + i)));
+#if defined(__FMA__)
+		accumulator = _mm256_fmadd_ps(_mm256_loadu_ps(weights + i), difference, accumulator);
+#else
+		accumulator = _mm256_add_ps(accumulator, _mm256_mul_ps(_mm256_loadu_ps(weights + i), difference));
+#endif
+	}
+	sum = horizontal_sum(accumulator);
+#elif defined(__SSE2__) && !defined(SIMD_KERNELS_SCALAR)
+	const __m128 sign_mask = _mm_set1_ps(-0.0f);
+	__m128 accumulator = _mm_setzero_ps();
+	for (; i < n; i += 4) {
+		__m128 difference = _mm_andnot_ps(sign_mask, _mm_sub_ps(load_as_float(a + i), load_as_float(b + i)));
+		accumulator = _mm_add_ps(accumulator, _mm_mul_ps(_mm_loadu_ps(weights + i), difference));
+	}
+	sum = horizontal_sum(accumulator);
+#endif
+
+	for (; i < n; i++) {
+		sum += weights[i] * fabs((float)a[i] - (float)b[i]);
+	}
+
+	return sum;
+}
+
+
+// NOTE: returns the kernel specialized for the row length, if the patch side and the number of channels match
+#define SELECT_KERNEL(KERNEL, SIDE, CHANNELS) \
+	if (patch_side == SIDE && number_of_channels == CHANNELS) { \
+		return is_uniform ? &KERNEL<SIDE * CHANNELS, true> : &KERNEL<SIDE * CHANNELS, false>; \
+	}
+
+#define SELECT_KERNEL_SIDES(KERNEL, CHANNELS) \
+	SELECT_KERNEL(KERNEL, 5, CHANNELS) \
+	SELECT_KERNEL(KERNEL, 7, CHANNELS) \
+	SELECT_KERNEL(KERNEL, 9, CHANNELS) \
+	SELECT_KERNEL(KERNEL, 11, CHANNELS) \
+	SELECT_KERNEL(KERNEL, 13, CHANNELS)
+
+
+/**
+ * Selects the squared difference kernel for the rows of patches of the given side (patch sides 5, 7, 9, 11, 13
+ * and 1, 2, 3, 6 or 9 channels are specialized; 2 and 6 are the channels of the gradients of 1 and 3 channel images,
+ * 9 the channels of the stacked features of 3 channel images, see FeaturePlanes).
+ *
+ * @param is_uniform If true, all weights are assumed to be equal to the first one.
+ */
+static PatchDistanceKernels::RowKernel select_squared_difference(int patch_side, int number_of_channels, bool is_uniform)
+{
+	SELECT_KERNEL_SIDES(squared_difference, 1)
+	SELECT_KERNEL_SIDES(squared_difference, 2)
+	SELECT_KERNEL_SIDES(squared_difference, 3)
+	SELECT_KERNEL_SIDES(squared_difference, 6)
+	SELECT_KERNEL_SIDES(squared_difference, 9)
+
+	return is_uniform ? &squared_difference<0, true> : &squared_difference<0, false>;
+}
+
+
+/**
+ * Selects the dot product kernel for the rows of patches of the given side (specialized as the squared difference).
+ *
+ * @param is_uniform If true, all weights are assumed to be equal to the first one.
+ */
+static PatchDistanceKernels::RowKernel select_dot_product(int patch_side, int number_of_channels, bool is_uniform)
+{
+	SELECT_KERNEL_SIDES(dot_product, 1)
+	SELECT_KERNEL_SIDES(dot_product, 2)
+	SELECT_KERNEL_SIDES(dot_product, 3)
+	SELECT_KERNEL_SIDES(dot_product, 6)
+
+	return is_uniform ? &dot_product<0, true> : &dot_product<0, false>;
+}
+
+
+/**
+ * Selects the absolute difference kernel for the rows of patches of the given side (patch sides 5, 7, 9, 11, 13
+ * and 1 or 3 channels are specialized).
+ *
+ * @param is_uniform If true, all weights are assumed to be equal to the first one.
+ */
+static PatchDistanceKernels::RowKernel select_absolute_difference(int patch_side, int number_of_channels, bool is_uniform)
+{
+	SELECT_KERNEL_SIDES(absolute_difference, 1)
+	SELECT_KERNEL_SIDES(absolute_difference, 3)
+
+	return is_uniform ? &absolute_difference<0, true> : &absolute_difference<0, false>;
+}
+
+#undef SELECT_KERNEL_SIDES
+#undef SELECT_KERNEL
+
+
+// NOTE: same as SELECT_KERNEL for the quantized kernels (the weights are never uniform, they contain the quantization steps)
+#define SELECT_QUANTIZED_KERNEL(KERNEL, TYPE, SIDE, CHANNELS) \
+	if (patch_side == SIDE && number_of_channels == CHANNELS) { \
+		return &KERNEL<TYPE, SIDE * CHANNELS>; \
+	}
+
+#define SELECT_QUANTIZED_KERNEL_SIDES(KERNEL, TYPE, CHANNELS) \
+	SELECT_QUANTIZED_KERNEL(KERNEL, TYPE, 5, CHANNELS) \
+	SELECT_QUANTIZED_KERNEL(KERNEL, TYPE, 7, CHANNELS) \
+	SELECT_QUANTIZED_KERNEL(KERNEL, TYPE, 9, CHANNELS) \
+	SELECT_QUANTIZED_KERNEL(KERNEL, TYPE, 11, CHANNELS) \
+	SELECT_QUANTIZED_KERNEL(KERNEL, TYPE, 13, CHANNELS)
+
+
+/**
+ * Selects the quantized squared difference kernels for the rows of patches of the given side (specialized as
+ * the squared difference).
+ */
+static PatchDistanceKernels::Int16RowKernel select_int16_squared_difference(int patch_side, int number_of_channels)
+{
+	SELECT_QUANTIZED_KERNEL_SIDES(quantized_squared_difference, int16_t, 1)
+	SELECT_QUANTIZED_KERNEL_SIDES(quantized_squared_difference, int16_t, 2)
+	SELECT_QUANTIZED_KERNEL_SIDES(quantized_squared_difference, int16_t, 3)
+	SELECT_QUANTIZED_KERNEL_SIDES(quantized_squared_difference, int16_t, 6)
+
+	return &quantized_squared_difference<int16_t, 0>;
+}
+
+
+static PatchDistanceKernels::UInt8RowKernel select_uint8_squared_difference(int patch_side, int number_of_channels)
+{
+	SELECT_QUANTIZED_KERNEL_SIDES(quantized_squared_difference, uint8_t, 1)
+	SELECT_QUANTIZED_KERNEL_SIDES(quantized_squared_difference, uint8_t, 2)
+	SELECT_QUANTIZED_KERNEL_SIDES(quantized_squared_difference, uint8_t, 3)
+	SELECT_QUANTIZED_KERNEL_SIDES(quantized_squared_difference, uint8_t, 6)
+
+	return &quantized_squared_difference<uint8_t, 0>;
+}
+
+
+/**
+ * Selects the quantized absolute difference kernels for the rows of patches of the given side (specialized as
+ * the absolute difference).
+ */
+static PatchDistanceKernels::Int16RowKernel select_int16_absolute_difference(int patch_side, int number_of_channels)
+{
+	SELECT_QUANTIZED_KERNEL_SIDES(quantized_absolute_difference, int16_t, 1)
+	SELECT_QUANTIZED_KERNEL_SIDES(quantized_absolute_difference, int16_t, 3)
+
+	return &quantized_absolute_difference<int16_t, 0>;
+}
+
+
+static PatchDistanceKernels::UInt8RowKernel select_uint8_absolute_difference(int patch_side, int number_of_channels)
+{
+	SELECT_QUANTIZED_KERNEL_SIDES(quantized_absolute_difference, uint8_t, 1)
+	SELECT_QUANTIZED_KERNEL_SIDES(quantized_absolute_difference, uint8_t, 3)
+
+	return &quantized_absolute_difference<uint8_t, 0>;
+}
+
+#undef SELECT_QUANTIZED_KERNEL_SIDES
+#undef SELECT_QUANTIZED_KERNEL
+
+
+static void weighted_accumulate(float *out, const float *values, const float *weights, float scale, int length)
+{
+	for (int i = 0; i < length; i++) {
+		out[i] += scale * weights[i] * values[i];
+	}
+}
+
+
+static void scaled_accumulate(float *out, const float *values, float scale, int length)
+{
+	for (int i = 0; i < length; i++) {
+		out[i] += scale * values[i];
+	}
+}
+
+
+static void weighted_rows_sum(float *out, const float * const *rows, const float *coefficients, int count, int length)
+{
+	for (int i = 0; i < length; i++) {
+		out[i] = 0.0f;
+	}
+
+	for (int k = 0; k < count; k++) {
+		const float *row = rows[k];
+		float coefficient = coefficients[k];
+		for (int i = 0; i < length; i++) {
+			out[i] += coefficient * row[i];
+		}
+	}
+}
+
+
+static void anisotropic_laplacian(const double *image, const double *coefficients, int stride, int length, double *out)
+{
+	for (int i = 0; i < length; i++) {
+		double a_top = coefficients[i - stride];
+		double a_left = coefficients[i - 1];
+		double a_center = coefficients[i];	// of the bottom and the right neighbors
+		out[i] = image[i - stride] * a_top + image[i - 1] * a_left + image[i + stride] * a_center + image[i + 1] * a_center -
+					image[i] * (a_top + a_left + a_center + a_center);
+	}
+}
+
+
+extern const SimdKernels SIMD_KERNELS_TABLE = {
+	SIMD_KERNELS_NAME,
+	SIMD_KERNELS_IS_COMPILED,
+	&squared_difference<0, false>,
+	&absolute_difference<0, false>,
+	&select_squared_difference,
+	&select_absolute_difference,
+	&select_dot_product,
+	&select_int16_squared_difference,
+	&select_int16_absolute_difference,
+	&select_uint8_squared_difference,
+	&select_uint8_absolute_difference,
+	&weighted_accumulate,
+	&scaled_accumulate,
+	&weighted_rows_sum,
+	&anisotropic_laplacian
+};
@@ -0,0 +1,19 @@
+/**
+ * Copyright (C) 2015, Vadim Fedorov <vadim.fedorov@upf.edu>
+ * Copyright (C) 2015, Gabriele Facciolo <facciolo@ens-cachan.fr>
+ * Copyright (C) 2015, Pablo Arias <pablo.arias@cmla.ens-cachan.fr>
+ *
+ * This program is free software: you can use, modify and/or
+ * redistribute it under the terms of the simplified BSD
+ * License. You should have received a copy of this license along
+ * this program. If not, see
+ * <http://www.opensource.org/licenses/bsd-license.html>.
+ */
+
+// Reference kernels: no vector instructions are used explicitly (nor generated by the compiler, see CMakeLists.txt)
+#define SIMD_KERNELS_SCALAR
+#define SIMD_KERNELS_TABLE SCALAR_SIMD_KERNELS
+#define SIMD_KERNELS_NAME "scalar"
+#define SIMD_KERNELS_IS_COMPILED true
+
+#include "simd_kernels.hpp"
@@ -0,0 +1,22 @@
+/**
+ * Copyright (C) 2015, Vadim Fedorov <vadim.fedorov@upf.edu>
+ * Copyright (C) 2015, Gabriele Facciolo <facciolo@ens-cachan.fr>
+ * Copyright (C) 2015, Pablo Arias <pablo.arias@cmla.ens-cachan.fr>
+ *
+ * This program is free software: you can use, modify and/or
+ * redistribute it under the terms of the simplified BSD
+ * License. You should have received a copy of this license along
+ * this program. If not, see
+ * <http://www.opensource.org/licenses/bsd-license.html>.
+ */
+
+// Kernels of the SSE2 instruction set (compiled with the corresponding flags, see CMakeLists.txt)
+#define SIMD_KERNELS_TABLE SSE2_SIMD_KERNELS
+#define SIMD_KERNELS_NAME "sse2"
+#if defined(__SSE2__)
+#define SIMD_KERNELS_IS_COMPILED true
+#else
+#define SIMD_KERNELS_IS_COMPILED false
+#endif
+
+#include "simd_kernels.hpp"
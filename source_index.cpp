@@ -0,0 +1,108 @@
+/**
+ * Copyright (C) 2015, Vadim Fedorov <vadim.fedorov@upf.edu>
+ * Copyright (C) 2015, Gabriele Facciolo <facciolo@ens-cachan.fr>
+ * Copyright (C) 2015, Pablo Arias <pablo.arias@cmla.ens-cachan.fr>
+ *
+ * This program is free software: you can use, modify and/or
+ * redistribute it under the terms of the simplified BSD
+ * License. You should have received a copy of this license along
+ * this program. If not, see
+ * <http://www.opensource.org/licenses/bsd-license.html>.
+ */
+
+#include "source_index.h"
+
+SourceIndex::SourceIndex()
+{
+	_table_size_x = 0;
+}
+
+
+/**
+ * Builds the summed-area table of the mask.
+ */
+SourceIndex::SourceIndex(FixedMask mask)
+{
+	_mask = mask;
+
+	int size_x = mask.get_size_x();
+	int size_y = mask.get_size_y();
+	_table_size_x = size_x + 1;
+	_table.assign(_table_size_x * (size_y + 1), 0);
+
+	for (int y = 0; y < size_y; y++) {
+		int row_count = 0;
+		for (int x = 0; x < size_x; x++) {
+			if (mask.test(x, y)) {
+				row_count++;
+			}
+			_table[_table_size_x * (y + 1) + x + 1] = _table[_table_size_x * y + x + 1] + row_count;
+		}
+	}
+}
+
+
+bool SourceIndex::is_empty() const
+{
+	return _table.empty();
+}
+
+
+FixedMask SourceIndex::get_mask() const
+{
+	return _mask;
+}
+
+
+int SourceIndex::count(int x_min, int y_min, int x_max, int y_max) const
+{
+	if (x_min >= x_max || y_min >= y_max) {
+		return 0;
+	}
+
+	return at(x_max, y_max) - at(x_min, y_max) - at(x_max, y_min) + at(x_min, y_min);
+}
+
+
+/**
+ * Finds the row of the k-th point by the binary search over the counts of the window's upper part,
+ * then finds the column by the binary search over the counts of the row's left part.
+ */
+Point SourceIndex::sample(int x_min, int y_min, int x_max, int y_max, int k) const
+{
+	// smallest row y such that [x_min, x_max) x [y_min, y + 1) contains more than k points
+	int low = y_min;
+	int high = y_max - 1;
+	while (low < high) {
+		int middle = (low + high) / 2;
+		if (count(x_min, y_min, x_max, middle + 1) > k) {
+			high = middle;
+		} else {
+			low = middle + 1;
+		}
+	}
+	int y = low;
+	k -= count(x_min, y_min, x_max, y);
+
+	// smallest column x such that [x_min, x + 1) x [y, y + 1) contains more than k points
+	low = x_min;
+	high = x_max - 1;
+	while (low < high) {
+		int middle = (low + high) / 2;
+		if (count(x_min, y, middle + 1, y + 1) > k) {
+			high = middle;
+		} else {
+			low = middle + 1;
+		}
+	}
+
+	return Point(low, y);
+}
+
+
+/* Private */
+
+inline int SourceIndex::at(int x, int y) const
+{
+	return _table[_table_size_x * y + x];
+}
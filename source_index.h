@@ -0,0 +1,54 @@
+/**
+ * Copyright (C) 2015, Vadim Fedorov <vadim.fedorov@upf.edu>
+ * Copyright (C) 2015, Gabriele Facciolo <facciolo@ens-cachan.fr>
+ * Copyright (C) 2015, Pablo Arias <pablo.arias@cmla.ens-cachan.fr>
+ *
+ * This program is free software: you can use, modify and/or
+ * redistribute it under the terms of the simplified BSD
+ * License. You should have received a copy of this license along
+ * this program. If not, see
+ * <http://www.opensource.org/licenses/bsd-license.html>.
+ */
+
+#ifndef SOURCE_INDEX_H_
+#define SOURCE_INDEX_H_
+
+#include <vector>
+#include "mask.h"
+#include "point.h"
+
+using namespace std;
+
+/**
+ * Index of the valid points of a mask (a summed-area table of the masked points).
+ * Counts the valid points inside any rectangular window in O(1) and draws the
+ * k-th valid point of the window (in scanline order) in O(log(size_x) + log(size_y)).
+ *
+ * @note Windows are given as half-open ranges [x_min, x_max) x [y_min, y_max).
+ */
+class SourceIndex
+{
+public:
+	SourceIndex();
+	SourceIndex(FixedMask mask);
+
+	bool is_empty() const;
+	FixedMask get_mask() const;
+
+	/// Number of valid points in the window.
+	int count(int x_min, int y_min, int x_max, int y_max) const;
+
+	/// Returns the k-th valid point of the window, 0 <= k < count(x_min, y_min, x_max, y_max).
+	Point sample(int x_min, int y_min, int x_max, int y_max, int k) const;
+
+private:
+	FixedMask _mask;
+	int _table_size_x;
+	// _table[(size_x + 1) * y + x] is the number of valid points in [0, x) x [0, y)
+	vector<int> _table;
+
+	inline int at(int x, int y) const;
+};
+
+
+#endif /* SOURCE_INDEX_H_ */
@@ -0,0 +1,220 @@
+/**
+ * Copyright (C) 2015, Vadim Fedorov <vadim.fedorov@upf.edu>
+ * Copyright (C) 2015, Gabriele Facciolo <facciolo@ens-cachan.fr>
+ * Copyright (C) 2015, Pablo Arias <pablo.arias@cmla.ens-cachan.fr>
+ *
+ * This program is free software: you can use, modify and/or
+ * redistribute it under the terms of the simplified BSD
+ * License. You should have received a copy of this license along
+ * this program. If not, see
+ * <http://www.opensource.org/licenses/bsd-license.html>.
+ */
+
+#include "sparse_patches.h"
+#include <algorithm>
+#include "a_patch_distance.h"	// NOTE: for the check of the uniform weights
+
+SparsePatches::SparsePatches()
+{
+	_stride = 1;
+	_number_of_channels = 0;
+	_radius_x = 0;
+	_radius_y = 0;
+	_rows_count = 0;
+	_row_length = 0;
+	_kernel = 0;
+	_original_values = 0;
+	_original_stride = 0;
+	_source_values = 0;
+	_target_values = 0;
+	_source_block_x = 0;
+	_source_block_y = 0;
+	_target_block_x = 0;
+	_target_block_y = 0;
+	_source_stride = 0;
+	_target_stride = 0;
+}
+
+
+/**
+ * Copies the values of the images (with interleaved channels) into the polyphase blocks.
+ *
+ * @param stride Step of the lattice (1 gives an empty object).
+ */
+SparsePatches::SparsePatches(FixedImage<float> source,
+							 FixedImage<float> target,
+							 FixedImage<float> patch_weighting,
+							 int stride,
+							 QuantizedPatches::Norm norm)
+{
+	int number_of_channels = source.get_number_of_channels();
+	*this = SparsePatches(source.raw(), number_of_channels * source.get_size_x(),
+						  target.raw(), number_of_channels * target.get_size_x(),
+						  source.get_size(), target.get_size(),
+						  number_of_channels, patch_weighting, stride, norm);
+}
+
+
+/**
+ * Copies the interleaved values (e.g. the features of the images) into the polyphase blocks. The target
+ * values are shared with the source ones, if the pointers are the same.
+ *
+ * @param source_stride Number of values per row.
+ * @param stride Step of the lattice (1 gives an empty object).
+ * @note The source values are not copied again, they should stay valid for refresh().
+ */
+SparsePatches::SparsePatches(const float *source_values,
+							 int source_stride,
+							 const float *target_values,
+							 int target_stride,
+							 Shape source_size,
+							 Shape target_size,
+							 int number_of_channels,
+							 FixedImage<float> patch_weighting,
+							 int stride,
+							 QuantizedPatches::Norm norm)
+{
+	*this = SparsePatches();
+	if (stride <= 1) {
+		return;
+	}
+
+	_stride = stride;
+	_number_of_channels = number_of_channels;
+	_original_values = source_values;
+	_original_stride = source_stride;
+	_source_size = source_size;
+	initialize(patch_weighting, norm);
+
+	_source_copy = allocate(source_size, _source_block_x, _source_block_y);
+	copy(source_values, source_stride, _source_copy, _source_block_x, _source_block_y, 0, 0, source_size.size_x, source_size.size_y);
+	if (target_values == source_values) {
+		_target_copy = _source_copy;
+		_target_block_x = _source_block_x;
+		_target_block_y = _source_block_y;
+	} else {
+		_target_copy = allocate(target_size, _target_block_x, _target_block_y);
+		copy(target_values, target_stride, _target_copy, _target_block_x, _target_block_y, 0, 0, target_size.size_x, target_size.size_y);
+	}
+
+	_source_values = _source_copy.raw();
+	_target_values = _target_copy.raw();
+	_source_stride = _number_of_channels * _source_copy.get_size_x();
+	_target_stride = _number_of_channels * _target_copy.get_size_x();
+}
+
+
+/**
+ * Copies the source values in the bounding box of the region extended by the margin again.
+ *
+ * @note The copies are shared by the copies of the object (and by the target, if it is the source).
+ */
+void SparsePatches::refresh(FixedMask modified_region, int margin)
+{
+	Point top_left = modified_region.bounding_box_top_left();
+	Point bottom_right = modified_region.bounding_box_bottom_right();
+	if (is_empty() || top_left.x < 0) {
+		return;
+	}
+
+	int x_begin = max(top_left.x - margin, 0);
+	int y_begin = max(top_left.y - margin, 0);
+	int x_end = min(bottom_right.x + margin + 1, (int)_source_size.size_x);
+	int y_end = min(bottom_right.y + margin + 1, (int)_source_size.size_y);
+	copy(_original_values, _original_stride, _source_copy, _source_block_x, _source_block_y, x_begin, y_begin, x_end, y_end);
+}
+
+
+bool SparsePatches::is_empty() const
+{
+	return _source_values == 0;
+}
+
+
+int SparsePatches::get_stride() const
+{
+	return _stride;
+}
+
+
+/* Private */
+
+/**
+ * Selects the pixels of the lattice (symmetric around the center of the patch) and scales their weights by
+ * (sum of the weights) / (sum of the lattice weights * patch area).
+ */
+void SparsePatches::initialize(FixedImage<float> patch_weighting, QuantizedPatches::Norm norm)
+{
+	int size_x = patch_weighting.get_size_x();
+	int size_y = patch_weighting.get_size_y();
+	const float *weights = patch_weighting.raw();
+
+	_radius_x = (size_x / 2) / _stride;
+	_radius_y = (size_y / 2) / _stride;
+	_rows_count = 2 * _radius_y + 1;
+	_row_length = _number_of_channels * (2 * _radius_x + 1);
+
+	float weights_sum = 0.0f;
+	for (int i = 0; i < size_x * size_y; i++) {
+		weights_sum += weights[i];
+	}
+
+	float lattice_weights_sum = 0.0f;
+	_weights.resize(_row_length * _rows_count);
+	for (int j = 0; j < _rows_count; j++) {
+		for (int i = 0; i <= 2 * _radius_x; i++) {
+			float weight = weights[size_x * (size_y / 2 + _stride * (j - _radius_y)) + size_x / 2 + _stride * (i - _radius_x)];
+			lattice_weights_sum += weight;
+			for (int ch = 0; ch < _number_of_channels; ch++) {
+				_weights[_row_length * j + _number_of_channels * i + ch] = weight;
+			}
+		}
+	}
+
+	float factor = weights_sum / (lattice_weights_sum * size_x * size_y);
+	for (uint i = 0; i < _weights.size(); i++) {
+		_weights[i] *= factor;
+	}
+
+	bool is_uniform = (size_x * size_y == 1) || APatchDistance::is_uniform(patch_weighting);
+	if (norm == QuantizedPatches::AbsoluteDifference) {
+		_kernel = PatchDistanceKernels::select_absolute_difference(2 * _radius_x + 1, _number_of_channels, is_uniform);
+	} else {
+		_kernel = PatchDistanceKernels::select_squared_difference(2 * _radius_x + 1, _number_of_channels, is_uniform);
+	}
+}
+
+
+/**
+ * Allocates the copy of an image of the given size: stride x stride blocks of the given size.
+ */
+Image<float> SparsePatches::allocate(Shape size, int &block_x, int &block_y) const
+{
+	block_x = (size.size_x + _stride - 1) / _stride;
+	block_y = (size.size_y + _stride - 1) / _stride;
+	return Image<float>(_stride * block_x, _stride * block_y, (uint)_number_of_channels, 0.0f);
+}
+
+
+/**
+ * Copies the pixel (x, y) of the values to the pixel (x / stride, y / stride) of the block (x % stride, y % stride)
+ * for the pixels in [x_begin, x_end) x [y_begin, y_end).
+ */
+void SparsePatches::copy(const float *values, int values_stride, Image<float> &copy, int block_x, int block_y,
+						 int x_begin, int y_begin, int x_end, int y_end) const
+{
+	float *copy_values = copy.raw();
+	int copy_stride = _number_of_channels * copy.get_size_x();
+
+	#pragma omp parallel for schedule(static)
+	for (int y = y_begin; y < y_end; y++) {
+		const float *row = values + values_stride * y;
+		float *copy_row = copy_values + copy_stride * (block_y * (y % _stride) + y / _stride);
+		for (int x = x_begin; x < x_end; x++) {
+			float *copy_pixel = copy_row + _number_of_channels * (block_x * (x % _stride) + x / _stride);
+			for (int ch = 0; ch < _number_of_channels; ch++) {
+				copy_pixel[ch] = row[_number_of_channels * x + ch];
+			}
+		}
+	}
+}
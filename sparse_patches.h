@@ -0,0 +1,118 @@
+/**
+ * Copyright (C) 2015, Vadim Fedorov <vadim.fedorov@upf.edu>
+ * Copyright (C) 2015, Gabriele Facciolo <facciolo@ens-cachan.fr>
+ * Copyright (C) 2015, Pablo Arias <pablo.arias@cmla.ens-cachan.fr>
+ *
+ * This program is free software: you can use, modify and/or
+ * redistribute it under the terms of the simplified BSD
+ * License. You should have received a copy of this license along
+ * this program. If not, see
+ * <http://www.opensource.org/licenses/bsd-license.html>.
+ */
+
+#ifndef SPARSE_PATCHES_H_
+#define SPARSE_PATCHES_H_
+
+#include <vector>
+#include "image.h"
+#include "mask.h"
+#include "point.h"
+#include "patch_distance_kernels.h"
+#include "quantized_patches.h"
+
+using namespace std;
+
+/**
+ * Sparse stage of the patch distances: the distance is estimated by the lattice of every n-th pixel of the patches
+ * in both directions (centered at the patch center). The values are rearranged into n x n polyphase blocks (the pixels
+ * with the same coordinates modulo n), so a row of the lattice of any patch is contiguous and is summed by the row
+ * kernels with the early termination. The weights of the lattice are scaled, so the estimate is comparable with
+ * the full distance (weighted sum per patch area).
+ *
+ * @note The estimate is not a bound of the distance. The copies are made once per initialization of the patch
+ *       distance and may be recalculated only in the modified region (see refresh()).
+ */
+class SparsePatches
+{
+public:
+	SparsePatches();
+	SparsePatches(FixedImage<float> source,
+				  FixedImage<float> target,
+				  FixedImage<float> patch_weighting,
+				  int stride,
+				  QuantizedPatches::Norm norm);
+	SparsePatches(const float *source_values,
+				  int source_stride,
+				  const float *target_values,
+				  int target_stride,
+				  Shape source_size,
+				  Shape target_size,
+				  int number_of_channels,
+				  FixedImage<float> patch_weighting,
+				  int stride,
+				  QuantizedPatches::Norm norm);
+
+	// Copies the source values (shared with the target ones) of the pixels at most 'margin' from the modified pixels again.
+	void refresh(FixedMask modified_region, int margin = 0);
+
+	bool is_empty() const;
+	int get_stride() const;		// NOTE: 1 for the empty object
+
+	/// Estimate of the distance, the summation stops as soon as the partial sum exceeds the bound.
+	inline float calculate(const Point &source_point, const Point &target_point, float bound) const
+	{
+		const float *source_values = _source_values + get_offset(source_point, _source_block_x, _source_block_y, _source_stride);
+		const float *target_values = _target_values + get_offset(target_point, _target_block_x, _target_block_y, _target_stride);
+
+		float distance = 0.0f;
+		for (int row = 0; row < _rows_count && distance < bound; row++) {
+			distance += _kernel(source_values + _source_stride * row,
+			                    target_values + _target_stride * row,
+			                    &_weights[_row_length * row],
+			                    _row_length);
+		}
+
+		return distance;
+	}
+
+private:
+	int _stride;
+	int _number_of_channels;
+	int _radius_x;				// of the lattice (in lattice pixels)
+	int _radius_y;
+	int _rows_count;
+	int _row_length;
+	vector<float> _weights;		// scaled weights of the lattice repeated for every channel
+	PatchDistanceKernels::RowKernel _kernel;
+	// original values of the source (for refresh())
+	const float *_original_values;
+	int _original_stride;
+	Shape _source_size;
+	// NOTE: the images are shared by the copies (reference counting), so the pointers stay valid
+	Image<float> _source_copy;
+	Image<float> _target_copy;
+	float *_source_values;
+	const float *_target_values;
+	int _source_block_x;		// size of a polyphase block
+	int _source_block_y;
+	int _target_block_x;
+	int _target_block_y;
+	int _source_stride;
+	int _target_stride;
+
+	/// Offset of the first lattice pixel of the patch centered at the point.
+	inline int get_offset(const Point &center, int block_x, int block_y, int stride) const
+	{
+		int x = block_x * (center.x % _stride) + center.x / _stride - _radius_x;
+		int y = block_y * (center.y % _stride) + center.y / _stride - _radius_y;
+		return stride * y + _number_of_channels * x;
+	}
+
+	void initialize(FixedImage<float> patch_weighting, QuantizedPatches::Norm norm);
+	Image<float> allocate(Shape size, int &block_x, int &block_y) const;
+	void copy(const float *values, int values_stride, Image<float> &copy, int block_x, int block_y,
+			  int x_begin, int y_begin, int x_end, int y_end) const;
+};
+
+
+#endif /* SPARSE_PATCHES_H_ */
@@ -0,0 +1,111 @@
+/**
+ * Copyright (C) 2015, Vadim Fedorov <vadim.fedorov@upf.edu>
+ * Copyright (C) 2015, Gabriele Facciolo <facciolo@ens-cachan.fr>
+ * Copyright (C) 2015, Pablo Arias <pablo.arias@cmla.ens-cachan.fr>
+ *
+ * This program is free software: you can use, modify and/or
+ * redistribute it under the terms of the simplified BSD
+ * License. You should have received a copy of this license along
+ * this program. If not, see
+ * <http://www.opensource.org/licenses/bsd-license.html>.
+ */
+
+#include "work_stealing_queue.h"
+
+WorkStealingQueue::WorkStealingQueue(int number_of_queues)
+	: _ranges(number_of_queues > 0 ? number_of_queues : 1)
+{
+	for (unsigned int i = 0; i < _ranges.size(); i++) {
+		_ranges[i].begin = 0;
+		_ranges[i].end = 0;
+#ifdef _OPENMP
+		omp_init_lock(&_ranges[i].lock);
+#endif
+	}
+}
+
+
+WorkStealingQueue::~WorkStealingQueue()
+{
+#ifdef _OPENMP
+	for (unsigned int i = 0; i < _ranges.size(); i++) {
+		omp_destroy_lock(&_ranges[i].lock);
+	}
+#endif
+}
+
+
+int WorkStealingQueue::get_number_of_queues() const
+{
+	return _ranges.size();
+}
+
+
+void WorkStealingQueue::assign(int number_of_items)
+{
+	int number_of_queues = _ranges.size();
+	for (int i = 0; i < number_of_queues; i++) {
+		_ranges[i].begin = (int)((long)number_of_items * i / number_of_queues);
+		_ranges[i].end = (int)((long)number_of_items * (i + 1) / number_of_queues);
+	}
+}
+
+
+bool WorkStealingQueue::pop(int queue, int &item)
+{
+	if (take_front(queue, item)) {
+		return true;
+	}
+
+	// own range is exhausted, steal from the others (starting from the next one)
+	int number_of_queues = _ranges.size();
+	for (int i = 1; i < number_of_queues; i++) {
+		if (take_back((queue + i) % number_of_queues, item)) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
+/* Private */
+
+inline bool WorkStealingQueue::take_front(int queue, int &item)
+{
+	Range &range = _ranges[queue];
+	bool is_taken = false;
+
+#ifdef _OPENMP
+	omp_set_lock(&range.lock);
+#endif
+	if (range.begin < range.end) {
+		item = range.begin++;
+		is_taken = true;
+	}
+#ifdef _OPENMP
+	omp_unset_lock(&range.lock);
+#endif
+
+	return is_taken;
+}
+
+
+inline bool WorkStealingQueue::take_back(int queue, int &item)
+{
+	Range &range = _ranges[queue];
+	bool is_taken = false;
+
+#ifdef _OPENMP
+	omp_set_lock(&range.lock);
+#endif
+	if (range.begin < range.end) {
+		item = --range.end;
+		is_taken = true;
+	}
+#ifdef _OPENMP
+	omp_unset_lock(&range.lock);
+#endif
+
+	return is_taken;
+}
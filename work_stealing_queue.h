@@ -0,0 +1,65 @@
+/**
+ * Copyright (C) 2015, Vadim Fedorov <vadim.fedorov@upf.edu>
+ * Copyright (C) 2015, Gabriele Facciolo <facciolo@ens-cachan.fr>
+ * Copyright (C) 2015, Pablo Arias <pablo.arias@cmla.ens-cachan.fr>
+ *
+ * This program is free software: you can use, modify and/or
+ * redistribute it under the terms of the simplified BSD
+ * License. You should have received a copy of this license along
+ * this program. If not, see
+ * <http://www.opensource.org/licenses/bsd-license.html>.
+ */
+
+#ifndef WORK_STEALING_QUEUE_H_
+#define WORK_STEALING_QUEUE_H_
+
+#include <vector>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+using namespace std;
+
+/**
+ * Distributes work items (integer indices) among a team of threads. Every
+ * thread owns a contiguous range of items and takes them from the front;
+ * a thread which runs out of items steals from the back of the other ranges.
+ *
+ * @note Without OpenMP there is no locking, a single queue should be used.
+ */
+class WorkStealingQueue
+{
+public:
+	WorkStealingQueue(int number_of_queues);
+	~WorkStealingQueue();
+
+	int get_number_of_queues() const;
+
+	/// Splits items [0, number_of_items) into contiguous ranges, one per queue. Not thread safe.
+	void assign(int number_of_items);
+
+	/// Takes the next item of the given queue or steals one from another queue.
+	/// Returns 'false', if there are no items left.
+	bool pop(int queue, int &item);
+
+private:
+	struct Range {
+		int begin;
+		int end;
+#ifdef _OPENMP
+		omp_lock_t lock;
+#endif
+	};
+
+	vector<Range> _ranges;
+
+	// not copyable (owns locks)
+	WorkStealingQueue(const WorkStealingQueue &source);
+	WorkStealingQueue& operator= (const WorkStealingQueue &other);
+
+	inline bool take_front(int queue, int &item);
+	inline bool take_back(int queue, int &item);
+};
+
+
+#endif /* WORK_STEALING_QUEUE_H_ */